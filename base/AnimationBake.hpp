@@ -0,0 +1,162 @@
+/*
+* Resampling of animation tracks to a uniform time grid
+*
+* A baked track has its keys at a fixed rate and linear interpolation, AnimationSampler finds the key of a time with
+* a direct index and blends two keys, whatever the spacing and interpolation of the source. The rate is raised until
+* the baked track stays within a given error of the source, tracks that would need too many keys are left as they are
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "AnimationSampler.hpp"
+
+namespace vkglTF
+{
+	struct AnimationBake {
+		// Points checked inside every baked interval, on top of every source key
+		static const uint32_t checksPerInterval = 8;
+
+		// Memory and evaluation cost of a track before and after baking
+		struct Report {
+			bool baked = false;
+			float rate = 0.0f; // keys per second of the baked track
+			float maxError = 0.0f; // largest difference to the source found at the checked points
+			uint32_t sourceKeys = 0;
+			uint32_t bakedKeys = 0;
+			size_t sourceBytes = 0;
+			size_t bakedBytes = 0;
+			double sourceNsPerSample = 0.0;
+			double bakedNsPerSample = 0.0;
+		};
+
+		/*
+			Resample source to linearly interpolated keys spaced uniformly from its first to its last key, at least rate
+			keys per second (adjusted so the grid ends on the last key). The rate is doubled until no checked point is
+			further than maxError from the source, up to maxRate
+			Returns false and leaves times and values empty if maxRate is not enough or the track has no duration
+		*/
+		static bool bake(const AnimationTrack &source, float rate, float maxError, float maxRate,
+						 std::vector<float> &times, std::vector<float> &values, Report &report)
+		{
+			report = Report();
+			report.sourceKeys = source.keyCount;
+			report.sourceBytes = trackBytes(source);
+			times.clear();
+			values.clear();
+			const float start = source.keyCount ? source.times[0] : 0.0f;
+			const float duration = source.duration() - start;
+			if (source.keyCount < 2 || source.components == 0 || !(duration > 0.0f) || !(rate > 0.0f)) {
+				return false;
+			}
+
+			for (; rate <= maxRate; rate *= 2.0f) {
+				const uint32_t intervals = std::max(1u, static_cast<uint32_t>(std::ceil(duration * rate)));
+				const float keyRate = static_cast<float>(intervals) / duration;
+				resample(source, start, keyRate, intervals + 1, times, values);
+
+				AnimationTrack baked = track(times, values, source.components, keyRate);
+				report.maxError = maxDifference(source, baked);
+				if (report.maxError <= maxError) {
+					report.baked = true;
+					report.rate = keyRate;
+					report.bakedKeys = baked.keyCount;
+					report.bakedBytes = trackBytes(baked);
+					report.sourceNsPerSample = nsPerSample(source);
+					report.bakedNsPerSample = nsPerSample(baked);
+					return true;
+				}
+			}
+			times.clear();
+			values.clear();
+			return false;
+		}
+
+		// Uniform linear track over times and values
+		static AnimationTrack track(const std::vector<float> &times, const std::vector<float> &values, uint32_t components, float keyRate)
+		{
+			AnimationTrack track;
+			track.times = times.data();
+			track.values = values.data();
+			track.keyCount = static_cast<uint32_t>(times.size());
+			track.components = components;
+			track.interpolation = AnimationTrack::LINEAR;
+			track.keyRate = keyRate;
+			return track;
+		}
+
+		// Memory of the times and values of a track
+		static size_t trackBytes(const AnimationTrack &track)
+		{
+			const size_t valuesPerKey = track.valuesPerKey();
+			if (track.quantizedValues) {
+				return static_cast<size_t>(track.keyCount) * (sizeof(float) + valuesPerKey * sizeof(uint16_t)) + valuesPerKey * 2 * sizeof(float);
+			}
+			return static_cast<size_t>(track.keyCount) * (1 + valuesPerKey) * sizeof(float);
+		}
+
+		// Largest difference of any component at every source key and checksPerInterval points inside every interval of track
+		static float maxDifference(const AnimationTrack &source, const AnimationTrack &track)
+		{
+			std::vector<float> expected(source.components);
+			std::vector<float> actual(source.components);
+			uint32_t sourceCursor = 0;
+			uint32_t cursor = 0;
+			float maxError = 0.0f;
+			auto check = [&](float time) {
+				AnimationSampler::sample(source, time, sourceCursor, expected.data());
+				AnimationSampler::sample(track, time, cursor, actual.data());
+				for (uint32_t c = 0; c < source.components; c++) {
+					maxError = std::max(maxError, std::fabs(expected[c] - actual[c]));
+				}
+			};
+			for (uint32_t k = 0; k < source.keyCount; k++) {
+				check(source.times[k]);
+			}
+			for (uint32_t k = 0; k + 1 < track.keyCount; k++) {
+				for (uint32_t i = 1; i <= checksPerInterval; i++) {
+					check(track.times[k] + (track.times[k + 1] - track.times[k]) * static_cast<float>(i) / static_cast<float>(checksPerInterval + 1));
+				}
+			}
+			return maxError;
+		}
+
+		// Time of one sample during playback, the track played through once at 4 samples per key
+		static double nsPerSample(const AnimationTrack &track)
+		{
+			const uint32_t sampleCount = std::min(4096u, track.keyCount * 4);
+			const float start = track.times[0];
+			const float step = (track.duration() - start) / static_cast<float>(sampleCount);
+			std::vector<float> out(track.components);
+			uint32_t cursor = 0;
+			auto begin = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < sampleCount; i++) {
+				AnimationSampler::sample(track, start + step * static_cast<float>(i), cursor, out.data());
+			}
+			const double ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - begin).count() / sampleCount;
+			// Keeps the loop from being optimized away
+			volatile float sink = out[0];
+			(void)sink;
+			return ns;
+		}
+
+	private:
+		static void resample(const AnimationTrack &source, float start, float keyRate, uint32_t keyCount, std::vector<float> &times, std::vector<float> &values)
+		{
+			times.resize(keyCount);
+			values.resize(static_cast<size_t>(keyCount) * source.components);
+			uint32_t cursor = 0;
+			for (uint32_t k = 0; k < keyCount; k++) {
+				times[k] = start + static_cast<float>(k) / keyRate;
+				AnimationSampler::sample(source, times[k], cursor, &values[static_cast<size_t>(k) * source.components]);
+			}
+		}
+	};
+}
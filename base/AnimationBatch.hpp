@@ -0,0 +1,283 @@
+/*
+* Batched keyframe sampling of one track for many instances
+*
+* Samples a track (see AnimationSampler) at a different time for every instance of a batch. The interpolation mode is
+* resolved once per batch into a kernel specialized for it. The keys and interpolation parameters of all instances
+* are found first and kept as arrays (the cubic basis is computed four instances at a time), then the values of
+* every instance are blended four components at a time, 16 bit values (see AnimationCompression) are decoded four at
+* a time just before. Gives the same result as AnimationSampler::sample
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "AnimationSampler.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VKGLTF_ANIMATION_SSE
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VKGLTF_ANIMATION_NEON
+#include <arm_neon.h>
+#endif
+
+namespace vkglTF
+{
+	class AnimationBatch {
+	public:
+		/*
+			Sample track for count instances, instance i at times[i]
+			keys holds the cursor of every instance (see AnimationSampler::advance) and is updated like by AnimationSampler::sample
+			Writes the components of instance i to out + i * outStride, outStride >= track.components
+		*/
+		static void sample(const AnimationTrack &track, const float *times, uint32_t *keys, size_t count, float *out, size_t outStride)
+		{
+			if (track.keyCount == 0) {
+				return;
+			}
+			// Keys of a 16 bit CUBICSPLINE track are decoded here right before blending them, up to two whole keys
+			std::vector<float> decoded((track.quantizedValues && track.interpolation == AnimationTrack::CUBICSPLINE) ? 2 * track.valuesPerKey() : 0);
+			for (size_t begin = 0; begin < count; begin += chunkSize) {
+				const size_t chunk = (count - begin < chunkSize) ? count - begin : chunkSize;
+				switch (track.interpolation) {
+					case AnimationTrack::STEP:
+						sampleChunk<AnimationTrack::STEP>(track, times + begin, keys + begin, chunk, out + begin * outStride, outStride, decoded.data());
+						break;
+					case AnimationTrack::CUBICSPLINE:
+						sampleChunk<AnimationTrack::CUBICSPLINE>(track, times + begin, keys + begin, chunk, out + begin * outStride, outStride, decoded.data());
+						break;
+					default:
+						sampleChunk<AnimationTrack::LINEAR>(track, times + begin, keys + begin, chunk, out + begin * outStride, outStride, decoded.data());
+				}
+			}
+		}
+
+	private:
+		// Instances whose interpolation parameters are kept on the stack at once
+		static const size_t chunkSize = 64;
+
+		template <AnimationTrack::Interpolation interpolation>
+		static void sampleChunk(const AnimationTrack &track, const float *times, uint32_t *keys, size_t count, float *out, size_t outStride, float *decoded)
+		{
+			const bool cubic = interpolation == AnimationTrack::CUBICSPLINE;
+			const uint32_t components = track.components;
+			const uint32_t keyStride = cubic ? components * 3 : components;
+
+			// Value offset of the two keys around every instance's time, holding a key is blending it with itself at t = 0
+			uint32_t first[chunkSize];
+			uint32_t second[chunkSize];
+			float t[chunkSize];
+			float tDelta[chunkSize];
+			for (size_t i = 0; i < count; i++) {
+				const AnimationSampler::Interval interval = AnimationSampler::locate(track, times[i], keys[i]);
+				first[i] = interval.key * keyStride + (cubic ? components : 0);
+				if (interpolation == AnimationTrack::STEP || interval.tDelta == 0.0f) {
+					second[i] = first[i];
+					t[i] = 0.0f;
+					tDelta[i] = 0.0f;
+				} else {
+					second[i] = first[i] + keyStride;
+					t[i] = interval.t;
+					tDelta[i] = interval.tDelta;
+				}
+			}
+
+			const uint16_t *quantized = track.quantizedValues;
+			if (interpolation == AnimationTrack::STEP) {
+				for (size_t i = 0; i < count; i++) {
+					if (quantized) {
+						decode(quantized + first[i], track.valueOffset, track.valueScale, out + i * outStride, components);
+					} else {
+						std::copy(track.values + first[i], track.values + first[i] + components, out + i * outStride);
+					}
+				}
+			} else if (interpolation == AnimationTrack::LINEAR) {
+				for (size_t i = 0; i < count; i++) {
+					if (quantized) {
+						lerpQuantized(quantized + first[i], quantized + second[i], track.valueOffset, track.valueScale, t[i], out + i * outStride, components);
+					} else {
+						lerp(track.values + first[i], track.values + second[i], t[i], out + i * outStride, components);
+					}
+				}
+			} else {
+				// Hermite basis of every instance, m0 is the out tangent of the first key, m1 the in tangent of the second
+				float p0Const[chunkSize];
+				float m0Const[chunkSize];
+				float p1Const[chunkSize];
+				float m1Const[chunkSize];
+				hermite(t, tDelta, p0Const, m0Const, p1Const, m1Const, count);
+				for (size_t i = 0; i < count; i++) {
+					if (quantized) {
+						// [value, out tangent] of the first key, [in tangent, value] of the second
+						decode(quantized + first[i], track.valueOffset + components, track.valueScale + components, decoded, 2 * components);
+						decode(quantized + second[i] - components, track.valueOffset, track.valueScale, decoded + 2 * components, 2 * components);
+						combine(p0Const[i], decoded, m0Const[i], decoded + components, p1Const[i], decoded + 3 * components, m1Const[i], decoded + 2 * components, out + i * outStride, components);
+					} else {
+						const float *v0 = track.values + first[i];
+						const float *v1 = track.values + second[i];
+						combine(p0Const[i], v0, m0Const[i], v0 + components, p1Const[i], v1, m1Const[i], v1 - components, out + i * outStride, components);
+					}
+				}
+			}
+		}
+
+		// out = offset + q * scale, in the operation order of AnimationTrack::value
+		static void decode(const uint16_t *q, const float *offset, const float *scale, float *out, uint32_t count)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 4 <= count; i += 4) {
+				const __m128 vq = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q + i)), zero));
+				_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(offset + i), _mm_mul_ps(vq, _mm_loadu_ps(scale + i))));
+			}
+#elif defined(VKGLTF_ANIMATION_NEON)
+			for (; i + 4 <= count; i += 4) {
+				const float32x4_t vq = vcvtq_f32_u32(vmovl_u16(vld1_u16(q + i)));
+				vst1q_f32(out + i, vaddq_f32(vld1q_f32(offset + i), vmulq_f32(vq, vld1q_f32(scale + i))));
+			}
+#endif
+			for (; i < count; i++) {
+				out[i] = offset[i] + static_cast<float>(q[i]) * scale[i];
+			}
+		}
+
+		// out = a + (b - a) * t, in the operation order of AnimationSampler::sample so both give the same result
+		static void lerp(const float *a, const float *b, float t, float *out, uint32_t count)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 vt = _mm_set1_ps(t);
+			for (; i + 4 <= count; i += 4) {
+				const __m128 va = _mm_loadu_ps(a + i);
+				_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), va), vt)));
+			}
+#elif defined(VKGLTF_ANIMATION_NEON)
+			const float32x4_t vt = vdupq_n_f32(t);
+			for (; i + 4 <= count; i += 4) {
+				const float32x4_t va = vld1q_f32(a + i);
+				vst1q_f32(out + i, vaddq_f32(va, vmulq_f32(vsubq_f32(vld1q_f32(b + i), va), vt)));
+			}
+#endif
+			for (; i < count; i++) {
+				out[i] = a[i] + (b[i] - a[i]) * t;
+			}
+		}
+
+		// lerp of two 16 bit keys, each decoded like by decode
+		static void lerpQuantized(const uint16_t *a, const uint16_t *b, const float *offset, const float *scale, float t, float *out, uint32_t count)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 vt = _mm_set1_ps(t);
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 4 <= count; i += 4) {
+				const __m128 vo = _mm_loadu_ps(offset + i);
+				const __m128 vs = _mm_loadu_ps(scale + i);
+				const __m128 va = _mm_add_ps(vo, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i)), zero)), vs));
+				const __m128 vb = _mm_add_ps(vo, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i)), zero)), vs));
+				_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+			}
+#elif defined(VKGLTF_ANIMATION_NEON)
+			const float32x4_t vt = vdupq_n_f32(t);
+			for (; i + 4 <= count; i += 4) {
+				const float32x4_t vo = vld1q_f32(offset + i);
+				const float32x4_t vs = vld1q_f32(scale + i);
+				const float32x4_t va = vaddq_f32(vo, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(a + i))), vs));
+				const float32x4_t vb = vaddq_f32(vo, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(b + i))), vs));
+				vst1q_f32(out + i, vaddq_f32(va, vmulq_f32(vsubq_f32(vb, va), vt)));
+			}
+#endif
+			for (; i < count; i++) {
+				const float va = offset[i] + static_cast<float>(a[i]) * scale[i];
+				const float vb = offset[i] + static_cast<float>(b[i]) * scale[i];
+				out[i] = va + (vb - va) * t;
+			}
+		}
+
+		// Cubic Hermite basis, the tangent terms are scaled by the key interval
+		static void hermite(const float *t, const float *tDelta, float *p0Const, float *m0Const, float *p1Const, float *m1Const, size_t count)
+		{
+			size_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 two = _mm_set1_ps(2.0f);
+			const __m128 three = _mm_set1_ps(3.0f);
+			const __m128 minusTwo = _mm_set1_ps(-2.0f);
+			for (; i + 4 <= count; i += 4) {
+				const __m128 vt = _mm_loadu_ps(t + i);
+				const __m128 dt = _mm_loadu_ps(tDelta + i);
+				const __m128 t2 = _mm_mul_ps(vt, vt);
+				const __m128 t3 = _mm_mul_ps(t2, vt);
+				_mm_storeu_ps(p0Const + i, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, t3), _mm_mul_ps(three, t2)), one));
+				_mm_storeu_ps(m0Const + i, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(t3, _mm_mul_ps(two, t2)), vt), dt));
+				_mm_storeu_ps(p1Const + i, _mm_add_ps(_mm_mul_ps(minusTwo, t3), _mm_mul_ps(three, t2)));
+				_mm_storeu_ps(m1Const + i, _mm_mul_ps(_mm_sub_ps(t3, t2), dt));
+			}
+#elif defined(VKGLTF_ANIMATION_NEON)
+			const float32x4_t one = vdupq_n_f32(1.0f);
+			const float32x4_t two = vdupq_n_f32(2.0f);
+			const float32x4_t three = vdupq_n_f32(3.0f);
+			const float32x4_t minusTwo = vdupq_n_f32(-2.0f);
+			for (; i + 4 <= count; i += 4) {
+				const float32x4_t vt = vld1q_f32(t + i);
+				const float32x4_t dt = vld1q_f32(tDelta + i);
+				const float32x4_t t2 = vmulq_f32(vt, vt);
+				const float32x4_t t3 = vmulq_f32(t2, vt);
+				vst1q_f32(p0Const + i, vaddq_f32(vsubq_f32(vmulq_f32(two, t3), vmulq_f32(three, t2)), one));
+				vst1q_f32(m0Const + i, vmulq_f32(vaddq_f32(vsubq_f32(t3, vmulq_f32(two, t2)), vt), dt));
+				vst1q_f32(p1Const + i, vaddq_f32(vmulq_f32(minusTwo, t3), vmulq_f32(three, t2)));
+				vst1q_f32(m1Const + i, vmulq_f32(vsubq_f32(t3, t2), dt));
+			}
+#endif
+			for (; i < count; i++) {
+				const float t2 = t[i] * t[i];
+				const float t3 = t2 * t[i];
+				p0Const[i] = 2.0f * t3 - 3.0f * t2 + 1.0f;
+				m0Const[i] = (t3 - 2.0f * t2 + t[i]) * tDelta[i];
+				p1Const[i] = -2.0f * t3 + 3.0f * t2;
+				m1Const[i] = (t3 - t2) * tDelta[i];
+			}
+		}
+
+		// out = p0Const * v0 + m0Const * m0 + p1Const * v1 + m1Const * m1
+		static void combine(float p0Const, const float *v0, float m0Const, const float *m0,
+							float p1Const, const float *v1, float m1Const, const float *m1, float *out, uint32_t count)
+		{
+			uint32_t i = 0;
+#if defined(VKGLTF_ANIMATION_SSE)
+			const __m128 p0 = _mm_set1_ps(p0Const);
+			const __m128 c0 = _mm_set1_ps(m0Const);
+			const __m128 p1 = _mm_set1_ps(p1Const);
+			const __m128 c1 = _mm_set1_ps(m1Const);
+			for (; i + 4 <= count; i += 4) {
+				__m128 sum = _mm_mul_ps(p0, _mm_loadu_ps(v0 + i));
+				sum = _mm_add_ps(sum, _mm_mul_ps(c0, _mm_loadu_ps(m0 + i)));
+				sum = _mm_add_ps(sum, _mm_mul_ps(p1, _mm_loadu_ps(v1 + i)));
+				sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_loadu_ps(m1 + i)));
+				_mm_storeu_ps(out + i, sum);
+			}
+#elif defined(VKGLTF_ANIMATION_NEON)
+			const float32x4_t p0 = vdupq_n_f32(p0Const);
+			const float32x4_t c0 = vdupq_n_f32(m0Const);
+			const float32x4_t p1 = vdupq_n_f32(p1Const);
+			const float32x4_t c1 = vdupq_n_f32(m1Const);
+			for (; i + 4 <= count; i += 4) {
+				float32x4_t sum = vmulq_f32(p0, vld1q_f32(v0 + i));
+				sum = vaddq_f32(sum, vmulq_f32(c0, vld1q_f32(m0 + i)));
+				sum = vaddq_f32(sum, vmulq_f32(p1, vld1q_f32(v1 + i)));
+				sum = vaddq_f32(sum, vmulq_f32(c1, vld1q_f32(m1 + i)));
+				vst1q_f32(out + i, sum);
+			}
+#endif
+			for (; i < count; i++) {
+				out[i] = p0Const * v0[i] + m0Const * m0[i] + p1Const * v1[i] + m1Const * m1[i];
+			}
+		}
+	};
+}
@@ -0,0 +1,180 @@
+/*
+* Keyframe reduction and 16 bit quantization of animation tracks
+*
+* Drops the keys of a track that interpolating their neighbours reproduces within a tolerance and stores the values
+* as 16 bit with a range per value of a key, AnimationSampler and AnimationBatch decode them while sampling. Only needs
+* the track, so it runs at load (Model::compressAnimationTolerance) or offline in asset tools alike
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "AnimationSampler.hpp"
+#include "AnimationBake.hpp"
+
+namespace vkglTF
+{
+	struct AnimationCompression {
+		// Keys one kept interval may span, bounds the cost of checking the dropped keys in between
+		static const uint32_t maxKeySpan = 64;
+
+		// Size and loss of a compressed track
+		struct Report {
+			bool reduced = false; // keys were dropped (LINEAR and STEP tracks with their own key spacing)
+			float maxError = 0.0f; // largest difference to the source found at the checked points (see AnimationBake::maxDifference)
+			uint32_t sourceKeys = 0;
+			uint32_t keys = 0;
+			size_t sourceBytes = 0;
+			size_t compressedBytes = 0;
+			double sourceNsPerSample = 0.0;
+			double nsPerSample = 0.0;
+
+			float ratio() const
+			{
+				return compressedBytes ? static_cast<float>(sourceBytes) / static_cast<float>(compressedBytes) : 0.0f;
+			}
+		};
+
+		/*
+			Compress source into times, values, offset and scale (see AnimationTrack::quantizedValues), no sampled point
+			is further than tolerance from the source for LINEAR and STEP tracks
+			The keys are reduced with what the quantization leaves of the tolerance. CUBICSPLINE tracks would need new
+			tangents and uniform tracks (baked, see AnimationBake) would lose their direct index, both keep all keys
+		*/
+		static void compress(const AnimationTrack &source, float tolerance, std::vector<float> &times, std::vector<uint16_t> &values,
+							 std::vector<float> &offset, std::vector<float> &scale, Report &report)
+		{
+			report = Report();
+			report.sourceKeys = source.keyCount;
+			report.sourceBytes = AnimationBake::trackBytes(source);
+			times.clear();
+			values.clear();
+			const uint32_t valuesPerKey = source.valuesPerKey();
+
+			// Range of every value of a key, a 16 bit step is scale
+			offset.assign(valuesPerKey, 0.0f);
+			scale.assign(valuesPerKey, 0.0f);
+			float maxStep = 0.0f;
+			for (uint32_t i = 0; i < valuesPerKey && source.keyCount > 0; i++) {
+				float low = source.value(0, i);
+				float high = low;
+				for (uint32_t k = 1; k < source.keyCount; k++) {
+					low = std::min(low, source.value(k, i));
+					high = std::max(high, source.value(k, i));
+				}
+				offset[i] = low;
+				scale[i] = (high - low) / 65535.0f;
+				maxStep = std::max(maxStep, scale[i]);
+			}
+
+			std::vector<uint32_t> kept;
+			const bool reducible = source.interpolation != AnimationTrack::CUBICSPLINE && source.keyRate == 0.0f;
+			if (reducible) {
+				reduce(source, std::max(0.0f, tolerance - 0.5f * maxStep), kept);
+				report.reduced = kept.size() < source.keyCount;
+			} else {
+				for (uint32_t k = 0; k < source.keyCount; k++) {
+					kept.push_back(k);
+				}
+			}
+
+			times.resize(kept.size());
+			values.resize(kept.size() * valuesPerKey);
+			for (size_t k = 0; k < kept.size(); k++) {
+				times[k] = source.times[kept[k]];
+				for (uint32_t i = 0; i < valuesPerKey; i++) {
+					const float q = (scale[i] > 0.0f) ? std::round((source.value(kept[k], i) - offset[i]) / scale[i]) : 0.0f;
+					values[k * valuesPerKey + i] = static_cast<uint16_t>(std::min(std::max(q, 0.0f), 65535.0f));
+				}
+			}
+
+			if (source.keyCount > 0) {
+				AnimationTrack compressed = track(times, values, offset, scale, source);
+				report.keys = compressed.keyCount;
+				report.compressedBytes = AnimationBake::trackBytes(compressed);
+				report.maxError = AnimationBake::maxDifference(source, compressed);
+				report.sourceNsPerSample = AnimationBake::nsPerSample(source);
+				report.nsPerSample = AnimationBake::nsPerSample(compressed);
+			}
+		}
+
+		// Compressed track over times, values, offset and scale, with the components and interpolation of source
+		static AnimationTrack track(const std::vector<float> &times, const std::vector<uint16_t> &values, const std::vector<float> &offset,
+									const std::vector<float> &scale, const AnimationTrack &source)
+		{
+			AnimationTrack track;
+			track.times = times.data();
+			track.quantizedValues = values.data();
+			track.valueOffset = offset.data();
+			track.valueScale = scale.data();
+			track.keyCount = static_cast<uint32_t>(times.size());
+			track.components = source.components;
+			track.interpolation = source.interpolation;
+			// Dropped keys break the uniform spacing
+			track.keyRate = (times.size() == source.keyCount) ? source.keyRate : 0.0f;
+			return track;
+		}
+
+	private:
+		/*
+			Keys of a LINEAR or STEP track to keep, the first and last key always are
+			Greedy: the interval from the last kept key grows as long as every key inside it is within tolerance of
+			interpolating its ends (LINEAR) or holding its start (STEP)
+		*/
+		static void reduce(const AnimationTrack &source, float tolerance, std::vector<uint32_t> &kept)
+		{
+			kept.clear();
+			if (source.keyCount == 0) {
+				return;
+			}
+			kept.push_back(0);
+			const bool step = source.interpolation == AnimationTrack::STEP;
+			uint32_t start = 0;
+			for (uint32_t end = 2; end < source.keyCount; end++) {
+				if (end - start > maxKeySpan || !(step ? holds(source, start, end - 1, tolerance) : interpolates(source, start, end, tolerance))) {
+					start = end - 1;
+					kept.push_back(start);
+				}
+			}
+			if (source.keyCount > 1) {
+				kept.push_back(source.keyCount - 1);
+			}
+		}
+
+		// Keys between start and end are within tolerance of the line between them, with the sampler's blend factor
+		static bool interpolates(const AnimationTrack &source, uint32_t start, uint32_t end, float tolerance)
+		{
+			const float tDelta = source.times[end] - source.times[start];
+			if (!(tDelta > 0.0f)) {
+				return false;
+			}
+			for (uint32_t k = start + 1; k < end; k++) {
+				const float t = (source.times[k] - source.times[start]) / tDelta;
+				for (uint32_t i = 0; i < source.components; i++) {
+					const float v0 = source.value(start, i);
+					if (std::fabs(v0 + (source.value(end, i) - v0) * t - source.value(k, i)) > tolerance) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		// Key is within tolerance of the value held from start
+		static bool holds(const AnimationTrack &source, uint32_t start, uint32_t key, float tolerance)
+		{
+			for (uint32_t i = 0; i < source.components; i++) {
+				if (std::fabs(source.value(key, i) - source.value(start, i)) > tolerance) {
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+}
@@ -0,0 +1,285 @@
+/*
+* Keyframe sampling of glTF animation tracks
+*
+* Evaluates a track (times and values of one glTF animation sampler) at any time, independent of the model the
+* data came from. Seeking binary searches the keys, coherent playback keeps a cursor per track and only steps
+* over the few keys passed since the last update, so both playback and scrubbing long tracks stay cheap.
+* Tracks with uniformly spaced keys (see AnimationBake) find their key with a direct index, tracks with 16 bit values
+* (see AnimationCompression) are decoded while they are sampled
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+namespace vkglTF
+{
+	/*
+		Keyframes of one glTF animation sampler, points into data owned by the caller (e.g. Mesh::weightsTime and weightsData)
+		Every key has components values, CUBICSPLINE keys are [in tangents, values, out tangents] (3 * components)
+		Values are either floats (values) or 16 bit (quantizedValues, values is null), value i of a key is then
+		valueOffset[i] + quantizedValues[key * valuesPerKey() + i] * valueScale[i]
+	*/
+	struct AnimationTrack {
+		enum Interpolation {LINEAR, STEP, CUBICSPLINE};
+		const float *times = nullptr;
+		const float *values = nullptr;
+		uint32_t keyCount = 0;
+		uint32_t components = 0;
+		Interpolation interpolation = LINEAR;
+		// Keys per second if key k is at times[0] + k / keyRate (baked tracks), 0 for any other spacing
+		float keyRate = 0.0f;
+		const uint16_t *quantizedValues = nullptr;
+		const float *valueOffset = nullptr; // valuesPerKey() floats each
+		const float *valueScale = nullptr;
+
+		float duration() const
+		{
+			return keyCount ? times[keyCount - 1] : 0.0f;
+		}
+
+		uint32_t valuesPerKey() const
+		{
+			return (interpolation == CUBICSPLINE) ? components * 3 : components;
+		}
+
+		// Value i of key, i < valuesPerKey()
+		float value(uint32_t key, uint32_t i) const
+		{
+			const size_t index = static_cast<size_t>(key) * valuesPerKey() + i;
+			return quantizedValues ? valueOffset[i] + static_cast<float>(quantizedValues[index]) * valueScale[i] : values[index];
+		}
+	};
+
+	class AnimationSampler {
+	public:
+		// Keys a cursor steps over before advance falls back to a binary search
+		static const uint32_t maxCursorSteps = 4;
+
+		/*
+			Key starting the interval time falls into, the last key with times[key] <= time (0 before the first key)
+			Binary search, O(log n) for any jump along the track, a direct index for uniformly spaced keys
+		*/
+		static uint32_t seek(const AnimationTrack &track, float time)
+		{
+			if (track.keyCount < 2) {
+				return 0;
+			}
+			if (track.keyRate > 0.0f) {
+				return uniformKey(track, (time - track.times[0]) * track.keyRate);
+			}
+			const float *upper = std::upper_bound(track.times, track.times + track.keyCount, time);
+			return (upper == track.times) ? 0 : static_cast<uint32_t>(upper - track.times) - 1;
+		}
+
+		/*
+			Same result as seek, starting at the key of the last update (the caller's cursor)
+			Playback only passes a few keys per update in either direction, those are stepped over, larger jumps
+			(scrubbing, wrapping around the loop) binary search
+		*/
+		static uint32_t advance(const AnimationTrack &track, float time, uint32_t key)
+		{
+			if (track.keyCount < 2) {
+				return 0;
+			}
+			if (track.keyRate > 0.0f) {
+				return seek(track, time);
+			}
+			const uint32_t last = track.keyCount - 1;
+			key = std::min(key, last);
+			for (uint32_t step = 0; step < maxCursorSteps; step++) {
+				if (time < track.times[key]) {
+					if (key == 0) {
+						return 0;
+					}
+					key--;
+				} else if (key < last && time >= track.times[key + 1]) {
+					key++;
+				} else {
+					return key;
+				}
+			}
+			return seek(track, time);
+		}
+
+		// Where a time falls on a track: between key and key + 1 at t (0 to 1) of the tDelta seconds between them
+		// tDelta is 0 if the value of key is held (before the first key, on a key, after the last key)
+		struct Interval {
+			uint32_t key;
+			float t;
+			float tDelta;
+		};
+
+		/*
+			Interval of time, key is the caller's cursor (see advance) and is updated to the interval's key
+		*/
+		static Interval locate(const AnimationTrack &track, float time, uint32_t &key)
+		{
+			Interval interval = { 0, 0.0f, 0.0f };
+			if (track.keyCount < 2) {
+				key = 0;
+				return interval;
+			}
+			const uint32_t last = track.keyCount - 1;
+			if (track.keyRate > 0.0f) {
+				// The position on the grid gives both the key and the blend factor
+				const float position = (time - track.times[0]) * track.keyRate;
+				key = uniformKey(track, position);
+				interval.key = key;
+				if (key < last && position > static_cast<float>(key)) {
+					interval.t = position - static_cast<float>(key);
+					interval.tDelta = 1.0f / track.keyRate;
+				}
+				return interval;
+			}
+			key = advance(track, time, key);
+			interval.key = key;
+			if (key < last && time > track.times[key]) {
+				interval.tDelta = track.times[key + 1] - track.times[key];
+				interval.t = (time - track.times[key]) / interval.tDelta;
+			}
+			return interval;
+		}
+
+		/*
+			Sample track at time (in seconds) into out, components floats
+			key is the caller's cursor into the track, updated to the key of time. The values of the first and last
+			key are held before and after the track
+		*/
+		static void sample(const AnimationTrack &track, float time, uint32_t &key, float *out)
+		{
+			if (track.keyCount == 0) {
+				return;
+			}
+			const Interval interval = locate(track, time, key);
+			if (track.quantizedValues) {
+				blend(QuantizedValues(track), track, interval, out);
+			} else {
+				blend(FloatValues(track), track, interval, out);
+			}
+		}
+
+	private:
+		// Value i of key for blend, the float and 16 bit variants
+		struct FloatValues {
+			const float *values;
+			uint32_t keyStride;
+			FloatValues(const AnimationTrack &track) : values(track.values), keyStride(track.valuesPerKey()) {}
+			float operator()(uint32_t key, uint32_t i) const
+			{
+				return values[static_cast<size_t>(key) * keyStride + i];
+			}
+		};
+		struct QuantizedValues {
+			const uint16_t *values;
+			const float *offset;
+			const float *scale;
+			uint32_t keyStride;
+			QuantizedValues(const AnimationTrack &track)
+				: values(track.quantizedValues), offset(track.valueOffset), scale(track.valueScale), keyStride(track.valuesPerKey()) {}
+			// Same operation order as AnimationTrack::value
+			float operator()(uint32_t key, uint32_t i) const
+			{
+				return offset[i] + static_cast<float>(values[static_cast<size_t>(key) * keyStride + i]) * scale[i];
+			}
+		};
+
+		template <typename Values>
+		static void blend(const Values &value, const AnimationTrack &track, const Interval &interval, float *out)
+		{
+			const uint32_t components = track.components;
+			const bool cubic = track.interpolation == AnimationTrack::CUBICSPLINE;
+			const uint32_t v = cubic ? components : 0; // first value of a key, in tangents come before
+			const uint32_t k0 = interval.key;
+			if (track.interpolation == AnimationTrack::STEP || interval.tDelta == 0.0f) {
+				for (uint32_t i = 0; i < components; i++) {
+					out[i] = value(k0, v + i);
+				}
+				return;
+			}
+
+			const uint32_t k1 = k0 + 1;
+			const float t = interval.t;
+			if (!cubic) {
+				for (uint32_t i = 0; i < components; i++) {
+					const float v0 = value(k0, i);
+					out[i] = v0 + (value(k1, i) - v0) * t;
+				}
+				return;
+			}
+
+			// https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#appendix-c-spline-interpolation
+			// p(t) = (2t^3 - 3t^2 + 1)p0 + (t^3 - 2t^2 + t)m0 + (-2t^3 + 3t^2)p1 + (t^3 - t^2)m1
+			const float t2 = t * t;
+			const float t3 = t2 * t;
+			const float p0Const = 2.0f * t3 - 3.0f * t2 + 1.0f;
+			const float m0Const = (t3 - 2.0f * t2 + t) * interval.tDelta;
+			const float p1Const = -2.0f * t3 + 3.0f * t2;
+			const float m1Const = (t3 - t2) * interval.tDelta;
+			for (uint32_t i = 0; i < components; i++) {
+				// m0 is the out tangent of key, m1 the in tangent of key + 1
+				out[i] = p0Const * value(k0, v + i) + m0Const * value(k0, 2 * components + i) + p1Const * value(k1, v + i) + m1Const * value(k1, i);
+			}
+		}
+
+		// Key of a position on a uniform grid (in keys from the first one), clamped to the track
+		static uint32_t uniformKey(const AnimationTrack &track, float position)
+		{
+			if (!(position > 0.0f)) {
+				return 0;
+			}
+			const uint32_t last = track.keyCount - 1;
+			return (position >= static_cast<float>(last)) ? last : static_cast<uint32_t>(position);
+		}
+	};
+
+	/*
+		Playback time of one animated object
+		rate scales the time step (negative plays backwards), offset shifts the sampled time along the clip, e.g. so
+		copies of one model do not move in sync. Loops over [0, duration) or holds at the ends if loop is false
+	*/
+	struct AnimationPlayback {
+		float time = 0.0f; // in seconds, kept inside the clip
+		float rate = 1.0f;
+		float offset = 0.0f;
+		float duration = 0.0f;
+		bool loop = true;
+
+		// Move by deltaTime seconds of wall time
+		void advance(float deltaTime)
+		{
+			time = wrap(time + deltaTime * rate);
+		}
+
+		// Jump to a time, e.g. when scrubbing
+		void seek(float newTime)
+		{
+			time = wrap(newTime);
+		}
+
+		// Time to sample the tracks at
+		float clipTime() const
+		{
+			return wrap(time + offset);
+		}
+
+		float wrap(float t) const
+		{
+			if (duration <= 0.0f) {
+				return 0.0f;
+			}
+			if (t >= 0.0f && t < duration) {
+				return t;
+			}
+			if (!loop) {
+				return std::min(std::max(t, 0.0f), duration);
+			}
+			t = std::fmod(t, duration);
+			return (t < 0.0f) ? t + duration : t;
+		}
+	};
+}
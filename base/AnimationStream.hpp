@@ -0,0 +1,341 @@
+/*
+* Streaming playback of long animation tracks
+*
+* Keeps only a window of a track in memory. The keys are split into chunks of keysPerChunk keys, a loader thread reads
+* the chunks around the playhead from the file holding the track (the glTF buffer or a sidecar file) into a fixed number
+* of slots. Sampling never waits for the file: a chunk that is not loaded yet is requested and the time is sampled from
+* a coarse preview (the first key of every chunk) meanwhile. Memory is the slots plus the preview, so a take of hours
+* needs about as much as one of minutes
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AnimationSampler.hpp"
+
+namespace vkglTF
+{
+	class AnimationStream {
+	public:
+		// Where the keys of a track are in a file, times and values as tightly packed floats (see AnimationTrack)
+		struct Source {
+			std::string path;
+			uint64_t timesOffset = 0;
+			uint64_t valuesOffset = 0;
+			uint32_t keyCount = 0;
+			uint32_t components = 0;
+			AnimationTrack::Interpolation interpolation = AnimationTrack::LINEAR;
+		};
+
+		// Samples served from a loaded chunk (hits) or the preview (misses), and chunks read by the loader
+		struct Stats {
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t loads;
+		};
+
+		static const uint32_t defaultKeysPerChunk = 256;
+		static const uint32_t defaultCacheChunks = 8;
+		// Chunks requested ahead of the one being sampled (plus the one before it, for playing backwards)
+		static const uint32_t prefetchChunks = 2;
+
+		AnimationStream() {}
+		AnimationStream(const AnimationStream&) = delete;
+		AnimationStream& operator=(const AnimationStream&) = delete;
+
+		~AnimationStream()
+		{
+			close();
+		}
+
+		/*
+			Read the preview and the first chunk of source and start the loader thread, keeping up to cacheChunks chunks
+			(at least prefetchChunks + 2) of keysPerChunk keys. Returns false if the file is missing or too short
+		*/
+		bool open(const Source &trackSource, uint32_t keysPerChunk = defaultKeysPerChunk, uint32_t cacheChunks = defaultCacheChunks)
+		{
+			close();
+			source = trackSource;
+			chunkKeys = std::max(1u, keysPerChunk);
+			valuesPerKey = (source.interpolation == AnimationTrack::CUBICSPLINE) ? source.components * 3 : source.components;
+			if (source.keyCount == 0 || source.components == 0) {
+				return false;
+			}
+			file.open(source.path.c_str(), std::ios::binary);
+			file.seekg(0, std::ios::end);
+			const uint64_t fileSize = file ? static_cast<uint64_t>(file.tellg()) : 0;
+			if (source.timesOffset + uint64_t(source.keyCount) * sizeof(float) > fileSize ||
+				source.valuesOffset + uint64_t(source.keyCount) * valuesPerKey * sizeof(float) > fileSize) {
+				file.close();
+				return false;
+			}
+
+			// First key of every chunk and the last key, the values without tangents
+			chunkCount = (source.keyCount + chunkKeys - 1) / chunkKeys;
+			previewTimes.resize(chunkCount + 1);
+			previewValues.resize(static_cast<size_t>(chunkCount + 1) * source.components);
+			const uint32_t valueOffset = (source.interpolation == AnimationTrack::CUBICSPLINE) ? source.components : 0;
+			for (uint32_t c = 0; c <= chunkCount; c++) {
+				const uint32_t key = std::min(c * chunkKeys, source.keyCount - 1);
+				if (!read(source.timesOffset + uint64_t(key) * sizeof(float), &previewTimes[c], 1) ||
+					!read(source.valuesOffset + (uint64_t(key) * valuesPerKey + valueOffset) * sizeof(float), &previewValues[static_cast<size_t>(c) * source.components], source.components)) {
+					file.close();
+					return false;
+				}
+			}
+
+			const uint32_t slotCount = std::max(cacheChunks, prefetchChunks + 2);
+			slots.assign(slotCount, std::shared_ptr<const Chunk>());
+			resident.reset(new std::atomic<uint32_t>[slotCount]);
+			pending.reset(new std::atomic<uint32_t>[slotCount]);
+			for (uint32_t s = 0; s < slotCount; s++) {
+				resident[s].store(noChunk);
+				pending[s].store(noChunk);
+			}
+			hits.store(0);
+			misses.store(0);
+			loads.store(0);
+			// Playback starts at the first chunk, loaded right away so the first frames do not use the preview
+			load(0);
+			stopping = false;
+			loader = std::thread(&AnimationStream::run, this);
+			return true;
+		}
+
+		// Stop the loader thread and release the chunks
+		void close()
+		{
+			if (loader.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+				wake.notify_all();
+				loader.join();
+			}
+			requests.clear();
+			slots.clear();
+			file.close();
+		}
+
+		/*
+			Sample the track at time into out (components floats), like AnimationSampler::sample with key as the cursor
+			(an index into the whole track). Never waits for the file, returns false if the time was sampled from the preview
+		*/
+		bool sample(float time, uint32_t &key, float *out)
+		{
+			std::shared_ptr<const Chunk> chunk;
+			const bool hit = sample(time, key, out, chunk);
+			(hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+			return hit;
+		}
+
+		// Sample count instances like sample, instance i at times[i] with cursor keys[i] into out + i * outStride
+		void sample(const float *times, uint32_t *keys, size_t count, float *out, size_t outStride)
+		{
+			// Consecutive instances usually fall into the same chunk, it is only looked up when that changes
+			std::shared_ptr<const Chunk> chunk;
+			uint64_t hitCount = 0;
+			for (size_t i = 0; i < count; i++) {
+				hitCount += sample(times[i], keys[i], out + i * outStride, chunk) ? 1 : 0;
+			}
+			hits.fetch_add(hitCount, std::memory_order_relaxed);
+			misses.fetch_add(count - hitCount, std::memory_order_relaxed);
+		}
+
+		float duration() const
+		{
+			return previewTimes.empty() ? 0.0f : previewTimes.back();
+		}
+
+		uint32_t keyCount() const
+		{
+			return source.keyCount;
+		}
+
+		// Largest memory the chunks and the preview take, and what the whole track would
+		size_t residentBytes() const
+		{
+			return (previewTimes.size() + previewValues.size() + slots.size() * static_cast<size_t>(chunkKeys + 1) * (1 + valuesPerKey)) * sizeof(float);
+		}
+
+		size_t trackBytes() const
+		{
+			return static_cast<size_t>(source.keyCount) * (1 + valuesPerKey) * sizeof(float);
+		}
+
+		Stats stats() const
+		{
+			return Stats{ hits.load(), misses.load(), loads.load() };
+		}
+
+	private:
+		// Keys firstKey to firstKey + keysPerChunk of the track, one more than the chunk so its last interval is complete
+		struct Chunk {
+			uint32_t index;
+			uint32_t firstKey;
+			std::vector<float> times;
+			std::vector<float> values;
+		};
+		static const uint32_t noChunk = UINT32_MAX;
+
+		Source source;
+		uint32_t chunkKeys = defaultKeysPerChunk;
+		uint32_t chunkCount = 0;
+		uint32_t valuesPerKey = 0;
+		std::vector<float> previewTimes;
+		std::vector<float> previewValues;
+		// Chunk c goes to slot c % slots.size(), read and replaced with std::atomic_load and std::atomic_store
+		std::vector<std::shared_ptr<const Chunk>> slots;
+		// Chunk loaded into and chunk requested for every slot, so checking a chunk does not touch the slot itself
+		std::unique_ptr<std::atomic<uint32_t>[]> resident;
+		std::unique_ptr<std::atomic<uint32_t>[]> pending;
+		std::atomic<uint64_t> hits{ 0 };
+		std::atomic<uint64_t> misses{ 0 };
+		std::atomic<uint64_t> loads{ 0 };
+
+		// Only read by the loader thread once it runs
+		std::ifstream file;
+		std::thread loader;
+		// Guards requests and stopping, never held while reading the file
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<uint32_t> requests;
+		bool stopping = false;
+
+		// chunk holds the chunk of the last sample and is reused if time falls into it again
+		bool sample(float time, uint32_t &key, float *out, std::shared_ptr<const Chunk> &chunk)
+		{
+			const uint32_t c = chunkOf(time);
+			if (!chunk || chunk->index != c) {
+				chunk = std::atomic_load(&slots[c % slots.size()]);
+				if (chunk && chunk->index != c) {
+					chunk.reset();
+				}
+				prefetch(c);
+			}
+			if (!chunk) {
+				AnimationTrack preview;
+				preview.times = previewTimes.data();
+				preview.values = previewValues.data();
+				preview.keyCount = static_cast<uint32_t>(previewTimes.size());
+				preview.components = source.components;
+				preview.interpolation = (source.interpolation == AnimationTrack::STEP) ? AnimationTrack::STEP : AnimationTrack::LINEAR;
+				uint32_t previewKey = 0;
+				AnimationSampler::sample(preview, time, previewKey, out);
+				return false;
+			}
+			AnimationTrack track;
+			track.times = chunk->times.data();
+			track.values = chunk->values.data();
+			track.keyCount = static_cast<uint32_t>(chunk->times.size());
+			track.components = source.components;
+			track.interpolation = source.interpolation;
+			uint32_t chunkKey = (key >= chunk->firstKey) ? key - chunk->firstKey : 0;
+			AnimationSampler::sample(track, time, chunkKey, out);
+			key = chunk->firstKey + chunkKey;
+			return true;
+		}
+
+		// Chunk whose keys cover time, the first one before the track and the last one after it
+		uint32_t chunkOf(float time) const
+		{
+			const float *upper = std::upper_bound(previewTimes.data(), previewTimes.data() + chunkCount, time);
+			return (upper == previewTimes.data()) ? 0 : static_cast<uint32_t>(upper - previewTimes.data()) - 1;
+		}
+
+		// Request chunk c if missing, the next prefetchChunks (wrapping around for looped playback) and the one before
+		void prefetch(uint32_t c)
+		{
+			request(c);
+			for (uint32_t i = 1; i <= prefetchChunks && i < chunkCount; i++) {
+				request((c + i) % chunkCount);
+			}
+			if (chunkCount > prefetchChunks + 1) {
+				request((c + chunkCount - 1) % chunkCount);
+			}
+		}
+
+		void request(uint32_t c)
+		{
+			const uint32_t s = c % static_cast<uint32_t>(slots.size());
+			if (resident[s].load(std::memory_order_acquire) == c || pending[s].load(std::memory_order_relaxed) == c) {
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending[s].store(c, std::memory_order_relaxed);
+				requests.push_back(c);
+				// The playhead moved on, requests older than a cache full are not worth reading anymore
+				while (requests.size() > slots.size()) {
+					uint32_t dropped = requests.front();
+					requests.pop_front();
+					pending[dropped % slots.size()].compare_exchange_strong(dropped, noChunk);
+				}
+			}
+			wake.notify_one();
+		}
+
+		void run()
+		{
+			for (;;) {
+				uint32_t c;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+					if (stopping) {
+						return;
+					}
+					c = requests.front();
+					requests.pop_front();
+				}
+				const uint32_t s = c % static_cast<uint32_t>(slots.size());
+				if (resident[s].load(std::memory_order_acquire) != c) {
+					load(c);
+				}
+				uint32_t expected = c;
+				pending[s].compare_exchange_strong(expected, noChunk);
+			}
+		}
+
+		// Read chunk c into its slot, replacing the chunk there
+		void load(uint32_t c)
+		{
+			std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+			chunk->index = c;
+			chunk->firstKey = c * chunkKeys;
+			const uint32_t count = std::min(chunkKeys + 1, source.keyCount - chunk->firstKey);
+			chunk->times.resize(count);
+			chunk->values.resize(static_cast<size_t>(count) * valuesPerKey);
+			if (!read(source.timesOffset + uint64_t(chunk->firstKey) * sizeof(float), chunk->times.data(), count) ||
+				!read(source.valuesOffset + uint64_t(chunk->firstKey) * valuesPerKey * sizeof(float), chunk->values.data(), chunk->values.size())) {
+				return;
+			}
+			const uint32_t s = c % static_cast<uint32_t>(slots.size());
+			std::atomic_store(&slots[s], std::shared_ptr<const Chunk>(chunk));
+			resident[s].store(c, std::memory_order_release);
+			loads.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		bool read(uint64_t offset, float *out, size_t count)
+		{
+			file.clear();
+			file.seekg(static_cast<std::streamoff>(offset));
+			file.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(count * sizeof(float)));
+			return static_cast<size_t>(file.gcount()) == count * sizeof(float);
+		}
+	};
+}
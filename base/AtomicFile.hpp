@@ -0,0 +1,51 @@
+/*
+* Atomic file writes
+*
+* Replaces a file only once its new content has been written completely, used for the caches that are rebuilt
+* while the old file may still be read on the next start
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+
+namespace vks
+{
+	/*
+		Write the content produced by write to filename, returns false if the file could not be written
+		Written to a temporary file first so a crash never leaves a truncated file behind
+	*/
+	inline bool writeFileAtomic(const std::string &filename, const std::function<void(std::ofstream&)> &write)
+	{
+		const std::string tempFile = filename + ".tmp";
+		std::ofstream out(tempFile.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+		write(out);
+		out.close();
+		if (!out) {
+			std::remove(tempFile.c_str());
+			return false;
+		}
+		// rename() does not replace an existing file on Windows
+		std::remove(filename.c_str());
+		if (std::rename(tempFile.c_str(), filename.c_str()) != 0) {
+			std::remove(tempFile.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	inline bool writeFileAtomic(const std::string &filename, const void *data, size_t size)
+	{
+		return writeFileAtomic(filename, [&](std::ofstream &out) {
+			out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		});
+	}
+}
@@ -0,0 +1,134 @@
+/*
+* Read only memory mapped file
+*
+* Maps a whole file into the address space so large binary data (model caches, glTF buffers) can be read,
+* or copied straight into staging buffers, without first reading it into a heap allocation
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !defined(__ANDROID__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	class MappedFile {
+	public:
+		MappedFile() {}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		/*
+			Map the whole file, returns false if it does not exist or can not be mapped (always on Android, use the asset manager there)
+		*/
+		bool open(const std::string &filename)
+		{
+			close();
+#if defined(_WIN32)
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL) {
+				close();
+				return false;
+			}
+			mappedData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (mappedData == NULL) {
+				close();
+				return false;
+			}
+			mappedSize = static_cast<size_t>(fileSize.QuadPart);
+			return true;
+#elif !defined(__ANDROID__)
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+				::close(fd);
+				return false;
+			}
+			void *mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			// The mapping stays valid after the descriptor is closed
+			::close(fd);
+			if (mapped == MAP_FAILED) {
+				return false;
+			}
+			mappedData = mapped;
+			mappedSize = static_cast<size_t>(fileStat.st_size);
+			return true;
+#else
+			(void)filename;
+			return false;
+#endif
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (mappedData) {
+				UnmapViewOfFile(mappedData);
+			}
+			if (mapping != NULL) {
+				CloseHandle(mapping);
+				mapping = NULL;
+			}
+			if (file != INVALID_HANDLE_VALUE) {
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+			}
+#elif !defined(__ANDROID__)
+			if (mappedData) {
+				munmap(mappedData, mappedSize);
+			}
+#endif
+			mappedData = nullptr;
+			mappedSize = 0;
+		}
+
+		const unsigned char* data() const
+		{
+			return static_cast<const unsigned char*>(mappedData);
+		}
+
+		size_t size() const
+		{
+			return mappedSize;
+		}
+
+	private:
+		void *mappedData = nullptr;
+		size_t mappedSize = 0;
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#endif
+	};
+}
@@ -0,0 +1,172 @@
+/*
+* Binary cache format of vkglTF::Model
+*
+* Stores the final packed vertex, index and morph target data plus the mesh and animation tables, so a model
+* can be loaded without parsing the glTF JSON and repacking it in loadNode (see Model::loadFromCache)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace vkglTF
+{
+	namespace cache
+	{
+		// Bump whenever the layout of a section or of the data the loader produces changes
+		const uint32_t VERSION = 3;
+		const uint32_t MAGIC = 0x43474b56; // "VKGC"
+		// Every section starts 16 byte aligned in the file, so mapped sections can be read as vertex or float data directly
+		const uint64_t SECTION_ALIGNMENT = 16;
+
+		enum SectionId {
+			SECTION_DEPENDENCIES = 0, // source files the cache was built from
+			SECTION_MODEL,            // nodes, meshes, primitives and animation curves
+			SECTION_VERTICES_MORPH,
+			SECTION_INDICES_MORPH,
+			SECTION_VERTICES_NORMAL,
+			SECTION_INDICES_NORMAL,
+			SECTION_MORPH_TARGETS,    // Model::morphVertexData
+			SECTION_MORPH_WEIGHTS,    // Model::morphWeightData
+			SECTION_COUNT
+		};
+
+		struct Header {
+			uint32_t magic;
+			uint32_t version;
+			// Hash of the load options and the content of every dependency, the cache is stale if it differs
+			uint64_t sourceHash;
+			uint32_t vertexSize; // sizeof(Model::Vertex) of the writer
+			uint32_t sectionCount;
+		};
+
+		struct Section {
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		/*
+			64 bit hash over 8 byte words (FNV-1a style with a final mix), fast enough to key the cache on the
+			whole content of the source files
+		*/
+		inline uint64_t hash(const void *data, size_t size, uint64_t seed)
+		{
+			const uint64_t prime = 0x100000001b3ull;
+			uint64_t h = seed ^ (size * prime);
+			const unsigned char *bytes = static_cast<const unsigned char*>(data);
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				uint64_t word;
+				memcpy(&word, &bytes[i], sizeof(word));
+				h = (h ^ word) * prime;
+				h ^= h >> 29;
+			}
+			for (; i < size; i++) {
+				h = (h ^ bytes[i]) * prime;
+			}
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		/*
+			Appends plain values and arrays to a byte buffer
+		*/
+		class Writer {
+		public:
+			std::vector<char> data;
+
+			template <typename T>
+			void write(const T &value)
+			{
+				const char *bytes = reinterpret_cast<const char*>(&value);
+				data.insert(data.end(), bytes, bytes + sizeof(T));
+			}
+
+			template <typename T>
+			void write(const std::vector<T> &values)
+			{
+				write(static_cast<uint64_t>(values.size()));
+				const char *bytes = reinterpret_cast<const char*>(values.data());
+				data.insert(data.end(), bytes, bytes + values.size() * sizeof(T));
+			}
+
+			void write(const std::string &value)
+			{
+				write(static_cast<uint64_t>(value.size()));
+				data.insert(data.end(), value.begin(), value.end());
+			}
+		};
+
+		/*
+			Reads back what Writer wrote, every read is bounds checked and fails the reader instead of reading past the end
+		*/
+		class Reader {
+		public:
+			Reader(const unsigned char *data, size_t size) : data(data), size(size) {}
+
+			bool ok() const
+			{
+				return valid;
+			}
+
+			template <typename T>
+			bool read(T &value)
+			{
+				if (!take(sizeof(T))) {
+					return false;
+				}
+				memcpy(&value, &data[offset - sizeof(T)], sizeof(T));
+				return true;
+			}
+
+			template <typename T>
+			bool read(std::vector<T> &values)
+			{
+				uint64_t count;
+				if (!read(count) || count > (size - offset) / sizeof(T)) {
+					valid = false;
+					return false;
+				}
+				values.resize(static_cast<size_t>(count));
+				if (count > 0) {
+					memcpy(values.data(), &data[offset], static_cast<size_t>(count) * sizeof(T));
+				}
+				offset += static_cast<size_t>(count) * sizeof(T);
+				return true;
+			}
+
+			bool read(std::string &value)
+			{
+				std::vector<char> chars;
+				if (!read(chars)) {
+					return false;
+				}
+				value.assign(chars.begin(), chars.end());
+				return true;
+			}
+
+		private:
+			const unsigned char *data;
+			size_t size;
+			size_t offset = 0;
+			bool valid = true;
+
+			bool take(size_t bytes)
+			{
+				if (!valid || bytes > size - offset) {
+					valid = false;
+					return false;
+				}
+				offset += bytes;
+				return true;
+			}
+		};
+	}
+}
@@ -0,0 +1,140 @@
+/*
+* Playback state of one copy of a vkglTF::Model
+*
+* The model holds everything that can be shared (GPU buffers, packed morph data, animation curves), an instance
+* only its transform, playback and keyframe cursors, so many independently animated copies share one loaded model
+* and can be updated from several threads at once
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "VulkanglTFModel.hpp"
+#include "AnimationBatch.hpp"
+
+namespace vkglTF
+{
+	class ModelInstance {
+	public:
+		glm::mat4 transform = glm::mat4(1.0f);
+		// Own time, rate, direction and offset, loops over Model::animationMaxTime
+		AnimationPlayback playback;
+
+		ModelInstance(const Model &model, const glm::mat4 &transform = glm::mat4(1.0f), float time = 0.0f)
+			: transform(transform), asset(&model), keyframes(model.meshesMorph.size(), 0)
+		{
+			playback.duration = model.animationMaxTime;
+			playback.seek(time);
+		}
+
+		const Model& model() const
+		{
+			return *asset;
+		}
+
+		// Floats of the weight block update() writes, the size of Model::morphWeightData
+		size_t weightBlockSize() const
+		{
+			return asset->morphWeightData.size();
+		}
+
+		/*
+			Advance the animation by deltaTime (in seconds) and write the packed weights of all morph meshes to weightBlock,
+			in the layout of Model::morphWeightData. Only touches the instance, the model is read only
+		*/
+		void update(float deltaTime, float *weightBlock)
+		{
+			std::vector<float> weights;
+			update(deltaTime, weightBlock, weights);
+		}
+
+		/*
+			Update all instances of one model, instance i writes its weight block at weightData + i * weightBlockSize()
+			and its transform to transforms[i], the layout drawMorph and morph.vert expect
+			Spread over up to threadCount threads (0 uses all hardware threads), each gets a contiguous range of instances
+			Each mesh's track is sampled for a batch of instances at once (AnimationBatch), same result as update()
+		*/
+		static void updateAll(std::vector<ModelInstance> &instances, float deltaTime, float *weightData, glm::mat4 *transforms, uint32_t threadCount = 1)
+		{
+			if (instances.empty()) {
+				return;
+			}
+			const Model &model = *instances[0].asset;
+			const size_t stride = instances[0].weightBlockSize();
+			auto updateRange = [&](size_t begin, size_t end) {
+				const size_t batchSize = 64;
+				std::vector<float> times(batchSize);
+				std::vector<uint32_t> keys(batchSize);
+				std::vector<float> weights; // targets of instance i at i * targetCount
+				for (size_t batch = begin; batch < end; batch += batchSize) {
+					const size_t count = std::min(end - batch, batchSize);
+					for (size_t i = 0; i < count; i++) {
+						ModelInstance &instance = instances[batch + i];
+						instance.playback.advance(deltaTime);
+						times[i] = instance.playback.clipTime();
+						transforms[batch + i] = instance.transform;
+					}
+					for (size_t m = 0; m < model.meshesMorph.size(); m++) {
+						const Mesh &mesh = model.meshesMorph[m];
+						const size_t targetCount = mesh.weights.size();
+						weights.resize(targetCount * count);
+						for (size_t i = 0; i < count; i++) {
+							keys[i] = instances[batch + i].keyframes[m];
+						}
+						if (mesh.weightsStream) {
+							mesh.weightsStream->sample(times.data(), keys.data(), count, weights.data(), targetCount);
+						} else {
+							AnimationBatch::sample(mesh.weightTrack(), times.data(), keys.data(), count, weights.data(), targetCount);
+						}
+						for (size_t i = 0; i < count; i++) {
+							instances[batch + i].keyframes[m] = keys[i];
+							Model::packWeights(mesh, weights.data() + i * targetCount, targetCount, weightData + (batch + i) * stride + mesh.morphPushConst.weightOffset);
+						}
+					}
+				}
+			};
+
+			// Starting a thread costs more than updating a few hundred instances
+			const size_t minInstancesPerThread = 256;
+			if (threadCount == 0) {
+				threadCount = std::max(1u, std::thread::hardware_concurrency());
+			}
+			threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, (instances.size() + minInstancesPerThread - 1) / minInstancesPerThread));
+			if (threadCount <= 1) {
+				updateRange(0, instances.size());
+				return;
+			}
+			std::vector<std::thread> threads;
+			const size_t perThread = (instances.size() + threadCount - 1) / threadCount;
+			for (size_t begin = 0; begin < instances.size(); begin += perThread) {
+				threads.push_back(std::thread(updateRange, begin, std::min(begin + perThread, instances.size())));
+			}
+			for (auto &thread : threads) {
+				thread.join();
+			}
+		}
+
+	private:
+		const Model *asset;
+		std::vector<uint32_t> keyframes; // cursor of every morph mesh's weight animation (AnimationSampler::advance)
+
+		// weights is scratch space, reused over the instances a thread updates
+		void update(float deltaTime, float *weightBlock, std::vector<float> &weights)
+		{
+			playback.advance(deltaTime);
+			const float time = playback.clipTime();
+			for (size_t m = 0; m < asset->meshesMorph.size(); m++) {
+				const Mesh &mesh = asset->meshesMorph[m];
+				weights.resize(mesh.weights.size());
+				Model::sampleWeights(mesh, time, keyframes[m], weights.data());
+				Model::packWeights(mesh, weights.data(), weights.size(), weightBlock + mesh.morphPushConst.weightOffset);
+			}
+		}
+	};
+}
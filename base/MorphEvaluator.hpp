@@ -0,0 +1,416 @@
+/*
+* CPU reference evaluator for the packed morph target data of vkglTF::Model
+*
+* Produces the same blended vertices as data/shaders/morph.vert without needing a Vulkan device,
+* so it can be used to validate GPU output or to drive morphs on a headless machine
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "VulkanglTFModel.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VKGLTF_MORPH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VKGLTF_MORPH_NEON
+#include <arm_neon.h>
+#endif
+
+// The AVX2 kernel is compiled for its own target so the rest of the project does not need -mavx2
+#if defined(VKGLTF_MORPH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VKGLTF_MORPH_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define VKGLTF_MORPH_TARGET_AVX2
+#endif
+
+namespace vkglTF
+{
+	/*
+		CPU morph target evaluator
+
+		Works directly on Model::morphVertexData and a mesh's MorphPushConst, so the data layout is the one described in the model:
+		per vertex [POS_0, POS_1... NORMAL_0, NORMAL_1... TANGENT_0, TANGENT_1..] with push.vertexStride vec4 aligned deltas per vertex,
+		or the per vertex delta lists if push.sparse is set. Quantized deltas (push.quantized) are decoded with MorphQuantization
+		Like morph.vert and morph.comp only positions and normals are blended, the tangents are copied from the base vertices
+	*/
+	struct MorphEvaluator {
+		enum Kernel { KERNEL_SCALAR, KERNEL_SSE, KERNEL_AVX2, KERNEL_NEON };
+
+		/*
+			Widest kernel supported by the build and the CPU it is running on
+		*/
+		static Kernel bestKernel()
+		{
+#if defined(VKGLTF_MORPH_X86)
+			if (cpuSupportsAVX2()) {
+				return KERNEL_AVX2;
+			}
+			return KERNEL_SSE;
+#elif defined(VKGLTF_MORPH_NEON)
+			return KERNEL_NEON;
+#else
+			return KERNEL_SCALAR;
+#endif
+		}
+
+		static bool kernelSupported(Kernel kernel)
+		{
+			switch (kernel) {
+#if defined(VKGLTF_MORPH_X86)
+				case KERNEL_SSE: return true;
+				case KERNEL_AVX2: return cpuSupportsAVX2();
+#elif defined(VKGLTF_MORPH_NEON)
+				case KERNEL_NEON: return true;
+#endif
+				case KERNEL_SCALAR: return true;
+				default: return false;
+			}
+		}
+
+		static const char* kernelName(Kernel kernel)
+		{
+			switch (kernel) {
+				case KERNEL_SSE: return "sse";
+				case KERNEL_AVX2: return "avx2";
+				case KERNEL_NEON: return "neon";
+				default: return "scalar";
+			}
+		}
+
+		/*
+			Blend vertexCount vertices starting at firstVertex (mesh local, same as gl_VertexIndex in morph.vert)
+
+			baseVertices and outVertices are indexed with the same mesh local index, morphVertexData and morphWeightData
+			are the whole Model::morphVertexData and Model::morphWeightData (see Model::updateMorphWeights)
+			Disjoint vertex ranges can be evaluated from different threads
+			Quantized meshes use the SSE kernel for KERNEL_SSE and KERNEL_AVX2 and the scalar kernel otherwise,
+			per vertex delta lists (push.sparse) are always blended with the scalar kernel
+		*/
+		static void blend(const Model::Vertex *baseVertices, uint32_t firstVertex, uint32_t vertexCount,
+						  const float *morphVertexData, const float *morphWeightData, const MorphPushConst &push,
+						  Model::Vertex *outVertices, Kernel kernel = bestKernel())
+		{
+			if (vertexCount == 0) {
+				return;
+			}
+
+			const float *weightBlock = morphWeightData + push.weightOffset;
+			if (push.sparse) {
+				// No slot of the mesh has a weight, the lists are not walked (activeCount of the sparse header)
+				uint32_t activeCount;
+				memcpy(&activeCount, &weightBlock[2], sizeof(uint32_t));
+				if (activeCount == 0) {
+					memcpy(&outVertices[firstVertex], &baseVertices[firstVertex], vertexCount * sizeof(Model::Vertex));
+					return;
+				}
+				// Per vertex delta lists are a gather over a few entries, nothing for the SIMD kernels to work on
+				blendSparse(baseVertices, firstVertex, firstVertex + vertexCount, morphVertexData, push, weightBlock + 4, outVertices);
+				return;
+			}
+
+			// Same compacted list of active slots the shader loops over, split into position/normal/tangent ranges
+			uint32_t header[4];
+			memcpy(header, weightBlock, sizeof(header));
+			ActiveSlots active;
+			active.segments[0] = 0;
+			active.segments[1] = header[0];
+			active.segments[2] = header[1];
+			active.segments[3] = header[2];
+			active.slots.resize(header[2]);
+			active.weights.resize(header[2]);
+			for (uint32_t k = 0; k < header[2]; k++) {
+				memcpy(&active.slots[k], &weightBlock[4 + k * 2], sizeof(uint32_t));
+				active.weights[k] = weightBlock[4 + k * 2 + 1];
+			}
+
+			if (push.quantized) {
+				blendQuantized(baseVertices, firstVertex, firstVertex + vertexCount, morphVertexData, push, active, outVertices, kernel);
+				return;
+			}
+
+			// Deltas are padded to 4 floats, so the SIMD kernels load one whole delta per target
+			const uint32_t endVertex = firstVertex + vertexCount;
+			switch (kernel) {
+#if defined(VKGLTF_MORPH_X86)
+				case KERNEL_AVX2: blendAVX2(baseVertices, firstVertex, endVertex, morphVertexData, push, active, outVertices); break;
+				case KERNEL_SSE: blendSSE(baseVertices, firstVertex, endVertex, morphVertexData, push, active, outVertices); break;
+#elif defined(VKGLTF_MORPH_NEON)
+				case KERNEL_NEON: blendNEON(baseVertices, firstVertex, endVertex, morphVertexData, push, active, outVertices); break;
+#endif
+				default: blendScalar(baseVertices, firstVertex, endVertex, morphVertexData, push, active, outVertices); break;
+			}
+		}
+
+		/*
+			Blend a whole morph mesh of a model loaded with host data kept (see Model::keepHostData)
+		*/
+		static void blendMesh(const Model &model, const Mesh &mesh, std::vector<Model::Vertex> &outVertices, Kernel kernel = bestKernel())
+		{
+			assert(!model.morphBaseVertices.empty());
+			const Model::Vertex *baseVertices = &model.morphBaseVertices[mesh.morphVertexOffset / sizeof(Model::Vertex)];
+			outVertices.resize(mesh.vertexCount);
+			blend(baseVertices, 0, mesh.vertexCount, model.morphVertexData.data(), model.morphWeightData.data(), mesh.morphPushConst, outVertices.data(), kernel);
+		}
+
+	private:
+#if defined(VKGLTF_MORPH_X86)
+		static bool cpuSupportsAVX2()
+		{
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		}
+#endif
+
+		struct ActiveSlots {
+			uint32_t segments[4];
+			std::vector<uint32_t> slots;
+			std::vector<float> weights;
+		};
+
+		static const float* vertexDeltas(const float *morphVertexData, const MorphPushConst &push, uint32_t vertex)
+		{
+			return morphVertexData + push.bufferOffset + (push.vertexStride * vertex * 4);
+		}
+
+		/*
+			All kernels blend the vertices in [first, end)
+		*/
+		static void blendScalar(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+								const MorphPushConst &push, const ActiveSlots &active, Model::Vertex *outVertices)
+		{
+			for (uint32_t v = first; v < end; v++) {
+				const float *deltas = vertexDeltas(morphVertexData, push, v);
+				glm::vec3 sum[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };
+				for (uint32_t s = 0; s < 2; s++) {
+					for (uint32_t k = active.segments[s]; k < active.segments[s + 1]; k++) {
+						sum[s] += glm::make_vec3(&deltas[active.slots[k] * 4]) * active.weights[k];
+					}
+				}
+				outVertices[v].pos = baseVertices[v].pos + sum[0];
+				outVertices[v].normal = baseVertices[v].normal + sum[1];
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+
+		// Per slot ranges of a quantized mesh, stored right before its data
+		static const float* slotRanges(const float *morphVertexData, const MorphPushConst &push)
+		{
+			return morphVertexData + push.bufferOffset - push.vertexStride * 4;
+		}
+
+		/*
+			Per slot scales and word offsets of a quantized mesh, shared by the quantized kernels
+		*/
+		struct QuantizedSlots {
+			std::vector<float> scales; // 4 per active slot, w is 0
+			std::vector<uint32_t> words;
+			uint32_t vertexWords;
+		};
+
+		static void blendQuantized(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+								   const MorphPushConst &push, const ActiveSlots &active, Model::Vertex *outVertices, Kernel kernel)
+		{
+			// Range times weight over the snorm scale of every active slot, so each delta is a plain integer conversion and one multiply
+			// The loader never writes -32768 / -128, so the clamp of unpackSnorm is not needed
+			const float *ranges = slotRanges(morphVertexData, push);
+			QuantizedSlots slots;
+			slots.scales.resize(active.slots.size() * 4);
+			slots.words.resize(active.slots.size());
+			slots.vertexWords = MorphQuantization::vertexWords(push);
+			for (size_t k = 0; k < active.slots.size(); k++) {
+				const float snormMax = (k < active.segments[1]) ? 32767.0f : 127.0f;
+				const float *range = &ranges[active.slots[k] * 4];
+				for (uint32_t c = 0; c < 3; c++) {
+					slots.scales[k * 4 + c] = range[c] * (active.weights[k] / snormMax);
+				}
+				slots.scales[k * 4 + 3] = 0.0f;
+				slots.words[k] = MorphQuantization::slotWord(push, active.slots[k]);
+			}
+
+#if defined(VKGLTF_MORPH_X86)
+			// Decoding is the bulk of the work and four lanes already hold a whole delta, so AVX2 shares the SSE kernel
+			if (kernel == KERNEL_SSE || kernel == KERNEL_AVX2) {
+				blendQuantizedSSE(baseVertices, first, end, morphVertexData, push, active, slots, outVertices);
+				return;
+			}
+#else
+			(void)kernel;
+#endif
+			for (uint32_t v = first; v < end; v++) {
+				const float *deltas = morphVertexData + push.bufferOffset + v * slots.vertexWords;
+				glm::vec3 sum[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };
+				for (uint32_t k = active.segments[0]; k < active.segments[1]; k++) {
+					int16_t q[4];
+					memcpy(q, &deltas[slots.words[k]], sizeof(q));
+					sum[0] += glm::vec3(q[0], q[1], q[2]) * glm::make_vec3(&slots.scales[k * 4]);
+				}
+				for (uint32_t k = active.segments[1]; k < active.segments[2]; k++) {
+					int8_t q[4];
+					memcpy(q, &deltas[slots.words[k]], sizeof(q));
+					sum[1] += glm::vec3(q[0], q[1], q[2]) * glm::make_vec3(&slots.scales[k * 4]);
+				}
+				outVertices[v].pos = baseVertices[v].pos + sum[0];
+				outVertices[v].normal = baseVertices[v].normal + sum[1];
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+
+		static void blendSparse(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+								const MorphPushConst &push, const float *slotWeights, Model::Vertex *outVertices)
+		{
+			const float *lists = morphVertexData + push.bufferOffset;
+			const float *ranges = slotRanges(morphVertexData, push);
+			const uint32_t entryWords = push.quantized ? 2 : 4;
+			for (uint32_t v = first; v < end; v++) {
+				uint32_t listStart, listEnd;
+				memcpy(&listStart, &lists[v], sizeof(uint32_t));
+				memcpy(&listEnd, &lists[v + 1], sizeof(uint32_t));
+				glm::vec3 sum[2] = { glm::vec3(0.0f), glm::vec3(0.0f) };
+				for (uint32_t e = listStart; e < listEnd; e += entryWords) {
+					// Zero weighted slots are dropped before decoding, like the shaders do
+					uint32_t slot;
+					memcpy(&slot, &lists[e], sizeof(uint32_t));
+					if (push.quantized) {
+						slot &= 0xffffu;
+					}
+					const float weight = slotWeights[slot];
+					if (weight == 0.0f || slot >= push.tangentOffset) {
+						continue;
+					}
+					glm::vec3 delta;
+					if (push.quantized) {
+						uint32_t words[2];
+						memcpy(words, &lists[e], sizeof(words));
+						delta = MorphQuantization::decodeListEntry(words, slot);
+						delta = delta * glm::make_vec3(&ranges[slot * 4]);
+					} else {
+						delta = glm::make_vec3(&lists[e + 1]);
+					}
+					sum[(slot < push.normalOffset) ? 0 : 1] += delta * weight;
+				}
+				outVertices[v].pos = baseVertices[v].pos + sum[0];
+				outVertices[v].normal = baseVertices[v].normal + sum[1];
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+
+#if defined(VKGLTF_MORPH_X86)
+		static void blendSSE(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+							 const MorphPushConst &push, const ActiveSlots &active, Model::Vertex *outVertices)
+		{
+			for (uint32_t v = first; v < end; v++) {
+				const float *deltas = vertexDeltas(morphVertexData, push, v);
+				float sum[2][4];
+				for (uint32_t s = 0; s < 2; s++) {
+					__m128 acc = _mm_setzero_ps();
+					for (uint32_t k = active.segments[s]; k < active.segments[s + 1]; k++) {
+						acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&deltas[active.slots[k] * 4]), _mm_set1_ps(active.weights[k])));
+					}
+					_mm_storeu_ps(sum[s], acc);
+				}
+				outVertices[v].pos = baseVertices[v].pos + glm::make_vec3(sum[0]);
+				outVertices[v].normal = baseVertices[v].normal + glm::make_vec3(sum[1]);
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+
+		/*
+			Positions are 4 x int16 and directions 4 x int8 with a zero w, both sign extended to 32 bit with an unpack and an arithmetic shift
+		*/
+		static void blendQuantizedSSE(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+									  const MorphPushConst &push, const ActiveSlots &active, const QuantizedSlots &slots, Model::Vertex *outVertices)
+		{
+			for (uint32_t v = first; v < end; v++) {
+				const float *deltas = morphVertexData + push.bufferOffset + v * slots.vertexWords;
+				float sum[2][4];
+				__m128 acc = _mm_setzero_ps();
+				for (uint32_t k = active.segments[0]; k < active.segments[1]; k++) {
+					__m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&deltas[slots.words[k]]));
+					q = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16);
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_loadu_ps(&slots.scales[k * 4])));
+				}
+				_mm_storeu_ps(sum[0], acc);
+				acc = _mm_setzero_ps();
+				for (uint32_t k = active.segments[1]; k < active.segments[2]; k++) {
+					int32_t word;
+					memcpy(&word, &deltas[slots.words[k]], sizeof(word));
+					__m128i q = _mm_cvtsi32_si128(word);
+					q = _mm_unpacklo_epi8(q, q);
+					q = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 24);
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_loadu_ps(&slots.scales[k * 4])));
+				}
+				_mm_storeu_ps(sum[1], acc);
+				outVertices[v].pos = baseVertices[v].pos + glm::make_vec3(sum[0]);
+				outVertices[v].normal = baseVertices[v].normal + glm::make_vec3(sum[1]);
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+
+		/*
+			Two vertices per iteration, one in each 128 bit half
+		*/
+		VKGLTF_MORPH_TARGET_AVX2
+		static void blendAVX2(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+							  const MorphPushConst &push, const ActiveSlots &active, Model::Vertex *outVertices)
+		{
+			uint32_t v = first;
+			for (; v + 2 <= end; v += 2) {
+				const float *deltas0 = vertexDeltas(morphVertexData, push, v);
+				const float *deltas1 = vertexDeltas(morphVertexData, push, v + 1);
+				float sum[2][8];
+				for (uint32_t s = 0; s < 2; s++) {
+					__m256 acc = _mm256_setzero_ps();
+					for (uint32_t k = active.segments[s]; k < active.segments[s + 1]; k++) {
+						uint32_t offset = active.slots[k] * 4;
+						__m256 delta = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&deltas0[offset])), _mm_loadu_ps(&deltas1[offset]), 1);
+						acc = _mm256_fmadd_ps(delta, _mm256_set1_ps(active.weights[k]), acc);
+					}
+					_mm256_storeu_ps(sum[s], acc);
+				}
+				outVertices[v].pos = baseVertices[v].pos + glm::make_vec3(&sum[0][0]);
+				outVertices[v].normal = baseVertices[v].normal + glm::make_vec3(&sum[1][0]);
+				outVertices[v].tangent = baseVertices[v].tangent;
+				outVertices[v + 1].pos = baseVertices[v + 1].pos + glm::make_vec3(&sum[0][4]);
+				outVertices[v + 1].normal = baseVertices[v + 1].normal + glm::make_vec3(&sum[1][4]);
+				outVertices[v + 1].tangent = baseVertices[v + 1].tangent;
+			}
+			blendSSE(baseVertices, v, end, morphVertexData, push, active, outVertices);
+		}
+#elif defined(VKGLTF_MORPH_NEON)
+		static void blendNEON(const Model::Vertex *baseVertices, uint32_t first, uint32_t end, const float *morphVertexData,
+							  const MorphPushConst &push, const ActiveSlots &active, Model::Vertex *outVertices)
+		{
+			for (uint32_t v = first; v < end; v++) {
+				const float *deltas = vertexDeltas(morphVertexData, push, v);
+				float sum[2][4];
+				for (uint32_t s = 0; s < 2; s++) {
+					float32x4_t acc = vdupq_n_f32(0.0f);
+					for (uint32_t k = active.segments[s]; k < active.segments[s + 1]; k++) {
+						acc = vmlaq_n_f32(acc, vld1q_f32(&deltas[active.slots[k] * 4]), active.weights[k]);
+					}
+					vst1q_f32(sum[s], acc);
+				}
+				outVertices[v].pos = baseVertices[v].pos + glm::make_vec3(sum[0]);
+				outVertices[v].normal = baseVertices[v].normal + glm::make_vec3(sum[1]);
+				outVertices[v].tangent = baseVertices[v].tangent;
+			}
+		}
+#endif
+	};
+}
@@ -0,0 +1,232 @@
+/*
+* Pipeline variants of morph.vert specialized per mesh layout
+*
+* morph.vert reads the slot layout of a mesh (position/normal/tangent slot counts, sparse, quantized) from push constants,
+* so its loops have a runtime trip count. A variant sets the layout as specialization constants instead, its loops have
+* a constant trip count and unroll, and the layout branches fold away. Variants are created on first use and cached by
+* their key, meshes with the same layout share one
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+#include "macros.h"
+#include "VulkanglTFModel.hpp"
+
+namespace vkglTF
+{
+	class MorphPipelineVariants {
+	public:
+		// Layout a variant is specialized on, the specialization data of morph.vert (constant_id 0 to 5)
+		struct Key {
+			VkBool32 specialized = VK_FALSE; // false: the generic variant, the layout comes from the push constants
+			uint32_t positionSlots = 0;
+			uint32_t normalSlots = 0;
+			uint32_t tangentSlots = 0;
+			VkBool32 sparse = VK_FALSE;
+			VkBool32 quantized = VK_FALSE;
+
+			bool operator<(const Key &other) const
+			{
+				return std::tie(specialized, positionSlots, normalSlots, tangentSlots, sparse, quantized) <
+					std::tie(other.specialized, other.positionSlots, other.normalSlots, other.tangentSlots, other.sparse, other.quantized);
+			}
+		};
+
+		// Meshes with more slots get the generic variant, unrolling hundreds of targets only bloats the shader
+		uint32_t maxSpecializedSlots = 64;
+		// Every mesh gets the generic variant if false, for comparing
+		bool specialize = true;
+
+		/*
+			Keeps a copy of the state of pipelineCI (without pNext chains and tessellation state) to create the variants from
+			and takes over its shader modules, which are destroyed with the variants
+		*/
+		void init(VkDevice device, VkPipelineCache pipelineCache, const VkGraphicsPipelineCreateInfo &pipelineCI)
+		{
+			this->device = device;
+			this->pipelineCache = pipelineCache;
+			this->pipelineCI = pipelineCI;
+			this->pipelineCI.pNext = nullptr;
+			this->pipelineCI.pTessellationState = nullptr;
+
+			stages.assign(pipelineCI.pStages, pipelineCI.pStages + pipelineCI.stageCount);
+			this->pipelineCI.pStages = stages.data();
+
+			if (pipelineCI.pVertexInputState) {
+				const VkPipelineVertexInputStateCreateInfo &state = *pipelineCI.pVertexInputState;
+				vertexInputState = state;
+				vertexBindings.assign(state.pVertexBindingDescriptions, state.pVertexBindingDescriptions + state.vertexBindingDescriptionCount);
+				vertexAttributes.assign(state.pVertexAttributeDescriptions, state.pVertexAttributeDescriptions + state.vertexAttributeDescriptionCount);
+				vertexInputState.pVertexBindingDescriptions = vertexBindings.data();
+				vertexInputState.pVertexAttributeDescriptions = vertexAttributes.data();
+				this->pipelineCI.pVertexInputState = &vertexInputState;
+			}
+			this->pipelineCI.pInputAssemblyState = copyState(pipelineCI.pInputAssemblyState, inputAssemblyState);
+			if (pipelineCI.pViewportState) {
+				const VkPipelineViewportStateCreateInfo &state = *pipelineCI.pViewportState;
+				viewportState = state;
+				if (state.pViewports) {
+					viewports.assign(state.pViewports, state.pViewports + state.viewportCount);
+					viewportState.pViewports = viewports.data();
+				}
+				if (state.pScissors) {
+					scissors.assign(state.pScissors, state.pScissors + state.scissorCount);
+					viewportState.pScissors = scissors.data();
+				}
+				this->pipelineCI.pViewportState = &viewportState;
+			}
+			this->pipelineCI.pRasterizationState = copyState(pipelineCI.pRasterizationState, rasterizationState);
+			if (pipelineCI.pMultisampleState) {
+				multisampleState = *pipelineCI.pMultisampleState;
+				if (multisampleState.pSampleMask) {
+					sampleMask.assign(multisampleState.pSampleMask, multisampleState.pSampleMask + (multisampleState.rasterizationSamples + 31) / 32);
+					multisampleState.pSampleMask = sampleMask.data();
+				}
+				this->pipelineCI.pMultisampleState = &multisampleState;
+			}
+			this->pipelineCI.pDepthStencilState = copyState(pipelineCI.pDepthStencilState, depthStencilState);
+			if (pipelineCI.pColorBlendState) {
+				const VkPipelineColorBlendStateCreateInfo &state = *pipelineCI.pColorBlendState;
+				colorBlendState = state;
+				blendAttachments.assign(state.pAttachments, state.pAttachments + state.attachmentCount);
+				colorBlendState.pAttachments = blendAttachments.data();
+				this->pipelineCI.pColorBlendState = &colorBlendState;
+			}
+			if (pipelineCI.pDynamicState) {
+				const VkPipelineDynamicStateCreateInfo &state = *pipelineCI.pDynamicState;
+				dynamicState = state;
+				dynamicStates.assign(state.pDynamicStates, state.pDynamicStates + state.dynamicStateCount);
+				dynamicState.pDynamicStates = dynamicStates.data();
+				this->pipelineCI.pDynamicState = &dynamicState;
+			}
+		}
+
+		// Tightest variant for a mesh layout
+		Key key(const MorphPushConst &push) const
+		{
+			Key key;
+			if (!specialize || push.vertexStride > maxSpecializedSlots) {
+				return key;
+			}
+			key.specialized = VK_TRUE;
+			key.positionSlots = push.normalOffset;
+			key.normalSlots = push.tangentOffset - push.normalOffset;
+			key.tangentSlots = push.vertexStride - push.tangentOffset;
+			key.sparse = push.sparse ? VK_TRUE : VK_FALSE;
+			key.quantized = push.quantized ? VK_TRUE : VK_FALSE;
+			return key;
+		}
+
+		VkPipeline get(const MorphPushConst &push)
+		{
+			return get(key(push));
+		}
+
+		// Pipeline of a variant, created (through the pipeline cache) the first time it is asked for
+		VkPipeline get(const Key &key)
+		{
+			std::map<Key, VkPipeline>::const_iterator it = pipelines.find(key);
+			if (it != pipelines.end()) {
+				return it->second;
+			}
+
+			const VkSpecializationMapEntry entries[] = {
+				{ 0, offsetof(Key, specialized), sizeof(VkBool32) },
+				{ 1, offsetof(Key, positionSlots), sizeof(uint32_t) },
+				{ 2, offsetof(Key, normalSlots), sizeof(uint32_t) },
+				{ 3, offsetof(Key, tangentSlots), sizeof(uint32_t) },
+				{ 4, offsetof(Key, sparse), sizeof(VkBool32) },
+				{ 5, offsetof(Key, quantized), sizeof(VkBool32) }
+			};
+			VkSpecializationInfo specializationInfo{};
+			specializationInfo.mapEntryCount = static_cast<uint32_t>(sizeof(entries) / sizeof(entries[0]));
+			specializationInfo.pMapEntries = entries;
+			specializationInfo.dataSize = sizeof(Key);
+			specializationInfo.pData = &key;
+
+			std::vector<VkPipelineShaderStageCreateInfo> variantStages(stages);
+			for (VkPipelineShaderStageCreateInfo &stage : variantStages) {
+				if (stage.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+					stage.pSpecializationInfo = &specializationInfo;
+				}
+			}
+			VkGraphicsPipelineCreateInfo variantCI = pipelineCI;
+			variantCI.pStages = variantStages.data();
+			VkPipeline pipeline;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &variantCI, nullptr, &pipeline));
+			pipelines[key] = pipeline;
+			return pipeline;
+		}
+
+		// Variant of every mesh in model.meshesMorph, in that order (see Model::drawMorph)
+		std::vector<VkPipeline> meshPipelines(const Model &model)
+		{
+			std::vector<VkPipeline> meshPipelines;
+			for (const Mesh &mesh : model.meshesMorph) {
+				meshPipelines.push_back(get(mesh.morphPushConst));
+			}
+			return meshPipelines;
+		}
+
+		// Variants created so far
+		size_t size() const
+		{
+			return pipelines.size();
+		}
+
+		void destroy()
+		{
+			for (auto &pipeline : pipelines) {
+				vkDestroyPipeline(device, pipeline.second, nullptr);
+			}
+			pipelines.clear();
+			for (VkPipelineShaderStageCreateInfo &stage : stages) {
+				vkDestroyShaderModule(device, stage.module, nullptr);
+			}
+			stages.clear();
+		}
+
+	private:
+		VkDevice device = VK_NULL_HANDLE;
+		VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+		std::map<Key, VkPipeline> pipelines;
+
+		// Copy of the template pipeline, pipelineCI points at the members below
+		VkGraphicsPipelineCreateInfo pipelineCI{};
+		std::vector<VkPipelineShaderStageCreateInfo> stages;
+		VkPipelineVertexInputStateCreateInfo vertexInputState{};
+		std::vector<VkVertexInputBindingDescription> vertexBindings;
+		std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState{};
+		VkPipelineViewportStateCreateInfo viewportState{};
+		std::vector<VkViewport> viewports;
+		std::vector<VkRect2D> scissors;
+		VkPipelineRasterizationStateCreateInfo rasterizationState{};
+		VkPipelineMultisampleStateCreateInfo multisampleState{};
+		std::vector<VkSampleMask> sampleMask;
+		VkPipelineDepthStencilStateCreateInfo depthStencilState{};
+		VkPipelineColorBlendStateCreateInfo colorBlendState{};
+		std::vector<VkPipelineColorBlendAttachmentState> blendAttachments;
+		VkPipelineDynamicStateCreateInfo dynamicState{};
+		std::vector<VkDynamicState> dynamicStates;
+
+		template <typename T>
+		static const T* copyState(const T *source, T &copy)
+		{
+			if (!source) {
+				return nullptr;
+			}
+			copy = *source;
+			return &copy;
+		}
+	};
+}
@@ -0,0 +1,84 @@
+/*
+* Resident memory of the process
+*
+* Peak resident set size (high water mark), so the memory a phase like a model load needs at most can be measured
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace vks
+{
+	/*
+		Highest resident set size of the process in bytes so far (or since resetPeakResidentSetSize), 0 if unknown
+	*/
+	inline uint64_t peakResidentSetSize()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return counters.PeakWorkingSetSize;
+		}
+		return 0;
+#else
+#if defined(__linux__)
+		// VmHWM follows resetPeakResidentSetSize, ru_maxrss does not once a thread has exited
+		FILE *status = fopen("/proc/self/status", "r");
+		if (status) {
+			char line[256];
+			unsigned long long kilobytes = 0;
+			bool found = false;
+			while (!found && fgets(line, sizeof(line), status)) {
+				found = strncmp(line, "VmHWM:", 6) == 0 && sscanf(line + 6, "%llu", &kilobytes) == 1;
+			}
+			fclose(status);
+			if (found) {
+				return kilobytes * 1024;
+			}
+		}
+#endif
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0;
+		}
+#if defined(__APPLE__)
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+	}
+
+	/*
+		Restart the peak at the current resident set size, returns false where this is not supported
+		(only Linux 4.0 and later), peakResidentSetSize() then still reports the peak of the whole run
+	*/
+	inline bool resetPeakResidentSetSize()
+	{
+#if defined(__linux__)
+		FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+		if (!clearRefs) {
+			return false;
+		}
+		const bool reset = fputs("5", clearRefs) >= 0;
+		return (fclose(clearRefs) == 0) && reset;
+#else
+		return false;
+#endif
+	}
+}
@@ -17,6 +17,8 @@
 #include <cstring>
 #include "vulkan/vulkan.h"
 #include "macros.h"
+#include "VulkanMemoryAllocator.hpp"
+#include "VulkanUploadManager.hpp"
 
 namespace vks
 {	
@@ -30,10 +32,15 @@ namespace vks
 		VkPhysicalDeviceMemoryProperties memoryProperties;
 		std::vector<VkQueueFamilyProperties> queueFamilyProperties;
 		VkCommandPool commandPool = VK_NULL_HANDLE;
+		/** @brief Pools the memory of buffers and images created with a vks::Allocation */
+		MemoryAllocator memoryAllocator;
+		/** @brief Batches the staging copies of loads, see VulkanUploadManager.hpp */
+		UploadManager uploadManager;
 
 		struct {
 			uint32_t graphics;
 			uint32_t compute;
+			uint32_t transfer;
 		} queueFamilyIndices;
 
 		operator VkDevice() { return logicalDevice; };
@@ -74,6 +81,8 @@ namespace vks
 				vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 			}
 			if (logicalDevice) {
+				uploadManager.destroy();
+				memoryAllocator.destroy();
 				vkDestroyDevice(logicalDevice, nullptr);
 			}
 		}
@@ -134,6 +143,17 @@ namespace vks
 				}
 			}
 
+			// Dedicated queue for transfer
+			// Try to find a queue family index that supports transfer but not graphics and compute
+			if (queueFlags & VK_QUEUE_TRANSFER_BIT)
+			{
+				for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+					if ((queueFamilyProperties[i].queueFlags & queueFlags) && ((queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0) && ((queueFamilyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0)) {
+						return i;
+					}
+				}
+			}
+
 			// For other queue types or if no separate compute queue is present, return the first one to support the requested flags
 			for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
 				if (queueFamilyProperties[i].queueFlags & queueFlags) {
@@ -153,7 +173,7 @@ namespace vks
 		*
 		* @return VkResult of the device creation call
 		*/
-		VkResult createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)
+		VkResult createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT)
 		{			
 			// Desired queues need to be requested upon logical device creation
 			// Due to differing queue family configurations of Vulkan implementations this can be a bit tricky, especially if the application
@@ -196,6 +216,23 @@ namespace vks
 				queueFamilyIndices.compute = queueFamilyIndices.graphics;
 			}
 
+			// Dedicated transfer queue, used by uploadManager
+			if (requestedQueueTypes & VK_QUEUE_TRANSFER_BIT) {
+				queueFamilyIndices.transfer = getQueueFamilyIndex(VK_QUEUE_TRANSFER_BIT);
+				if ((queueFamilyIndices.transfer != queueFamilyIndices.graphics) && (queueFamilyIndices.transfer != queueFamilyIndices.compute)) {
+					// If transfer family index differs, we need an additional queue create info for the transfer queue
+					VkDeviceQueueCreateInfo queueInfo{};
+					queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+					queueInfo.queueFamilyIndex = queueFamilyIndices.transfer;
+					queueInfo.queueCount = 1;
+					queueInfo.pQueuePriorities = &defaultQueuePriority;
+					queueCreateInfos.push_back(queueInfo);
+				}
+			} else {
+				// Else we use the same queue
+				queueFamilyIndices.transfer = queueFamilyIndices.graphics;
+			}
+
 			// Create the logical device representation
 			std::vector<const char*> deviceExtensions(enabledExtensions);
 			deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
@@ -215,6 +252,8 @@ namespace vks
 
 			if (result == VK_SUCCESS) {
 				commandPool = createCommandPool(queueFamilyIndices.graphics);
+				memoryAllocator.init(logicalDevice, memoryProperties, properties.limits);
+				uploadManager.init(logicalDevice, &memoryAllocator, memoryProperties, queueFamilyIndices.graphics, queueFamilyIndices.transfer);
 			}
 
 			this->enabledFeatures = enabledFeatures;
@@ -279,6 +318,100 @@ namespace vks
 			return VK_SUCCESS;
 		}
 
+		/**
+		* Create a buffer on the device, its memory is sub-allocated from the pools of memoryAllocator
+		*
+		* @param usageFlags Usage flag bitmask for the buffer (i.e. index, vertex, uniform buffer)
+		* @param memoryPropertyFlags Memory properties for this buffer (i.e. device local, host visible, coherent)
+		* @param size Size of the buffer in byes
+		* @param buffer Pointer to the buffer handle acquired by the function
+		* @param allocation Pointer to the allocation acquired by the function, host visible allocations stay mapped (allocation->mapped)
+		* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+		*
+		* @note Release with destroyBuffer
+		*
+		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+		*/
+		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, Allocation *allocation, void *data = nullptr)
+		{
+			VkBufferCreateInfo bufferCreateInfo{};
+			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferCreateInfo.usage = usageFlags;
+			bufferCreateInfo.size = size;
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, buffer));
+
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(logicalDevice, *buffer, &memReqs);
+			const uint32_t memoryType = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+			VK_CHECK_RESULT(memoryAllocator.allocate(memReqs, memoryType, MemoryAllocator::RESOURCE_LINEAR, allocation));
+
+			if (data != nullptr)
+			{
+				memcpy(allocation->mapped, data, size);
+				if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0) {
+					flushAllocation(*allocation);
+				}
+			}
+
+			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, *buffer, allocation->memory, allocation->offset));
+
+			return VK_SUCCESS;
+		}
+
+		/**
+		* Destroy a buffer created with a vks::Allocation and return its memory to the pool
+		*/
+		void destroyBuffer(VkBuffer buffer, Allocation &allocation)
+		{
+			vkDestroyBuffer(logicalDevice, buffer, nullptr);
+			memoryAllocator.free(allocation);
+		}
+
+		/**
+		* Sub-allocate memory for an image from the pools of memoryAllocator and bind it
+		*
+		* @param image Image to allocate the memory for
+		* @param memoryPropertyFlags Memory properties for the image memory
+		* @param allocation Pointer to the allocation acquired by the function
+		* @param linearTiling True if the image was created with VK_IMAGE_TILING_LINEAR
+		*
+		* @note Release with freeMemory after destroying the image
+		*/
+		VkResult allocateImageMemory(VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, Allocation *allocation, bool linearTiling = false)
+		{
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(logicalDevice, image, &memReqs);
+			const uint32_t memoryType = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+			VK_CHECK_RESULT(memoryAllocator.allocate(memReqs, memoryType, linearTiling ? MemoryAllocator::RESOURCE_LINEAR : MemoryAllocator::RESOURCE_OPTIMAL, allocation));
+			VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, image, allocation->memory, allocation->offset));
+			return VK_SUCCESS;
+		}
+
+		/**
+		* Return a pooled allocation, the resource using it must already be destroyed
+		*/
+		void freeMemory(Allocation &allocation)
+		{
+			memoryAllocator.free(allocation);
+		}
+
+		/**
+		* Make host writes to a non coherent allocation visible to the device
+		*/
+		void flushAllocation(const Allocation &allocation)
+		{
+			VkMappedMemoryRange mappedRange{};
+			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			mappedRange.memory = allocation.memory;
+			mappedRange.offset = allocation.offset;
+			// Non coherent allocations start on a nonCoherentAtomSize boundary, the size is rounded up or runs to the end of the block
+			const VkDeviceSize atom = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+			const VkDeviceSize size = (allocation.size + atom - 1) / atom * atom;
+			mappedRange.size = allocation.offset + size > allocation.block->size ? VK_WHOLE_SIZE : size;
+			VK_CHECK_RESULT(vkFlushMappedMemoryRanges(logicalDevice, 1, &mappedRange));
+		}
+
 		/** 
 		* Create a command pool for allocation command buffers from
 		* 
@@ -147,15 +147,21 @@ void VulkanExampleBase::prepare()
 	*/
 	VkSemaphoreCreateInfo semaphoreCI{};
 	semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &presentCompleteSemaphore));
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &renderCompleteSemaphore));
 	VkFenceCreateInfo fenceCreateInfo = {};
 	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-	waitFences.resize(swapChain.imageCount);
-	for (auto& fence : waitFences) {
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
-	}
+	presentCompleteSemaphores.resize(settings.framesInFlight);
+	renderCompleteSemaphores.resize(settings.framesInFlight);
+	frameFences.resize(settings.framesInFlight);
+	for (uint32_t i = 0; i < settings.framesInFlight; i++) {
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &presentCompleteSemaphores[i]));
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &renderCompleteSemaphores[i]));
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &frameFences[i]));
+	}
+	presentCompleteSemaphore = presentCompleteSemaphores[0];
+	renderCompleteSemaphore = renderCompleteSemaphores[0];
+	// No image has been rendered to yet
+	waitFences.assign(swapChain.imageCount, VK_NULL_HANDLE);
 
 	/*
 		Command pool
@@ -340,9 +346,7 @@ void VulkanExampleBase::prepare()
 	/*
 		Pipeline cache
 	*/
-	VkPipelineCacheCreateInfo pipelineCacheCreateInfo{};
-	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-	VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+	createPipelineCache();
 
 	/*
 		Frame buffer
@@ -350,6 +354,68 @@ void VulkanExampleBase::prepare()
 	setupFrameBuffer();
 }
 
+/*
+	Create the pipeline cache, with the data saved by an earlier run on the same device and driver if there is any
+*/
+void VulkanExampleBase::createPipelineCache()
+{
+	if (!settings.persistentPipelineCache) {
+		VkPipelineCacheCreateInfo pipelineCacheCreateInfo{};
+		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+		return;
+	}
+#if defined(__ANDROID__)
+	const std::string directory = (androidApp->activity->internalDataPath) ? std::string(androidApp->activity->internalDataPath) + "/" : "";
+#else
+	const std::string directory = "";
+#endif
+	pipelineCacheFile = vks::pipelinecache::fileName(directory + name + "_pipelines", deviceProperties);
+
+	auto tStart = std::chrono::high_resolution_clock::now();
+	size_t loadedSize = 0;
+	pipelineCache = vks::pipelinecache::load(device, deviceProperties, pipelineCacheFile, &loadedSize);
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	std::stringstream message;
+	message << "Pipeline cache: ";
+	if (loadedSize > 0) {
+		message << "loaded " << loadedSize << " bytes from " << pipelineCacheFile;
+	} else {
+		message << "no saved cache for this device and driver, starting empty";
+	}
+	message << " (" << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms)";
+#if defined(__ANDROID__)
+	LOGD("%s", message.str().c_str());
+#else
+	std::cout << message.str() << std::endl;
+#endif
+}
+
+/*
+	Write the pipeline cache back to pipelineCacheFile, including the pipelines created by this run
+*/
+void VulkanExampleBase::savePipelineCache()
+{
+	if (pipelineCache == VK_NULL_HANDLE || pipelineCacheFile.empty()) {
+		return;
+	}
+	auto tStart = std::chrono::high_resolution_clock::now();
+	const size_t savedSize = vks::pipelinecache::save(device, pipelineCache, pipelineCacheFile);
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	std::stringstream message;
+	if (savedSize > 0) {
+		message << "Pipeline cache: saved " << savedSize << " bytes to " << pipelineCacheFile;
+	} else {
+		message << "Pipeline cache: could not save " << pipelineCacheFile;
+	}
+	message << " (" << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms)";
+#if defined(__ANDROID__)
+	LOGD("%s", message.str().c_str());
+#else
+	std::cout << message.str() << std::endl;
+#endif
+}
+
 void VulkanExampleBase::renderFrame()
 {
 	auto tStart = std::chrono::high_resolution_clock::now();
@@ -363,6 +429,7 @@ void VulkanExampleBase::renderFrame()
 	frameCounter++;
 	auto tEnd = std::chrono::high_resolution_clock::now();
 	auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+	recordFrameTime(tDiff);
 	frameTimer = (float)tDiff / 1000.0f;
 	camera.update(frameTimer);
 	if (camera.moving())
@@ -439,6 +506,7 @@ void VulkanExampleBase::renderLoop()
 			frameCounter++;
 			auto tEnd = std::chrono::high_resolution_clock::now();
 			auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+			recordFrameTime(tDiff);
 			frameTimer = tDiff / 1000.0f;
 			camera.update(frameTimer);
 			fpsTimer += (float)tDiff;
@@ -505,6 +573,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		recordFrameTime(tDiff);
 		frameTimer = tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
@@ -539,6 +608,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		recordFrameTime(tDiff);
 		frameTimer = tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
@@ -575,6 +645,7 @@ void VulkanExampleBase::renderLoop()
 		frameCounter++;
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		recordFrameTime(tDiff);
 		frameTimer = tDiff / 1000.0f;
 		camera.update(frameTimer);
 		if (camera.moving())
@@ -596,21 +667,69 @@ void VulkanExampleBase::renderLoop()
 #endif
 	// Flush device to make sure all resources can be freed 
 	vkDeviceWaitIdle(device);
+	printFrameTimeStats();
+}
+
+void VulkanExampleBase::recordFrameTime(double frameTime)
+{
+	// About a minute at 1000 fps, older frames are overwritten
+	const size_t maxFrameTimes = 65536;
+	if (frameTimes.size() < maxFrameTimes) {
+		frameTimes.push_back(static_cast<float>(frameTime));
+	} else {
+		frameTimes[frameTimeIndex] = static_cast<float>(frameTime);
+		frameTimeIndex = (frameTimeIndex + 1) % maxFrameTimes;
+	}
+}
+
+void VulkanExampleBase::printFrameTimeStats()
+{
+	if (frameTimes.empty()) {
+		return;
+	}
+	std::vector<float> sorted(frameTimes);
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&sorted](float p) {
+		return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<float>(sorted.size())))];
+	};
+	std::stringstream stats;
+	stats << "Frame times (" << settings.framesInFlight << " frames in flight, " << sorted.size() << " frames): "
+		<< "p50 " << percentile(0.5f) << " ms, p90 " << percentile(0.9f) << " ms, p99 " << percentile(0.99f) << " ms, max " << sorted.back() << " ms";
+#if defined(__ANDROID__)
+	LOGD("%s", stats.str().c_str());
+#else
+	std::cout << stats.str() << std::endl;
+#endif
 }
 
+/*
+	Waits until the GPU is done with the frame submitted settings.framesInFlight frames ago and acquires the next image
+	Afterwards the command buffer and per image resources of currentBuffer are no longer in use by the GPU, and the
+	submit of this frame has to signal waitFences[currentBuffer]
+*/
 void VulkanExampleBase::prepareFrame()
 {
+	VK_CHECK_RESULT(vkWaitForFences(device, 1, &frameFences[currentFrame], VK_TRUE, UINT64_MAX));
+	presentCompleteSemaphore = presentCompleteSemaphores[currentFrame];
+	renderCompleteSemaphore = renderCompleteSemaphores[currentFrame];
 	VkResult err = swapChain.acquireNextImage(presentCompleteSemaphore, &currentBuffer);
 	if ((err == VK_ERROR_OUT_OF_DATE_KHR) || (err == VK_SUBOPTIMAL_KHR)) {
 		windowResize();
 	} else {
 		VK_CHECK_RESULT(err);
 	}
+	// The image can come back before the frame that last rendered to it finished (more images than frames in flight)
+	if (waitFences[currentBuffer] != VK_NULL_HANDLE && waitFences[currentBuffer] != frameFences[currentFrame]) {
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentBuffer], VK_TRUE, UINT64_MAX));
+	}
+	waitFences[currentBuffer] = frameFences[currentFrame];
+	VK_CHECK_RESULT(vkResetFences(device, 1, &frameFences[currentFrame]));
 }
 
 void VulkanExampleBase::submitFrame()
 {
 	VK_CHECK_RESULT(swapChain.queuePresent(queue, currentBuffer, renderCompleteSemaphore));
+	currentFrame = (currentFrame + 1) % settings.framesInFlight;
 }
 
 VulkanExampleBase::VulkanExampleBase()
@@ -636,6 +755,13 @@ VulkanExampleBase::VulkanExampleBase()
 			uint32_t h = strtol(args[i + 1], &numConvPtr, 10);
 			if (numConvPtr != args[i + 1]) { height = h; };
 		}
+		if ((args[i] == std::string("--frames-in-flight")) && (i + 1 < args.size())) {
+			uint32_t n = strtol(args[i + 1], &numConvPtr, 10);
+			if (numConvPtr != args[i + 1]) { settings.framesInFlight = std::max(n, 1u); };
+		}
+		if (args[i] == std::string("--no-pipeline-cache")) {
+			settings.persistentPipelineCache = false;
+		}
 	}
 	
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -673,12 +799,13 @@ VulkanExampleBase::~VulkanExampleBase()
 	vkDestroyImageView(device, depthStencil.view, nullptr);
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
+	savePipelineCache();
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 	vkDestroyCommandPool(device, cmdPool, nullptr);
-	vkDestroySemaphore(device, presentCompleteSemaphore, nullptr);
-	vkDestroySemaphore(device, renderCompleteSemaphore, nullptr);
-	for (auto& fence : waitFences) {
-		vkDestroyFence(device, fence, nullptr);
+	for (uint32_t i = 0; i < frameFences.size(); i++) {
+		vkDestroySemaphore(device, presentCompleteSemaphores[i], nullptr);
+		vkDestroySemaphore(device, renderCompleteSemaphores[i], nullptr);
+		vkDestroyFence(device, frameFences[i], nullptr);
 	}
 	if (settings.multiSampling) {
 		vkDestroyImage(device, multisampleTarget.color.image, nullptr);
@@ -1894,6 +2021,8 @@ void VulkanExampleBase::windowResize()
 	width = destWidth;
 	height = destHeight;
 	setupSwapChain();
+	// The image count may change, all frames are done after the wait above
+	waitFences.assign(swapChain.imageCount, VK_NULL_HANDLE);
 	vkDestroyImageView(device, depthStencil.view, nullptr);
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
@@ -39,6 +39,8 @@
 #include <sstream>
 #include <array>
 #include <numeric>
+#include <vector>
+#include <algorithm>
 
 #include "vulkan/vulkan.h"
 
@@ -48,6 +50,7 @@
 
 #include "VulkanDevice.hpp"
 #include "VulkanSwapChain.hpp"
+#include "VulkanPipelineCache.hpp"
 
 class VulkanExampleBase
 {
@@ -56,6 +59,11 @@ private:
 	uint32_t frameCounter = 0;
 	uint32_t lastFPS = 0;
 	bool viewUpdated = false;
+	// Most recent frame times in ms (ring buffer), reported as percentiles when the render loop exits
+	std::vector<float> frameTimes;
+	size_t frameTimeIndex = 0;
+	void recordFrameTime(double frameTime);
+	void printFrameTimeStats();
 	uint32_t destWidth;
 	uint32_t destHeight;
 	bool resizing = false;
@@ -92,10 +100,23 @@ protected:
 	std::vector<VkFramebuffer>frameBuffers;
 	uint32_t currentBuffer = 0;
 	VkDescriptorPool descriptorPool;
-	VkPipelineCache pipelineCache;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	// Where pipelineCache is loaded from and saved to, empty if it is not kept on disk
+	std::string pipelineCacheFile;
+	void createPipelineCache();
+	void savePipelineCache();
 	VulkanSwapChain swapChain;
+	/*
+		Up to settings.framesInFlight frames are recorded and submitted ahead of the GPU, each with its own semaphores and fence
+		prepareFrame() points presentCompleteSemaphore and renderCompleteSemaphore at the ones of the current frame
+	*/
 	VkSemaphore presentCompleteSemaphore;
 	VkSemaphore renderCompleteSemaphore;
+	std::vector<VkSemaphore> presentCompleteSemaphores;
+	std::vector<VkSemaphore> renderCompleteSemaphores;
+	std::vector<VkFence> frameFences;
+	uint32_t currentFrame = 0;
+	// Per swap chain image, the fence of the frame that last rendered to it (and submits to it next after prepareFrame())
 	std::vector<VkFence> waitFences;
 	std::string title = "Vulkan Example";
 	std::string name = "vulkanExample";
@@ -117,6 +138,10 @@ public:
 		bool vsync = false;
 		bool multiSampling = false;
 		VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_4_BIT;
+		// Frames the CPU may run ahead of the GPU (--frames-in-flight), 1 trades throughput for latency
+		uint32_t framesInFlight = 2;
+		// Keep the pipeline cache on disk between runs (--no-pipeline-cache disables it), see VulkanPipelineCache.hpp
+		bool persistentPipelineCache = true;
 	} settings;
 
 	struct DepthStencil {
@@ -0,0 +1,359 @@
+/*
+* Pooled device memory allocator
+*
+* Sub-allocates buffers and images from a few large VkDeviceMemory blocks per memory type instead of calling
+* vkAllocateMemory for every resource, which keeps the allocation count far below maxMemoryAllocationCount
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "vulkan/vulkan.h"
+#include "macros.h"
+
+namespace vks
+{
+	struct MemoryBlock;
+
+	/*
+		A range of a pooled memory block, returned by MemoryAllocator::allocate
+		mapped points at offset and is only set for host visible memory, the blocks stay mapped for their whole lifetime
+	*/
+	struct Allocation {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void *mapped = nullptr;
+		MemoryBlock *block = nullptr;
+	};
+
+	struct MemoryBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint8_t *mapped = nullptr;
+		uint32_t allocationCount = 0;
+		// Holds a single resource that did not fit the default block size, released as soon as it is freed
+		bool dedicated = false;
+		uint32_t pool = 0;
+		// Free ranges as offset -> size, neighbours are merged on free
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+		// The same ranges as (size, offset), for the best fit search
+		std::set<std::pair<VkDeviceSize, VkDeviceSize>> freeBySize;
+	};
+
+	class MemoryAllocator
+	{
+	public:
+		/*
+			Buffers and linear images never share a block with optimal tiling images, so two neighbours in a block
+			are always of the same kind and bufferImageGranularity does not have to be padded in between
+		*/
+		enum ResourceKind {
+			RESOURCE_LINEAR = 0,
+			RESOURCE_OPTIMAL = 1
+		};
+
+		struct Stats {
+			uint32_t blockCount = 0;
+			uint32_t allocationCount = 0;
+			// Number of vkAllocateMemory calls since init, including blocks that were released again
+			uint32_t deviceAllocations = 0;
+			VkDeviceSize bytesReserved = 0;
+			VkDeviceSize bytesUsed = 0;
+			VkDeviceSize largestFreeRange = 0;
+			// Share of the free bytes of the blocks in use that lie outside the largest free range of their block
+			// 0 when every block has one hole, close to 1 when the free space is split into many small holes
+			float fragmentation = 0.0f;
+		};
+
+		// Size of new blocks, requests larger than half of it get a block of their own
+		VkDeviceSize blockSize = 64 * 1024 * 1024;
+
+		void init(VkDevice device, const VkPhysicalDeviceMemoryProperties &memoryProperties, const VkPhysicalDeviceLimits &limits)
+		{
+			this->device = device;
+			this->memoryProperties = memoryProperties;
+			nonCoherentAtomSize = std::max<VkDeviceSize>(limits.nonCoherentAtomSize, 1);
+			pools.resize(memoryProperties.memoryTypeCount * 2);
+		}
+
+		/*
+			Sub-allocate memory for requirements from memory type memoryType
+			Host visible, non coherent memory is aligned to nonCoherentAtomSize so every allocation can be flushed on its own
+		*/
+		VkResult allocate(const VkMemoryRequirements &requirements, uint32_t memoryType, ResourceKind kind, Allocation *allocation)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[memoryType].propertyFlags;
+			VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+			if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+				alignment = std::max(alignment, nonCoherentAtomSize);
+			}
+			const uint32_t poolIndex = memoryType * 2 + kind;
+			std::vector<std::unique_ptr<MemoryBlock>> &pool = pools[poolIndex];
+
+			const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+			// Small heaps (e.g. the 256 MiB device local + host visible heap) get smaller blocks
+			const VkDeviceSize poolBlockSize = std::max<VkDeviceSize>(std::min(blockSize, heapSize / 8), 1);
+
+			if (requirements.size > poolBlockSize / 2) {
+				MemoryBlock *block = nullptr;
+				VkResult result = createBlock(poolIndex, requirements.size, true, &block);
+				if (result != VK_SUCCESS) {
+					return result;
+				}
+				take(block, block->freeRanges.begin(), 0, requirements.size, allocation);
+				return VK_SUCCESS;
+			}
+
+			// Best fit over all blocks of the pool: the smallest free range the request fits in
+			// Ranges of at least size + alignment - 1 always fit, only the smaller ones before them can fail on the alignment padding
+			MemoryBlock *bestBlock = nullptr;
+			VkDeviceSize bestSize = 0;
+			VkDeviceSize bestRangeOffset = 0;
+			VkDeviceSize bestOffset = 0;
+			for (auto &block : pool) {
+				if (block->dedicated) {
+					continue;
+				}
+				auto range = block->freeBySize.lower_bound(std::make_pair(requirements.size, VkDeviceSize(0)));
+				for (; range != block->freeBySize.end(); range++) {
+					if (bestBlock && range->first >= bestSize) {
+						break;
+					}
+					const VkDeviceSize offset = alignUp(range->second, alignment);
+					if (offset + requirements.size <= range->second + range->first) {
+						bestBlock = block.get();
+						bestSize = range->first;
+						bestRangeOffset = range->second;
+						bestOffset = offset;
+						break;
+					}
+				}
+			}
+
+			if (!bestBlock) {
+				VkResult result = createBlock(poolIndex, poolBlockSize, false, &bestBlock);
+				if (result != VK_SUCCESS) {
+					return result;
+				}
+				bestRangeOffset = 0;
+				bestOffset = 0;
+			}
+			take(bestBlock, bestBlock->freeRanges.find(bestRangeOffset), bestOffset, requirements.size, allocation);
+			return VK_SUCCESS;
+		}
+
+		/*
+			Return an allocation to its block
+			An empty block is kept for reuse (staging buffers come and go), but only one per pool
+		*/
+		void free(Allocation &allocation)
+		{
+			if (!allocation.block) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			MemoryBlock *block = allocation.block;
+			insertFreeRange(block, allocation.offset, allocation.size);
+			block->allocationCount--;
+			usedBytes -= allocation.size;
+			allocation = Allocation();
+
+			if (block->allocationCount > 0) {
+				return;
+			}
+			std::vector<std::unique_ptr<MemoryBlock>> &pool = pools[block->pool];
+			bool keep = !block->dedicated;
+			if (keep) {
+				for (auto &other : pool) {
+					if (other.get() != block && !other->dedicated && other->allocationCount == 0) {
+						keep = false;
+						break;
+					}
+				}
+			}
+			if (!keep) {
+				releaseBlock(block);
+			}
+		}
+
+		Stats stats()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Stats stats;
+			VkDeviceSize freeBytes = 0;
+			VkDeviceSize splitBytes = 0;
+			for (auto &pool : pools) {
+				for (auto &block : pool) {
+					stats.blockCount++;
+					stats.allocationCount += block->allocationCount;
+					stats.bytesReserved += block->size;
+					if (block->freeBySize.empty()) {
+						continue;
+					}
+					const VkDeviceSize largest = block->freeBySize.rbegin()->first;
+					stats.largestFreeRange = std::max(stats.largestFreeRange, largest);
+					if (block->allocationCount > 0) {
+						VkDeviceSize blockFree = 0;
+						for (auto &range : block->freeRanges) {
+							blockFree += range.second;
+						}
+						freeBytes += blockFree;
+						splitBytes += blockFree - largest;
+					}
+				}
+			}
+			stats.deviceAllocations = deviceAllocations;
+			stats.bytesUsed = usedBytes;
+			if (freeBytes > 0) {
+				stats.fragmentation = (float)((double)splitBytes / (double)freeBytes);
+			}
+			return stats;
+		}
+
+		void printStats(std::ostream &out = std::cout)
+		{
+			Stats s = stats();
+			const double mib = 1.0 / (1024.0 * 1024.0);
+			out << std::fixed << std::setprecision(2)
+				<< "Device memory: " << s.allocationCount << " allocations in " << s.blockCount << " blocks (" << s.deviceAllocations << " vkAllocateMemory calls), "
+				<< s.bytesUsed * mib << " of " << s.bytesReserved * mib << " MiB used, largest free range " << s.largestFreeRange * mib << " MiB, "
+				<< "fragmentation " << s.fragmentation * 100.0f << "%" << std::endl;
+			out.unsetf(std::ios_base::floatfield);
+		}
+
+		// Free all blocks, every allocation must have been freed or be abandoned together with the device
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto &pool : pools) {
+				for (auto &block : pool) {
+					if (block->mapped) {
+						vkUnmapMemory(device, block->memory);
+					}
+					vkFreeMemory(device, block->memory, nullptr);
+				}
+				pool.clear();
+			}
+			usedBytes = 0;
+		}
+
+	private:
+		VkDevice device = VK_NULL_HANDLE;
+		VkPhysicalDeviceMemoryProperties memoryProperties{};
+		VkDeviceSize nonCoherentAtomSize = 1;
+		// Indexed by memoryType * 2 + ResourceKind
+		std::vector<std::vector<std::unique_ptr<MemoryBlock>>> pools;
+		VkDeviceSize usedBytes = 0;
+		uint32_t deviceAllocations = 0;
+		std::mutex mutex;
+
+		static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		VkResult createBlock(uint32_t poolIndex, VkDeviceSize size, bool dedicated, MemoryBlock **block)
+		{
+			const uint32_t memoryType = poolIndex / 2;
+			VkMemoryAllocateInfo memAlloc{};
+			memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memAlloc.allocationSize = size;
+			memAlloc.memoryTypeIndex = memoryType;
+			std::unique_ptr<MemoryBlock> newBlock(new MemoryBlock());
+			VkResult result = vkAllocateMemory(device, &memAlloc, nullptr, &newBlock->memory);
+			if (result != VK_SUCCESS) {
+				return result;
+			}
+			deviceAllocations++;
+			if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+				void *mapped;
+				VK_CHECK_RESULT(vkMapMemory(device, newBlock->memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+				newBlock->mapped = static_cast<uint8_t*>(mapped);
+			}
+			newBlock->size = size;
+			newBlock->dedicated = dedicated;
+			newBlock->pool = poolIndex;
+			addFreeRange(newBlock.get(), 0, size);
+			*block = newBlock.get();
+			pools[poolIndex].push_back(std::move(newBlock));
+			return VK_SUCCESS;
+		}
+
+		void releaseBlock(MemoryBlock *block)
+		{
+			std::vector<std::unique_ptr<MemoryBlock>> &pool = pools[block->pool];
+			if (block->mapped) {
+				vkUnmapMemory(device, block->memory);
+			}
+			vkFreeMemory(device, block->memory, nullptr);
+			pool.erase(std::find_if(pool.begin(), pool.end(), [block](const std::unique_ptr<MemoryBlock> &b) { return b.get() == block; }));
+		}
+
+		// Cut [offset, offset + size) out of range, the alignment padding in front of it stays free
+		void take(MemoryBlock *block, std::map<VkDeviceSize, VkDeviceSize>::iterator range, VkDeviceSize offset, VkDeviceSize size, Allocation *allocation)
+		{
+			const VkDeviceSize rangeStart = range->first;
+			const VkDeviceSize rangeEnd = range->first + range->second;
+			removeFreeRange(block, range);
+			if (offset > rangeStart) {
+				addFreeRange(block, rangeStart, offset - rangeStart);
+			}
+			if (offset + size < rangeEnd) {
+				addFreeRange(block, offset + size, rangeEnd - (offset + size));
+			}
+			block->allocationCount++;
+			usedBytes += size;
+
+			allocation->memory = block->memory;
+			allocation->offset = offset;
+			allocation->size = size;
+			allocation->mapped = block->mapped ? block->mapped + offset : nullptr;
+			allocation->block = block;
+		}
+
+		void addFreeRange(MemoryBlock *block, VkDeviceSize offset, VkDeviceSize size)
+		{
+			block->freeRanges[offset] = size;
+			block->freeBySize.insert(std::make_pair(size, offset));
+		}
+
+		std::map<VkDeviceSize, VkDeviceSize>::iterator removeFreeRange(MemoryBlock *block, std::map<VkDeviceSize, VkDeviceSize>::iterator range)
+		{
+			block->freeBySize.erase(std::make_pair(range->second, range->first));
+			return block->freeRanges.erase(range);
+		}
+
+		// Give a range back to the block, merged with the free ranges right before and after it
+		void insertFreeRange(MemoryBlock *block, VkDeviceSize offset, VkDeviceSize size)
+		{
+			auto next = block->freeRanges.lower_bound(offset);
+			if (next != block->freeRanges.end() && offset + size == next->first) {
+				size += next->second;
+				next = removeFreeRange(block, next);
+			}
+			if (next != block->freeRanges.begin()) {
+				auto prev = std::prev(next);
+				if (prev->first + prev->second == offset) {
+					offset = prev->first;
+					size += prev->second;
+					removeFreeRange(block, prev);
+				}
+			}
+			addFreeRange(block, offset, size);
+		}
+	};
+}
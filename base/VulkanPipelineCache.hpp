@@ -0,0 +1,132 @@
+/*
+* Pipeline cache persisted to disk
+*
+* Loads the data of a VkPipelineCache saved by an earlier run, so the pipelines are not compiled from scratch on every
+* start. The file name and the header check are keyed on the vendor, device and pipelineCacheUUID of the driver,
+* data written by another device or driver version is never handed to the driver
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "vulkan/vulkan.h"
+#include "macros.h"
+#include "AtomicFile.hpp"
+
+namespace vks
+{
+	namespace pipelinecache
+	{
+		// Start of the data returned by vkGetPipelineCacheData (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		struct Header {
+			uint32_t headerSize;
+			uint32_t headerVersion;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			uint8_t uuid[VK_UUID_SIZE];
+		};
+
+		/*
+			Cache file of a device, "<prefix>_<vendor>_<device>_<uuid>.bin", so switching GPUs or drivers does not
+			overwrite the cache of the other one
+		*/
+		inline std::string fileName(const std::string &prefix, const VkPhysicalDeviceProperties &properties)
+		{
+			std::ostringstream name;
+			name << prefix << "_" << std::hex << std::setfill('0') << std::setw(4) << properties.vendorID << "_" << std::setw(4) << properties.deviceID << "_";
+			for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+				name << std::setw(2) << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+			}
+			name << ".bin";
+			return name.str();
+		}
+
+		// True if data was saved from a pipeline cache of this device and driver
+		inline bool validHeader(const void *data, size_t size, const VkPhysicalDeviceProperties &properties)
+		{
+			Header header;
+			if (size < sizeof(header)) {
+				return false;
+			}
+			memcpy(&header, data, sizeof(header));
+			return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+				header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+				memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+
+		/*
+			Create a pipeline cache with the content of filename if it was saved for this device and driver, empty otherwise
+			loadedSize is set to the bytes handed to the driver (0 if the file was missing or did not match)
+		*/
+		inline VkPipelineCache load(VkDevice device, const VkPhysicalDeviceProperties &properties, const std::string &filename, size_t *loadedSize = nullptr)
+		{
+			std::vector<char> data;
+			std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+			if (file) {
+				const std::streamoff size = file.tellg();
+				if (size > 0) {
+					data.resize(static_cast<size_t>(size));
+					file.seekg(0);
+					if (!file.read(data.data(), size)) {
+						data.clear();
+					}
+				}
+			}
+			if (!validHeader(data.data(), data.size(), properties)) {
+				data.clear();
+			}
+
+			VkPipelineCacheCreateInfo pipelineCacheCreateInfo{};
+			pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+			pipelineCacheCreateInfo.initialDataSize = data.size();
+			pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+			VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+			if (!data.empty() && vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+				// Rejected by the driver, start over with an empty cache
+				data.clear();
+				pipelineCacheCreateInfo.initialDataSize = 0;
+				pipelineCacheCreateInfo.pInitialData = nullptr;
+				pipelineCache = VK_NULL_HANDLE;
+			}
+			if (pipelineCache == VK_NULL_HANDLE) {
+				VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+			}
+			if (loadedSize) {
+				*loadedSize = data.size();
+			}
+			return pipelineCache;
+		}
+
+		/*
+			Write the content of pipelineCache to filename, returns the bytes written or 0 on failure
+		*/
+		inline size_t save(VkDevice device, VkPipelineCache pipelineCache, const std::string &filename)
+		{
+			size_t size = 0;
+			if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+				return 0;
+			}
+			std::vector<char> data(size);
+			if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) {
+				return 0;
+			}
+
+			if (!writeFileAtomic(filename, data.data(), size)) {
+				return 0;
+			}
+			return size;
+		}
+	}
+}
@@ -0,0 +1,425 @@
+/*
+* Batched staging uploads
+*
+* Collects the buffer and image copies of a load in one command buffer, staged through a persistently mapped ring buffer,
+* and submits them together. submit() returns a ticket instead of waiting, so the host can go on (or render) while the
+* copies run, optionally on a dedicated transfer queue family
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "vulkan/vulkan.h"
+#include "macros.h"
+#include "VulkanMemoryAllocator.hpp"
+
+namespace vks
+{
+	class UploadManager
+	{
+	public:
+		// Increases with every submit, 0 is never returned
+		typedef uint64_t Ticket;
+
+		// Mapped staging memory, copy from buffer at offset
+		struct StagingRange {
+			VkBuffer buffer;
+			VkDeviceSize offset;
+			void *mapped;
+		};
+
+		// Size of the staging ring, larger uploads (or uploads while the ring is still in use) get a staging buffer of their own
+		VkDeviceSize ringSize = 32 * 1024 * 1024;
+		// Copy on the dedicated transfer queue family if the device has one, set before the first upload
+		bool useTransferQueue = true;
+
+		void init(VkDevice device, MemoryAllocator *allocator, const VkPhysicalDeviceMemoryProperties &memoryProperties, uint32_t graphicsFamily, uint32_t transferFamily)
+		{
+			this->device = device;
+			this->allocator = allocator;
+			this->memoryProperties = memoryProperties;
+			this->graphicsFamily = graphicsFamily;
+			this->transferFamily = transferFamily;
+		}
+
+		// True if the copies run on the transfer queue family and the resources are handed over to the graphics queue family
+		bool dedicatedTransfer() const
+		{
+			return useTransferQueue && transferFamily != graphicsFamily;
+		}
+
+		/*
+			Reserve size bytes of mapped staging memory for the current batch, the caller writes the data and records the copy
+			Never waits for the GPU: if the ring has no room, the range comes from a temporary pooled buffer instead
+		*/
+		StagingRange stage(VkDeviceSize size, VkDeviceSize alignment = 16)
+		{
+			begin();
+			collect();
+			if (ring == VK_NULL_HANDLE) {
+				ringMemory = createStagingBuffer(ringSize, &ring);
+			}
+			uint64_t offset = alignUp(ringHead, alignment);
+			if (offset % ringSize + size > ringSize) {
+				// Does not fit before the end of the ring, start over at its beginning
+				offset = alignUp(offset, ringSize);
+			}
+			if (size <= ringSize && offset + size - ringTail <= ringSize) {
+				ringHead = offset + size;
+				const VkDeviceSize ringOffset = static_cast<VkDeviceSize>(offset % ringSize);
+				return { ring, ringOffset, static_cast<uint8_t*>(ringMemory.mapped) + ringOffset };
+			}
+			std::pair<VkBuffer, Allocation> buffer;
+			buffer.second = createStagingBuffer(size, &buffer.first);
+			current.stagingBuffers.push_back(buffer);
+			return { buffer.first, 0, buffer.second.mapped };
+		}
+
+		/*
+			Copy size bytes of data to dst at dstOffset and make them visible to dstAccess in dstStage on the graphics queue family
+			data is copied to staging memory right away and can be freed once this returns
+		*/
+		void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+		{
+			if (size == 0) {
+				return;
+			}
+			StagingRange staging = stage(size);
+			memcpy(staging.mapped, data, static_cast<size_t>(size));
+			copyStaged(staging, dst, dstOffset, size, dstStage, dstAccess);
+		}
+
+		/*
+			Same as uploadBuffer for data the caller has already written to a range from stage() of the current batch,
+			e.g. a loader that produces its output straight in staging memory
+		*/
+		void copyStaged(const StagingRange &staging, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+		{
+			if (size == 0) {
+				return;
+			}
+			VkBufferCopy copyRegion = {};
+			copyRegion.srcOffset = staging.offset;
+			copyRegion.dstOffset = dstOffset;
+			copyRegion.size = size;
+			vkCmdCopyBuffer(transferCommandBuffer(), staging.buffer, dst, 1, &copyRegion);
+			releaseBuffer(dst, dstOffset, size, dstStage, dstAccess);
+		}
+
+		// Command buffer of the current batch for copies, runs on the transfer queue family
+		VkCommandBuffer transferCommandBuffer()
+		{
+			begin();
+			return current.transferCmd;
+		}
+
+		// Command buffer of the current batch for work that needs the graphics queue (e.g. blits), runs after all copies of the batch
+		VkCommandBuffer graphicsCommandBuffer()
+		{
+			begin();
+			return current.graphicsCmd;
+		}
+
+		/*
+			Make the transfer writes to a buffer range visible to the graphics queue family
+			With a dedicated transfer queue this is a queue family ownership transfer: released in the transfer and acquired in the graphics command buffer
+		*/
+		void releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+		{
+			VkBufferMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccess;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = buffer;
+			barrier.offset = offset;
+			barrier.size = size;
+			if (dedicatedTransfer()) {
+				barrier.srcQueueFamilyIndex = transferFamily;
+				barrier.dstQueueFamilyIndex = graphicsFamily;
+				barrier.dstAccessMask = 0;
+				vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = dstAccess;
+			}
+			vkCmdPipelineBarrier(graphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+
+		// Same as releaseBuffer for an image, transitioning it from oldLayout to newLayout
+		void releaseImage(VkImage image, const VkImageSubresourceRange &subresourceRange, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccess;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = subresourceRange;
+			if (dedicatedTransfer()) {
+				barrier.srcQueueFamilyIndex = transferFamily;
+				barrier.dstQueueFamilyIndex = graphicsFamily;
+				barrier.dstAccessMask = 0;
+				vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = dstAccess;
+			}
+			vkCmdPipelineBarrier(graphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		/*
+			Submit everything recorded since the last submit and return its ticket without waiting
+			graphicsQueue must be of the graphics queue family, it runs the graphics command buffer (after the transfer queue signals)
+			Work submitted to it afterwards is ordered after the upload by the barriers of releaseBuffer/releaseImage
+			Must be called from the thread that submits to graphicsQueue
+		*/
+		Ticket submit(VkQueue graphicsQueue)
+		{
+			if (!recording) {
+				return lastTicket;
+			}
+			VK_CHECK_RESULT(vkEndCommandBuffer(current.transferCmd));
+			VkFenceCreateInfo fenceInfo{};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &current.fence));
+
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			if (current.graphicsCmd != current.transferCmd) {
+				VK_CHECK_RESULT(vkEndCommandBuffer(current.graphicsCmd));
+				VkSemaphoreCreateInfo semaphoreInfo{};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &current.semaphore));
+				submitInfo.pCommandBuffers = &current.transferCmd;
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &current.semaphore;
+				VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+				// Only the acquire barriers and blits wait for the copies
+				const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+				submitInfo.signalSemaphoreCount = 0;
+				submitInfo.pSignalSemaphores = nullptr;
+				submitInfo.waitSemaphoreCount = 1;
+				submitInfo.pWaitSemaphores = &current.semaphore;
+				submitInfo.pWaitDstStageMask = &waitStage;
+				submitInfo.pCommandBuffers = &current.graphicsCmd;
+				VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, current.fence));
+			} else {
+				submitInfo.pCommandBuffers = &current.transferCmd;
+				VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, current.fence));
+			}
+
+			current.ticket = ++lastTicket;
+			current.ringEnd = ringHead;
+			pending.push_back(current);
+			current = Batch();
+			recording = false;
+			return lastTicket;
+		}
+
+		// True once the GPU has finished the batch of ticket (and all batches before it)
+		bool isComplete(Ticket ticket)
+		{
+			collect();
+			return ticket <= completedTicket;
+		}
+
+		// Block until the batch of ticket has finished
+		void wait(Ticket ticket)
+		{
+			while (!pending.empty() && pending.front().ticket <= ticket) {
+				VK_CHECK_RESULT(vkWaitForFences(device, 1, &pending.front().fence, VK_TRUE, UINT64_MAX));
+				retire(pending.front());
+				pending.pop_front();
+			}
+		}
+
+		// Wait for all submitted batches and free the staging memory, an unsubmitted batch is dropped
+		void destroy()
+		{
+			wait(lastTicket);
+			if (recording) {
+				freeCommandBuffers(current);
+				releaseStagingBuffers(current);
+				current = Batch();
+				recording = false;
+			}
+			if (ring != VK_NULL_HANDLE) {
+				vkDestroyBuffer(device, ring, nullptr);
+				allocator->free(ringMemory);
+				ring = VK_NULL_HANDLE;
+			}
+			if (transferPool != VK_NULL_HANDLE) {
+				vkDestroyCommandPool(device, transferPool, nullptr);
+				transferPool = VK_NULL_HANDLE;
+			}
+			if (graphicsPool != VK_NULL_HANDLE) {
+				vkDestroyCommandPool(device, graphicsPool, nullptr);
+				graphicsPool = VK_NULL_HANDLE;
+			}
+		}
+
+	private:
+		struct Batch {
+			Ticket ticket = 0;
+			VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+			// Same as transferCmd unless a dedicated transfer queue is used
+			VkCommandBuffer graphicsCmd = VK_NULL_HANDLE;
+			VkSemaphore semaphore = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			// Ring position after the last byte staged for this batch, the ring is free up to here once it finished
+			uint64_t ringEnd = 0;
+			std::vector<std::pair<VkBuffer, Allocation>> stagingBuffers;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		MemoryAllocator *allocator = nullptr;
+		VkPhysicalDeviceMemoryProperties memoryProperties{};
+		uint32_t graphicsFamily = 0;
+		uint32_t transferFamily = 0;
+		VkQueue transferQueue = VK_NULL_HANDLE;
+		VkCommandPool transferPool = VK_NULL_HANDLE;
+		VkCommandPool graphicsPool = VK_NULL_HANDLE;
+
+		VkBuffer ring = VK_NULL_HANDLE;
+		Allocation ringMemory;
+		// Absolute byte positions, the ring offset is position % ringSize
+		uint64_t ringHead = 0;
+		uint64_t ringTail = 0;
+
+		Batch current;
+		bool recording = false;
+		std::deque<Batch> pending;
+		Ticket lastTicket = 0;
+		Ticket completedTicket = 0;
+
+		static uint64_t alignUp(uint64_t value, uint64_t alignment)
+		{
+			alignment = std::max<uint64_t>(alignment, 1);
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		VkCommandBuffer allocateCommandBuffer(VkCommandPool pool)
+		{
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+			cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmdBufAllocateInfo.commandPool = pool;
+			cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			cmdBufAllocateInfo.commandBufferCount = 1;
+			VkCommandBuffer cmdBuffer;
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer));
+			VkCommandBufferBeginInfo cmdBufInfo{};
+			cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
+			return cmdBuffer;
+		}
+
+		VkCommandPool createCommandPool(uint32_t queueFamilyIndex)
+		{
+			VkCommandPoolCreateInfo cmdPoolInfo = {};
+			cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			VkCommandPool cmdPool;
+			VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &cmdPool));
+			return cmdPool;
+		}
+
+		// Start recording a new batch if none is open
+		void begin()
+		{
+			if (recording) {
+				return;
+			}
+			if (graphicsPool == VK_NULL_HANDLE) {
+				graphicsPool = createCommandPool(graphicsFamily);
+				if (dedicatedTransfer()) {
+					transferPool = createCommandPool(transferFamily);
+					vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+				}
+			}
+			current.graphicsCmd = allocateCommandBuffer(graphicsPool);
+			current.transferCmd = transferPool != VK_NULL_HANDLE ? allocateCommandBuffer(transferPool) : current.graphicsCmd;
+			recording = true;
+		}
+
+		Allocation createStagingBuffer(VkDeviceSize size, VkBuffer *buffer)
+		{
+			VkBufferCreateInfo bufferCreateInfo{};
+			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			bufferCreateInfo.size = size;
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, buffer));
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(device, *buffer, &memReqs);
+			const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			uint32_t memoryType = UINT32_MAX;
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+				if ((memReqs.memoryTypeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
+					memoryType = i;
+					break;
+				}
+			}
+			if (memoryType == UINT32_MAX) {
+				throw std::runtime_error("Could not find a host visible memory type for staging");
+			}
+			Allocation allocation;
+			VK_CHECK_RESULT(allocator->allocate(memReqs, memoryType, MemoryAllocator::RESOURCE_LINEAR, &allocation));
+			VK_CHECK_RESULT(vkBindBufferMemory(device, *buffer, allocation.memory, allocation.offset));
+			return allocation;
+		}
+
+		// Retire the finished batches in submission order
+		void collect()
+		{
+			while (!pending.empty() && vkGetFenceStatus(device, pending.front().fence) == VK_SUCCESS) {
+				retire(pending.front());
+				pending.pop_front();
+			}
+		}
+
+		void retire(Batch &batch)
+		{
+			freeCommandBuffers(batch);
+			releaseStagingBuffers(batch);
+			vkDestroyFence(device, batch.fence, nullptr);
+			if (batch.semaphore != VK_NULL_HANDLE) {
+				vkDestroySemaphore(device, batch.semaphore, nullptr);
+			}
+			ringTail = batch.ringEnd;
+			completedTicket = batch.ticket;
+		}
+
+		void freeCommandBuffers(Batch &batch)
+		{
+			vkFreeCommandBuffers(device, graphicsPool, 1, &batch.graphicsCmd);
+			if (batch.transferCmd != batch.graphicsCmd) {
+				vkFreeCommandBuffers(device, transferPool, 1, &batch.transferCmd);
+			}
+		}
+
+		void releaseStagingBuffers(Batch &batch)
+		{
+			for (auto &buffer : batch.stagingBuffers) {
+				vkDestroyBuffer(device, buffer.first, nullptr);
+				allocator->free(buffer.second);
+			}
+			batch.stagingBuffers.clear();
+		}
+	};
+}
@@ -12,6 +12,12 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <cstdio>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.hpp"
@@ -24,13 +30,18 @@
 #include <gli/gli.hpp>
 
 #include "tiny_gltf.h"
+#include "MappedFile.hpp"
+#include "AtomicFile.hpp"
+#include "ModelCache.hpp"
+#include "AnimationSampler.hpp"
+#include "AnimationBake.hpp"
+#include "AnimationCompression.hpp"
+#include "AnimationStream.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
 #endif
 
-#define MAX_WEIGHTS 8
-
 namespace vkglTF
 {
 	/*
@@ -40,7 +51,7 @@ namespace vkglTF
 		vks::VulkanDevice *device;
 		VkImage image;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
+		vks::Allocation deviceMemory;
 		VkImageView view;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -59,15 +70,16 @@ namespace vkglTF
 		{
 			vkDestroyImageView(device->logicalDevice, view, nullptr);
 			vkDestroyImage(device->logicalDevice, image, nullptr);
-			vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
+			device->freeMemory(deviceMemory);
 			vkDestroySampler(device->logicalDevice, sampler, nullptr);
 		}
 
 		/*
 			Load a texture from a glTF image (stored as vector of chars loaded via stb_image)
 			Also generates the mip chain as glTF images are stored as jpg or png without any mips
+			Only records the upload into device->uploadManager, it is submitted with the buffers of the model
 		*/
-		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device, VkQueue copyQueue)
+		void fromglTfImage(tinygltf::Image &gltfimage, vks::VulkanDevice *device)
 		{
 			this->device = device;
 
@@ -107,29 +119,8 @@ namespace vkglTF
 			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
 			assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 
-			VkMemoryAllocateInfo memAllocInfo{};
-			memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			VkMemoryRequirements memReqs{};
-
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo{};
-			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bufferCreateInfo.size = bufferSize;
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			uint8_t *data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void **)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
+			vks::UploadManager::StagingRange staging = device->uploadManager.stage(bufferSize);
+			memcpy(staging.mapped, buffer, bufferSize);
 
 			VkImageCreateInfo imageCreateInfo{};
 			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -145,13 +136,10 @@ namespace vkglTF
 			imageCreateInfo.extent = { width, height, 1 };
 			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
+			VK_CHECK_RESULT(device->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &deviceMemory));
 
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			// The copy of the first level runs with the other copies of the load, the mip chain is blitted on the graphics queue
+			VkCommandBuffer copyCmd = device->uploadManager.transferCommandBuffer();
 
 			VkImageSubresourceRange subresourceRange = {};
 			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -171,6 +159,7 @@ namespace vkglTF
 			}
 
 			VkBufferImageCopy bufferCopyRegion = {};
+			bufferCopyRegion.bufferOffset = staging.offset;
 			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			bufferCopyRegion.imageSubresource.mipLevel = 0;
 			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
@@ -179,27 +168,12 @@ namespace vkglTF
 			bufferCopyRegion.imageExtent.height = height;
 			bufferCopyRegion.imageExtent.depth = 1;
 
-			vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			device->flushCommandBuffer(copyCmd, copyQueue, true);
+			vkCmdCopyBufferToImage(copyCmd, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
 
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+			device->uploadManager.releaseImage(image, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
 
 			// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-			VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkCommandBuffer blitCmd = device->uploadManager.graphicsCommandBuffer();
 			for (uint32_t i = 1; i < mipLevels; i++) {
 				VkImageBlit imageBlit{};
 
@@ -259,13 +233,13 @@ namespace vkglTF
 				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 				imageMemoryBarrier.image = image;
 				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 			}
 
-			device->flushCommandBuffer(blitCmd, copyQueue, true);
+			// Submitted with the next device->uploadManager.submit(), for a model at the end of the load
 
 			VkSamplerCreateInfo samplerInfo{};
 			samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -324,37 +298,169 @@ namespace vkglTF
 	struct Primitive {
 		uint32_t firstIndex;
 		uint32_t indexCount;
+		int32_t materialIndex; // glTF material index, -1 if none
 		Material &material;
 	};
 
 	struct MorphPushConst{
-		uint32_t bufferOffset;
+		uint32_t bufferOffset; // in floats, always a multiple of 4 (vec4 aligned)
 		uint32_t normalOffset;
 		uint32_t tangentOffset;
 		uint32_t vertexStride;
-		float    weights[MAX_WEIGHTS];
+		uint32_t sparse; // 1 if bufferOffset points to per vertex delta lists instead of dense deltas
+		uint32_t weightOffset; // start of the mesh's block in Model::morphWeightData
+		uint32_t quantized; // 1 if the deltas are stored as snorm, see MorphQuantization
+	};
+
+	/*
+		Push constants of morph.vert, drawMorph draws all instances of a primitive with one draw
+	*/
+	struct MorphDrawPushConst {
+		MorphPushConst morph;
+		uint32_t instanceWeightStride; // floats between the weight blocks of consecutive instances (see ModelInstance::updateAll)
+		uint32_t node; // world matrix of the drawn node in Model::nodeTransformData
+	};
+
+	/*
+		Push constants of morph.comp, the compute pass blending the morph vertices once per frame
+	*/
+	struct MorphComputePushConst {
+		MorphPushConst morph;
+		uint32_t baseVertex; // first vertex of the mesh in verticesMorph
+		uint32_t vertexCount;
+		uint32_t blendedVertex; // first vertex of the node's output in verticesBlended
+	};
+
+	/*
+		Quantized morph deltas (Model::quantizeMorphDeltas)
+
+		Every slot gets a range, the largest magnitude per component of its deltas, stored as one vec4 per slot
+		right before MorphPushConst::bufferOffset. Deltas are stored as snorm of delta / range, the range is
+		symmetric so vertices a target does not move stay exactly in place.
+		Dense layout, per vertex: position slots as 3 x snorm16 (2 words), normal and tangent slots as 3 x snorm8
+		(1 word), padded to an even word count. List entries are 2 words, the slot in the low 16 bits followed by
+		3 x snorm16. Decoded the same way by morph.vert and morph.comp (unpackSnorm2x16, unpackSnorm4x8)
+	*/
+	struct MorphQuantization {
+		static glm::vec3 toUnit(const glm::vec3 &delta, const glm::vec3 &range)
+		{
+			return glm::vec3(range.x > 0.0f ? delta.x / range.x : 0.0f, range.y > 0.0f ? delta.y / range.y : 0.0f, range.z > 0.0f ? delta.z / range.z : 0.0f);
+		}
+
+		static uint32_t vertexWords(const MorphPushConst &push)
+		{
+			return (push.normalOffset * 2 + (push.vertexStride - push.normalOffset) + 1) & ~1u;
+		}
+
+		// Word of a slot within the dense block of a vertex
+		static uint32_t slotWord(const MorphPushConst &push, uint32_t slot)
+		{
+			return (slot < push.normalOffset) ? slot * 2 : push.normalOffset + slot;
+		}
+
+		static void encodePosition(const glm::vec3 &unit, uint32_t *words)
+		{
+			words[0] = glm::packSnorm2x16(glm::vec2(unit.x, unit.y));
+			words[1] = glm::packSnorm2x16(glm::vec2(unit.z, 0.0f));
+		}
+
+		static glm::vec3 decodePosition(const uint32_t *words)
+		{
+			glm::vec2 xy = glm::unpackSnorm2x16(words[0]);
+			return glm::vec3(xy.x, xy.y, glm::unpackSnorm2x16(words[1]).x);
+		}
+
+		static uint32_t encodeDirection(const glm::vec3 &unit)
+		{
+			return glm::packSnorm4x8(glm::vec4(unit, 0.0f));
+		}
+
+		static glm::vec3 decodeDirection(uint32_t word)
+		{
+			return glm::vec3(glm::unpackSnorm4x8(word));
+		}
+
+		static void encodeListEntry(uint32_t slot, const glm::vec3 &unit, uint32_t *words)
+		{
+			words[0] = (slot & 0xffffu) | (glm::packSnorm2x16(glm::vec2(0.0f, unit.x)) & 0xffff0000u);
+			words[1] = glm::packSnorm2x16(glm::vec2(unit.y, unit.z));
+		}
+
+		static glm::vec3 decodeListEntry(const uint32_t *words, uint32_t &slot)
+		{
+			slot = words[0] & 0xffffu;
+			glm::vec2 yz = glm::unpackSnorm2x16(words[1]);
+			return glm::vec3(glm::unpackSnorm2x16(words[0]).y, yz.x, yz.y);
+		}
 	};
 
 	/*
 		glTF Mesh class
+		One per node drawing a glTF mesh, nodes using the same glTF mesh share its packed vertex, index and morph data
+		and only have their own transform, weight animation and weight block
 	*/
 	struct Mesh {
-		enum MorphInterpolation {LINEAR, STEP, CUBICSPLINE};
 		bool isMorphTarget;
 		size_t  sampler;
 		size_t  input;
 		size_t  output;
-		MorphInterpolation interpolation;
+		AnimationTrack::Interpolation interpolation;
 		std::vector<float> weightsInit;
 		std::vector<float> weightsTime;
 		std::vector<float> weightsData;
+		float weightsRate = 0.0f; // keys per second of weightsTime once the animation is baked (Model::bakeAnimations), 0 otherwise
+		// 16 bit weightsData once the animation is compressed (Model::compressAnimations), weightsData is empty then
+		// See AnimationTrack::quantizedValues, weightsOffset and weightsScale hold the range of every value of a key
+		std::vector<uint16_t> weightsQuantized;
+		std::vector<float> weightsOffset;
+		std::vector<float> weightsScale;
+		// Weight animation read from its file while playing (Model::streamAnimationKeys), weightsTime and weightsData are empty then
+		// weightsSource.path is relative to the glTF file (empty for the glTF file itself), so the model cache can open it again
+		AnimationStream::Source weightsSource;
+		std::shared_ptr<AnimationStream> weightsStream;
+		std::vector<float> weights; // current weight of every target
+		std::vector<uint32_t> slotTargets; // target of every packed delta slot in morphVertexData
 		uint32_t morphVertexOffset;
+		uint32_t vertexCount = 0;
+		uint32_t node = 0; // in Model::nodes and Model::nodeTransformData
+		uint32_t blendedVertex = 0; // first vertex of the node's range in Model::verticesBlended
 		MorphPushConst morphPushConst;
+		// Loss of the quantized deltas (only set if morphPushConst.quantized), reported at load time
+		struct QuantizationError {
+			float positionMax = 0.0f;
+			float positionRms = 0.0f;
+			float directionMax = 0.0f; // normals and tangents
+			float directionRms = 0.0f;
+		} quantizationError;
 
 		std::vector<Primitive> primitives;
 
-		// for keeping state of mesh's animation
+		// Cursor of the model's own playback into weightsTime (AnimationSampler::advance)
 		uint32_t currentIndex = 0;
+
+		size_t weightKeyCount() const
+		{
+			return weightsStream ? weightsStream->keyCount() : weightsTime.size();
+		}
+
+		// Weight animation as a track for AnimationSampler, empty for streamed animations (see weightsStream)
+		AnimationTrack weightTrack() const
+		{
+			AnimationTrack track;
+			track.times = weightsTime.data();
+			track.values = weightsData.data();
+			track.keyCount = static_cast<uint32_t>(weightsTime.size());
+			track.components = static_cast<uint32_t>(weightsInit.size());
+			track.interpolation = interpolation;
+			track.keyRate = weightsRate;
+			if (!weightsQuantized.empty()) {
+				track.values = nullptr;
+				track.quantizedValues = weightsQuantized.data();
+				track.valueOffset = weightsOffset.data();
+				track.valueScale = weightsScale.data();
+			}
+			return track;
+		}
 	};
 
 	/*
@@ -369,52 +475,396 @@ namespace vkglTF
 		};
 
 		struct Vertices {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			vks::Allocation memory;
 		};
 
 		struct Indices {
-			uint32_t count;
-			VkBuffer buffer;
-			VkDeviceMemory memory;
+			uint32_t count = 0;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			vks::Allocation memory;
+		};
+
+		/*
+			Node of the default scene, in depth first order so every parent comes before its children
+			matrix is in the space of the packed vertices (load scale applied to the translation, Vulkan y axis)
+		*/
+		struct Node {
+			int32_t parent; // -1 for the scene roots
+			glm::mat4 matrix; // local transform, change it and call updateNodeTransforms() to move the node
 		};
 
 		Vertices verticesMorph;
 		Indices indicesMorph;
+		// Output of the compute blending (dispatchMorph), one range per morph mesh node at Mesh::blendedVertex
+		Vertices verticesBlended;
+		VkDeviceSize verticesMorphSize = 0;
 		Vertices verticesNormal;
 		Indices indicesNormal;
+		// Storage buffer with the packed morph deltas (the layout of morphVertexData), read by morph.vert and morph.comp
+		Vertices morphTargets;
 
 		std::vector<Mesh> meshesMorph;
 		std::vector<Mesh> meshesNormal;
 		std::vector<Texture> textures;
 		std::vector<Material> materials;
-
-		// In order [POS_0, POS_1... NORMAL_0, NORMAL_1... TANGENT_0, TANGENT_1..]
-		std::vector<float> morphVertexData; // TODO clear after device transfer
+		// Used by primitives without a material or while materials are not loaded
+		Material defaultMaterial{};
+		std::vector<Node> nodes;
+		// World matrix of every node, rewritten by updateNodeTransforms(), each draw reads the one at Mesh::node
+		std::vector<glm::mat4> nodeTransformData;
+
+		// In order [POS_0, POS_1... NORMAL_0, NORMAL_1... TANGENT_0, TANGENT_1..], every delta padded to a vec4 so the shaders fetch it with one 16 byte load
+		// Meshes with mostly zero deltas (e.g. sparse accessors) use per vertex delta lists instead (MorphPushConst::sparse):
+		// vertexCount + 1 uint offsets (relative to bufferOffset, padded to a multiple of 4) followed by the [slot, x, y, z] entries of each vertex, slot stored as uint bits
+		// Only filled if keepHostData is set or the model is loaded without a device, the loader writes it straight to staging
+		// memory otherwise and the GPU copy in morphTargets is the only one
+		std::vector<float> morphVertexData;
+		// Weights of all morph meshes, rewritten by updateMorphWeights() and uploaded every frame
+		// Per mesh at weightOffset: [normalStart, tangentStart, activeCount, 0] header followed by
+		// activeCount [slot, weight] pairs of the non zero weighted slots (dense layout) or one weight per slot (sparse layout)
+		// Sparse blocks only fill activeCount, the shaders skip the list entries of zero weighted slots instead of walking an active list
+		std::vector<float> morphWeightData;
+		// Base vertices of the morph meshes, kept on the host for CPU morph evaluation (see MorphEvaluator.hpp)
+		// Only filled if keepHostData is set or the model is loaded without a device
+		std::vector<Vertex> morphBaseVertices;
+		bool keepHostData = false;
+		// Store the morph deltas as 16 bit (positions) and 8 bit (normals, tangents) snorm, see MorphQuantization
+		bool quantizeMorphDeltas = false;
+		// Threads packing the primitives of a scene in packScene (and measuring them in sizeScene), 0 uses all hardware threads
+		// The packed data is the same for any thread count
+		uint32_t loadThreads = 1;
+		// Binary cache of the packed model (see ModelCache.hpp), loadFromFile uses it instead of the glTF file while it is
+		// up to date with the source files and rewrites it otherwise. Empty disables caching
+		std::string cacheFile;
+		// Read the GLB BIN chunk and external .bin files in place from a memory mapping instead of copying them into
+		// the tinygltf buffers, loadFromFile falls back to copying where files can not be mapped (Android assets)
+		bool mapBufferData = true;
+		// Per glTF buffer, points into the mapped files while loadFromFile packs a scene read in place (null: use Buffer::data)
+		std::vector<const unsigned char*> mappedBuffers;
+		// Per glTF buffer, the file mappedBuffers points into and the offset of the buffer in it, for streamed animations
+		// uri is relative to the glTF file and empty for the GLB BIN chunk
+		struct BufferFile {
+			std::string uri;
+			std::string path;
+			uint64_t offset;
+		};
+		std::vector<BufferFile> mappedBufferFiles;
+		// Weight animations with more keys than this are not copied at load but streamed from their file in chunks while
+		// playing (see AnimationStream). Only for float keys in mapped buffer files (mapBufferData), 0 copies every animation
+		uint32_t streamAnimationKeys = 0;
+		// Resample the weight animations at load to at least this many keys per second with linear interpolation, so a
+		// sample is a direct index and one blend (see AnimationBake). 0 keeps the keys of the glTF file
+		float bakeAnimationRate = 0.0f;
+		// Largest difference to the glTF curve a baked track may have, tracks needing more than 16 times the rate keep their keys
+		float bakeAnimationMaxError = 1.0e-3f;
+		// Drop the weight animation keys interpolation reproduces within this tolerance and store the values as 16 bit
+		// (see AnimationCompression), after baking. 0 keeps float keys
+		float compressAnimationTolerance = 0.0f;
 		float animationMaxTime = 0.0f;
-		float currentTime = 0.0f;
-
-		void destroy(VkDevice device)
-		{
-			vkDestroyBuffer(device, verticesMorph.buffer, nullptr);
-			vkFreeMemory(device, verticesMorph.memory, nullptr);
-			vkDestroyBuffer(device, indicesMorph.buffer, nullptr);
-			vkFreeMemory(device, indicesMorph.memory, nullptr);
-			vkDestroyBuffer(device, verticesNormal.buffer, nullptr);
-			vkFreeMemory(device, verticesNormal.memory, nullptr);
-			vkDestroyBuffer(device, indicesNormal.buffer, nullptr);
-			vkFreeMemory(device, indicesNormal.memory, nullptr);
+		// Time of the model's own playback (updateAnimation), its duration is animationMaxTime
+		AnimationPlayback playback;
+		// Batch of device->uploadManager holding the buffer copies of the last load. Work submitted to the load queue afterwards
+		// is ordered after them, host side users (e.g. before destroying the model) check or wait for it on the upload manager
+		vks::UploadManager::Ticket uploadTicket = 0;
+
+		void destroy(vks::VulkanDevice *device)
+		{
+			device->uploadManager.wait(uploadTicket);
+			device->destroyBuffer(verticesMorph.buffer, verticesMorph.memory);
+			device->destroyBuffer(verticesBlended.buffer, verticesBlended.memory);
+			device->destroyBuffer(indicesMorph.buffer, indicesMorph.memory);
+			device->destroyBuffer(verticesNormal.buffer, verticesNormal.memory);
+			device->destroyBuffer(indicesNormal.buffer, indicesNormal.memory);
+			device->destroyBuffer(morphTargets.buffer, morphTargets.memory);
 			for (auto texture : textures) {
 				texture.destroy();
 			}
 		};
 
-		void loadNode(const tinygltf::Node &node, size_t nodeIndex, const glm::mat4 &parentMatrix, const tinygltf::Model &model,
-					  std::vector<Vertex>& vertexBufferMorph, std::vector<uint32_t>& indexBufferMorph,
-					  std::vector<Vertex>& vertexBufferNormal, std::vector<uint32_t >& indexBufferNormal,
-					  float globalscale)
+		// Start of an accessor's data in a buffer view, in place in a mapped file (see mappedBuffers) or in the loaded buffer
+		const unsigned char* bufferViewData(const tinygltf::Model &model, const tinygltf::BufferView &view, size_t byteOffset) const
+		{
+			const size_t buffer = static_cast<size_t>(view.buffer);
+			const unsigned char *data = (buffer < mappedBuffers.size() && mappedBuffers[buffer]) ? mappedBuffers[buffer] : model.buffers[buffer].data.data();
+			return data + view.byteOffset + byteOffset;
+		}
+
+		/*
+			Deltas of one morph target attribute
+			Sparse accessors without a base buffer view stay as index/value lists, everything else ends up dense
+		*/
+		struct MorphTargetSource {
+			const float *dense = nullptr;
+			std::vector<float> densified;
+			std::vector<uint32_t> sparseIndices;
+			const float *sparseValues = nullptr;
+		};
+
+		// Element indices and start of the values of a sparse accessor
+		const unsigned char* readSparse(const tinygltf::Model &model, const tinygltf::Accessor &accessor, std::vector<uint32_t> &indices) const
+		{
+			const tinygltf::BufferView &indexView = model.bufferViews[accessor.sparse.indices.bufferView];
+			const unsigned char *indexData = bufferViewData(model, indexView, accessor.sparse.indices.byteOffset);
+			indices.resize(accessor.sparse.count);
+			for (size_t i = 0; i < indices.size(); i++) {
+				switch (accessor.sparse.indices.componentType) {
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+					indices[i] = reinterpret_cast<const uint32_t*>(indexData)[i];
+					break;
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+					indices[i] = reinterpret_cast<const uint16_t*>(indexData)[i];
+					break;
+				default:
+					indices[i] = indexData[i];
+					break;
+				}
+			}
+			const tinygltf::BufferView &valueView = model.bufferViews[accessor.sparse.values.bufferView];
+			return bufferViewData(model, valueView, accessor.sparse.values.byteOffset);
+		}
+
+		/*
+			Tightly packed elements of an accessor, in place if it is a plain buffer view
+			Accessors without a buffer view are zeros (glTF 2.0, 3.6.2.3) and sparse values are patched over them or over
+			a copy of the buffer view, both end up in storage. Null for unknown component types
+		*/
+		const unsigned char* readAccessor(const tinygltf::Model &model, const tinygltf::Accessor &accessor, std::vector<unsigned char> &storage) const
+		{
+			const int32_t componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+			const int32_t components = tinygltf::GetTypeSizeInBytes(static_cast<uint32_t>(accessor.type));
+			if (componentSize <= 0 || components <= 0) {
+				return nullptr;
+			}
+			const unsigned char *data = nullptr;
+			if (accessor.bufferView >= 0) {
+				data = bufferViewData(model, model.bufferViews[accessor.bufferView], accessor.byteOffset);
+				if (!accessor.sparse.isSparse) {
+					return data;
+				}
+			}
+
+			const size_t elementSize = static_cast<size_t>(componentSize) * static_cast<size_t>(components);
+			if (data) {
+				storage.assign(data, data + accessor.count * elementSize);
+			} else {
+				storage.assign(accessor.count * elementSize, 0);
+			}
+			if (accessor.sparse.isSparse) {
+				std::vector<uint32_t> indices;
+				const unsigned char *values = readSparse(model, accessor, indices);
+				for (size_t i = 0; i < indices.size(); i++) {
+					if (indices[i] < accessor.count) {
+						memcpy(&storage[indices[i] * elementSize], &values[i * elementSize], elementSize);
+					}
+				}
+			}
+			return storage.data();
+		}
+
+		void readMorphTarget(const tinygltf::Model &model, const tinygltf::Accessor &accessor, MorphTargetSource &source) const
+		{
+			if (accessor.bufferView >= 0) {
+				const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+				source.dense = reinterpret_cast<const float*>(bufferViewData(model, view, accessor.byteOffset));
+			}
+			if (!accessor.sparse.isSparse) {
+				return;
+			}
+
+			source.sparseValues = reinterpret_cast<const float*>(readSparse(model, accessor, source.sparseIndices));
+
+			if (source.dense) {
+				// Values patched into a base buffer view, nothing left to gain from keeping it sparse
+				densifyMorphTarget(source, static_cast<uint32_t>(accessor.count));
+			}
+		}
+
+		static void densifyMorphTarget(MorphTargetSource &source, uint32_t vertexCount)
+		{
+			if (source.dense) {
+				source.densified.assign(source.dense, source.dense + vertexCount * 3);
+			} else {
+				source.densified.assign(vertexCount * 3, 0.0f);
+			}
+			for (size_t i = 0; i < source.sparseIndices.size(); i++) {
+				if (source.sparseIndices[i] < vertexCount) {
+					memcpy(&source.densified[source.sparseIndices[i] * 3], &source.sparseValues[i * 3], sizeof(float) * 3);
+				}
+			}
+			source.dense = source.densified.data();
+			source.sparseIndices.clear();
+			source.sparseValues = nullptr;
+		}
+
+		static bool isZeroDelta(const float *delta)
+		{
+			return delta[0] == 0.0f && delta[1] == 0.0f && delta[2] == 0.0f;
+		}
+
+		/*
+			Calls fn(vertex, delta) for every vertex of a target that has a delta, zero deltas of dense accessors are skipped
+		*/
+		template <typename Fn>
+		static void forEachMorphDelta(const MorphTargetSource &source, uint32_t vertexCount, Fn fn)
+		{
+			if (source.dense) {
+				for (uint32_t v = 0; v < vertexCount; v++) {
+					if (!isZeroDelta(&source.dense[v * 3])) {
+						fn(v, &source.dense[v * 3]);
+					}
+				}
+			} else {
+				for (size_t i = 0; i < source.sparseIndices.size(); i++) {
+					if (source.sparseIndices[i] < vertexCount) {
+						fn(source.sparseIndices[i], &source.sparseValues[i * 3]);
+					}
+				}
+			}
+		}
+
+		static size_t alignedSize(size_t size, size_t alignment)
+		{
+			return (size + alignment - 1) / alignment * alignment;
+		}
+
+		/*
+			One primitive of the scene, planned in scene order by loadNode, measured by measureMorphData and packed by packPrimitive
+			The output ranges of every primitive are fixed before packing and packPrimitive only writes to its own ranges,
+			so primitives can be packed on any thread and in any order with the same result
+		*/
+		struct PrimitiveJob {
+			const tinygltf::Primitive *primitive;
+			const std::string *meshName;
+			bool isMorphTarget;
+			size_t meshIndex; // in meshesMorph or meshesNormal
+			size_t primitiveIndex; // in Mesh::primitives
+			uint32_t vertexCount;
+			uint32_t vertexStart;
+			uint32_t indexCount; // indices written, 0 if the index type is not supported
+			uint32_t firstIndex;
+			// Slot layout and weightOffset from loadNode, measureMorphData adds sparse and bufferOffset (relative to morphBlockStart)
+			MorphPushConst morphPushConst;
+			// Set by measureMorphData, used and released by packPrimitive
+			std::vector<MorphTargetSource> morphSources;
+			std::vector<glm::vec3> slotRanges;
+			std::vector<uint32_t> listOffsets;
+			size_t deltaCount;
+			// Range table and deltas of the primitive in morphVertexData, placed vec4 aligned in scene order
+			size_t morphDataSize;
+			size_t morphBlockStart;
+			Mesh::QuantizationError quantizationError;
+			std::string quantizationReport;
+		};
+
+		/*
+			Mesh of a node using a glTF mesh already planned for an earlier node, packScene gives it the packed ranges of source
+		*/
+		struct SharedMesh {
+			bool isMorphTarget;
+			size_t meshIndex; // in meshesMorph or meshesNormal
+			size_t sourceIndex; // same list, the mesh whose primitives were planned
+		};
+
+		// Everything loadNode plans for sizeScene and packScene
+		struct ScenePlan {
+			std::vector<PrimitiveJob> jobs;
+			std::vector<int64_t> meshEntries; // per glTF mesh, the mesh its primitives were planned for, -1 while unused
+			std::vector<SharedMesh> sharedMeshes;
+		};
+
+		/*
+			One output of a load, sized first (by sizeScene or from a cache section) and then written in place
+			data is a range of mapped staging memory (staged) or host memory, see preparePackedScene
+		*/
+		struct PackedBuffer {
+			void *data = nullptr;
+			size_t size = 0; // in bytes
+			bool staged = false;
+			vks::UploadManager::StagingRange staging;
+		};
+
+		struct PackedScene {
+			PackedBuffer verticesMorph;
+			PackedBuffer indicesMorph;
+			PackedBuffer verticesNormal;
+			PackedBuffer indicesNormal;
+			PackedBuffer morphData; // layout of morphVertexData
+			// Host memory of the outputs of a load without a device that the model does not keep
+			std::vector<Vertex> hostVerticesNormal;
+			std::vector<uint32_t> hostIndicesMorph;
+			std::vector<uint32_t> hostIndicesNormal;
+		};
+
+		// glTF node matrix in the space of the packed vertices, the same as transforming a vertex before the load scale and y flip
+		static glm::mat4 vulkanNodeMatrix(const glm::mat4 &matrix, float globalscale)
+		{
+			glm::mat4 scaled = matrix;
+			scaled[3] = glm::vec4(glm::vec3(matrix[3]) * globalscale, matrix[3].w);
+			const glm::mat4 flip = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f));
+			return flip * scaled * flip;
+		}
+
+		/*
+			Stream the weight animation of mesh from its file if it has more than streamAnimationKeys keys, stored as
+			tightly packed floats in one mapped buffer file. Returns false if the animation has to be copied
+		*/
+		bool streamWeights(const tinygltf::Model &model, const tinygltf::Accessor &input, const tinygltf::Accessor &output, Mesh &mesh)
+		{
+			// Sparse accessors and accessors without a buffer view have no keys in the file to stream
+			if (streamAnimationKeys == 0 || input.count <= streamAnimationKeys || input.bufferView < 0 || output.bufferView < 0 ||
+				input.sparse.isSparse || output.sparse.isSparse) {
+				return false;
+			}
+			const tinygltf::BufferView &inputView = model.bufferViews[input.bufferView];
+			const tinygltf::BufferView &outputView = model.bufferViews[output.bufferView];
+			if (inputView.buffer != outputView.buffer || inputView.buffer < 0 || static_cast<size_t>(inputView.buffer) >= mappedBufferFiles.size()) {
+				return false;
+			}
+			auto packedFloats = [](const tinygltf::Accessor &accessor, const tinygltf::BufferView &view) {
+				return accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && accessor.type == TINYGLTF_TYPE_SCALAR &&
+					(view.byteStride == 0 || view.byteStride == sizeof(float));
+			};
+			const BufferFile &file = mappedBufferFiles[static_cast<size_t>(inputView.buffer)];
+			AnimationStream::Source &source = mesh.weightsSource;
+			source.path = file.uri;
+			source.timesOffset = file.offset + inputView.byteOffset + input.byteOffset;
+			source.valuesOffset = file.offset + outputView.byteOffset + output.byteOffset;
+			source.keyCount = static_cast<uint32_t>(input.count);
+			source.components = static_cast<uint32_t>(mesh.weightsInit.size());
+			source.interpolation = mesh.interpolation;
+			const size_t valuesPerKey = (mesh.interpolation == AnimationTrack::CUBICSPLINE) ? source.components * 3 : source.components;
+			if (!packedFloats(input, inputView) || !packedFloats(output, outputView) || output.count != input.count * valuesPerKey ||
+				!openWeightsStream(mesh, file.path)) {
+				mesh.weightsSource = AnimationStream::Source();
+				return false;
+			}
+			return true;
+		}
+
+		// Start streaming mesh.weightsSource from path and report the memory it saves
+		static bool openWeightsStream(Mesh &mesh, const std::string &path)
 		{
+			AnimationStream::Source source = mesh.weightsSource;
+			source.path = path;
+			std::shared_ptr<AnimationStream> stream(new AnimationStream());
+			if (!stream->open(source)) {
+				std::cerr << "Could not stream the weight animation of node " << mesh.node << " from " << path << std::endl;
+				return false;
+			}
+			mesh.weightsStream = stream;
+			std::cerr << "Streaming weight animation of node " << mesh.node << ": " << source.keyCount << " keys (" << stream->trackBytes()
+				<< " bytes), at most " << stream->residentBytes() << " bytes in memory" << std::endl;
+			return true;
+		}
 
+		/*
+			Adds the node to nodes and builds its mesh and animation data, the primitives of a glTF mesh are only planned
+			in plan.jobs for the first node using it (the vertex, index and morph data is packed afterwards by packPrimitive,
+			see packScene), later nodes share them
+		*/
+		void loadNode(const tinygltf::Node &node, size_t nodeIndex, int32_t parent, const tinygltf::Model &model, float globalscale, ScenePlan &plan)
+		{
 			// Generate local node matrix
 			glm::vec3 translation = glm::vec3(0.0f);
 			if (node.translation.size() == 3) {
@@ -430,24 +880,19 @@ namespace vkglTF
 				scale = glm::make_vec3(node.scale.data());
 			}
 			glm::mat4 localNodeTRSMatrix;
-			glm::mat4 localNodeRSMatrix; // need only rotate/scale for morph changes
 			if (node.matrix.size() == 16) {
 				localNodeTRSMatrix = glm::make_mat4x4(node.matrix.data());
-				localNodeRSMatrix = glm::make_mat4x4(node.matrix.data());
 			} else {
 				// T * R * S
 				localNodeTRSMatrix = glm::translate(glm::mat4(1.0f), translation) * rotation * glm::scale(glm::mat4(1.0f), scale);
-				localNodeRSMatrix = glm::mat4(1.0f) * rotation * glm::scale(glm::mat4(1.0f), scale);
 			}
-			localNodeTRSMatrix = parentMatrix * localNodeTRSMatrix;
-			// TODO send in RS Matrix from Parent
+			// Applied at draw time from nodeTransformData, the vertices stay in mesh space
+			const uint32_t nodeSlot = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(Node{ parent, vulkanNodeMatrix(localNodeTRSMatrix, globalscale) });
 
 			// Parent node with children
-			// TODO support children testing
-			if (node.children.size() > 0) {
-				for (auto i = 0; i < node.children.size(); i++) {
-					loadNode(model.nodes[node.children[i]], node.children[i], localNodeTRSMatrix, model, vertexBufferMorph, indexBufferMorph, vertexBufferNormal, indexBufferNormal, globalscale);
-				}
+			for (size_t i = 0; i < node.children.size(); i++) {
+				loadNode(model.nodes[node.children[i]], node.children[i], static_cast<int32_t>(nodeSlot), model, globalscale, plan);
 			}
 
 			if (node.mesh < 0) {
@@ -455,7 +900,7 @@ namespace vkglTF
 			}
 
 			// Node contains mesh data
-			const tinygltf::Mesh mesh = model.meshes[node.mesh];
+			const tinygltf::Mesh &mesh = model.meshes[node.mesh];
 
 			// determine if the mesh is morph or not
 			if (mesh.weights.empty()) {
@@ -465,6 +910,8 @@ namespace vkglTF
 			}
 			Mesh &pMesh = (mesh.weights.empty()) ? meshesNormal.back() : meshesMorph.back();
 			pMesh.isMorphTarget = mesh.weights.empty() ? false : true;
+			pMesh.node = nodeSlot;
+			const size_t meshIndex = (mesh.weights.empty()) ? meshesNormal.size() - 1 : meshesMorph.size() - 1;
 
 			if (pMesh.isMorphTarget) {
 				// find glTF sampler to node's mesh
@@ -476,11 +923,11 @@ namespace vkglTF
 							pMesh.input = animation.samplers[pMesh.sampler].input;
 							pMesh.output = animation.samplers[pMesh.sampler].output;
 							if (animation.samplers[pMesh.sampler].interpolation == "STEP") {
-								pMesh.interpolation = Mesh::STEP;
+								pMesh.interpolation = AnimationTrack::STEP;
 							} else if (animation.samplers[pMesh.sampler].interpolation == "CUBICSPLINE") {
-								pMesh.interpolation = Mesh::CUBICSPLINE;
+								pMesh.interpolation = AnimationTrack::CUBICSPLINE;
 							} else { // LINEAR as default from glTF spec
-								pMesh.interpolation = Mesh::LINEAR;
+								pMesh.interpolation = AnimationTrack::LINEAR;
 							}
 
 							foundSampler = true;
@@ -491,33 +938,39 @@ namespace vkglTF
 				}
 
 				// set init weights of mesh
-				for (size_t i = 0; i < mesh.weights.size() && i < MAX_WEIGHTS; i++) {
+				for (size_t i = 0; i < mesh.weights.size(); i++) {
 					pMesh.weightsInit.push_back(static_cast<float>(mesh.weights[i]));
 				}
+				pMesh.weights = pMesh.weightsInit;
 
 				// get weight input (times)
 				const tinygltf::Accessor &inputAccessor = model.accessors[pMesh.input];
-				const tinygltf::BufferView &inputView = model.bufferViews[inputAccessor.bufferView];
-				const float* weightTimeBuffer = reinterpret_cast<const float *>(&(model.buffers[inputView.buffer].data[inputAccessor.byteOffset + inputView.byteOffset]));
-				pMesh.weightsTime.resize(inputAccessor.count);
+				const tinygltf::Accessor &outputAccessor = model.accessors[pMesh.output];
 
-				// We need to copy morph weight data for CPU to calculate during looping
-				// Also trying to avoid C memcpy for safty and true C++ container use
-				for (size_t i = 0; i < pMesh.weightsTime.size(); i++) {
-					pMesh.weightsTime[i] = weightTimeBuffer[i];
-				}
+				// Long takes stay in their file and are read around the playhead instead
+				if (streamWeights(model, inputAccessor, outputAccessor, pMesh)) {
+					animationMaxTime = std::max(animationMaxTime, pMesh.weightsStream->duration());
+				} else {
+					std::vector<unsigned char> timeStorage, dataStorage;
+					const float* weightTimeBuffer = reinterpret_cast<const float *>(readAccessor(model, inputAccessor, timeStorage));
+					pMesh.weightsTime.resize(inputAccessor.count);
+
+					// We need to copy morph weight data for CPU to calculate during looping
+					// Also trying to avoid C memcpy for safty and true C++ container use
+					for (size_t i = 0; i < pMesh.weightsTime.size(); i++) {
+						pMesh.weightsTime[i] = weightTimeBuffer[i];
+					}
 
-				// looking for animation time in whole model
-				animationMaxTime = std::max(animationMaxTime, pMesh.weightsTime.back());
+					// looking for animation time in whole model
+					animationMaxTime = std::max(animationMaxTime, pMesh.weightsTime.back());
 
-				// now the output (weight data)
-				const tinygltf::Accessor &outputAccessor = model.accessors[pMesh.output];
-				const tinygltf::BufferView &outputView = model.bufferViews[outputAccessor.bufferView];
-				const float* weightDataBuffer = reinterpret_cast<const float *>(&(model.buffers[outputView.buffer].data[outputAccessor.byteOffset + outputView.byteOffset]));
-				pMesh.weightsData.resize(outputAccessor.count);
+					// now the output (weight data)
+					const float* weightDataBuffer = reinterpret_cast<const float *>(readAccessor(model, outputAccessor, dataStorage));
+					pMesh.weightsData.resize(outputAccessor.count);
 
-				for (size_t i = 0; i < pMesh.weightsData.size(); i++) {
-					pMesh.weightsData[i] = weightDataBuffer[i];
+					for (size_t i = 0; i < pMesh.weightsData.size(); i++) {
+						pMesh.weightsData[i] = weightDataBuffer[i];
+					}
 				}
 
 			} else {
@@ -528,187 +981,374 @@ namespace vkglTF
 				pMesh.morphPushConst.normalOffset = 0;
 				pMesh.morphPushConst.tangentOffset = 0;
 				pMesh.morphPushConst.vertexStride = 0;
+				pMesh.morphPushConst.quantized = 0;
 			}
 
+			int64_t &meshEntry = plan.meshEntries[node.mesh];
+			if (meshEntry >= 0) {
+				// Only the node's own weight block, the rest is taken from the first node's mesh once it is placed
+				if (pMesh.isMorphTarget) {
+					const size_t slotCount = meshesMorph[static_cast<size_t>(meshEntry)].slotTargets.size();
+					pMesh.morphPushConst.weightOffset = static_cast<uint32_t>(morphWeightData.size());
+					morphWeightData.resize(morphWeightData.size() + 4 + slotCount * 2, 0.0f);
+				}
+				plan.sharedMeshes.push_back(SharedMesh{ pMesh.isMorphTarget, meshIndex, static_cast<size_t>(meshEntry) });
+				return;
+			}
+			meshEntry = static_cast<int64_t>(meshIndex);
+
 			for (auto& primitive : mesh.primitives) {
 
 				if (primitive.indices < 0) {
 					continue;
 				}
 
+				// firstIndex is set once the index ranges of all primitives are known
 				pMesh.primitives.push_back(vkglTF::Primitive{
-					.firstIndex = (pMesh.isMorphTarget) ? static_cast<uint32_t>(indexBufferMorph.size()) : static_cast<uint32_t>(indexBufferNormal.size()),
+					.firstIndex = 0,
 					.indexCount = 0,
-					.material = materials[primitive.material],
+					.materialIndex = primitive.material,
+					.material = primitiveMaterial(primitive.material),
 				});
 				Primitive &pPrimitive = pMesh.primitives.back();
 
-				uint32_t vertexStart = (pMesh.isMorphTarget) ? static_cast<uint32_t>(vertexBufferMorph.size()) : static_cast<uint32_t>(vertexBufferNormal.size());
-				pMesh.morphVertexOffset = vertexStart * sizeof(Vertex);
-
-				// Vertices
-				{
-					const float *bufferPos = nullptr;
-					const float *bufferNormals = nullptr;
-					const float *bufferTexCoords = nullptr;
+				PrimitiveJob job{};
+				job.primitive = &primitive;
+				job.meshName = &mesh.name;
+				job.isMorphTarget = pMesh.isMorphTarget;
+				job.meshIndex = meshIndex;
+				job.primitiveIndex = pMesh.primitives.size() - 1;
+
+				// Position attribute is required
+				assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
+				job.vertexCount = static_cast<uint32_t>(model.accessors[primitive.attributes.find("POSITION")->second].count);
+				pMesh.vertexCount = job.vertexCount;
+
+				if (pMesh.isMorphTarget) {
+					// Slots in order [POS_0, POS_1... NORMAL_0, NORMAL_1... TANGENT_0, TANGENT_1..]
+					MorphPushConst &push = job.morphPushConst;
+					pMesh.slotTargets.clear();
+					const char *attributes[3] = { "POSITION", "NORMAL", "TANGENT" };
+					for (uint32_t a = 0; a < 3; a++) {
+						if (a == 1) {
+							push.normalOffset = static_cast<uint32_t>(pMesh.slotTargets.size());
+						} else if (a == 2) {
+							push.tangentOffset = static_cast<uint32_t>(pMesh.slotTargets.size());
+						}
+						for (size_t t = 0; t < primitive.targets.size(); t++) {
+							if (primitive.targets[t].find(attributes[a]) != primitive.targets[t].end()) {
+								pMesh.slotTargets.push_back(static_cast<uint32_t>(t));
+							}
+						}
+					}
+					const uint32_t slotCount = static_cast<uint32_t>(pMesh.slotTargets.size());
+					push.vertexStride = slotCount;
+					// Quantized list entries only have 16 bits for the slot
+					push.quantized = (quantizeMorphDeltas && slotCount <= 0xffff) ? 1 : 0;
+					// Room for the header and every slot active
+					push.weightOffset = static_cast<uint32_t>(morphWeightData.size());
+					morphWeightData.resize(morphWeightData.size() + 4 + slotCount * 2, 0.0f);
+				}
 
-					// Position attribute is required
-					assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
+				const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
+				pPrimitive.indexCount = static_cast<uint32_t>(indexAccessor.count);
+				switch (indexAccessor.componentType) {
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
+					job.indexCount = pPrimitive.indexCount;
+					plan.jobs.push_back(std::move(job));
+					break;
+				default:
+					// The vertices are still packed, the remaining primitives of the mesh are skipped
+					// No indices are written for this primitive, so it draws nothing
+					std::cerr << "Index component type " << indexAccessor.componentType << " not supported!" << std::endl;
+					pPrimitive.indexCount = 0;
+					plan.jobs.push_back(std::move(job));
+					return;
+				}
+			}
+		}
 
-					const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-					const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-					bufferPos = reinterpret_cast<const float *>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
+		// Global scale and Vulkan coordinate system applied to a morph delta of a slot, the node transform is applied at draw time
+		static glm::vec3 transformMorphDelta(const PrimitiveJob &job, uint32_t slot, const float *delta, float globalscale)
+		{
+			glm::vec3 temp = glm::make_vec3(delta);
+			if (slot < job.morphPushConst.normalOffset) {
+				// only position get global scaled up
+				temp *= globalscale;
+			} else if (temp.x != 0 || temp.y != 0 ||  temp.z != 0) { // glm::normalize() causes "nan" TODO figure that out
+				// need to normalize normal/tangent vectors
+				temp = glm::normalize(temp);
+			}
+			temp.y *= -1.0f;
+			return temp;
+		}
 
-					if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-						const tinygltf::Accessor &normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-						const tinygltf::BufferView &normView = model.bufferViews[normAccessor.bufferView];
-						bufferNormals = reinterpret_cast<const float *>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
+		/*
+			First pass over the morph targets of a planned primitive: picks the dense or list layout and the quantization
+			ranges and sets job.morphDataSize, so sizeScene can place every primitive's block before any is written
+		*/
+		void measureMorphData(PrimitiveJob &job, const tinygltf::Model &model, float globalscale) const
+		{
+			const tinygltf::Primitive &primitive = *job.primitive;
+			const uint32_t vertexCount = job.vertexCount;
+			MorphPushConst &push = job.morphPushConst;
+			// loop for each type to pack data given for morphVertexData, same slot order as planned by loadNode
+			const char *attributes[3] = { "POSITION", "NORMAL", "TANGENT" };
+			for (uint32_t a = 0; a < 3; a++) {
+				for (size_t t = 0; t < primitive.targets.size(); t++) {
+					auto target = primitive.targets[t].find(attributes[a]);
+					if (target != primitive.targets[t].end()) {
+						job.morphSources.push_back(MorphTargetSource{});
+						readMorphTarget(model, model.accessors[target->second], job.morphSources.back());
 					}
+				}
+			}
 
-					if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-						const tinygltf::Accessor &uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-						const tinygltf::BufferView &uvView = model.bufferViews[uvAccessor.bufferView];
-						bufferTexCoords = reinterpret_cast<const float *>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-					}
+			const uint32_t slotCount = push.vertexStride;
+			const bool quantize = push.quantized != 0;
+			if (quantize) {
+				job.slotRanges.assign(slotCount, glm::vec3(0.0f));
+				for (uint32_t j = 0; j < slotCount; j++) {
+					forEachMorphDelta(job.morphSources[j], vertexCount, [&](uint32_t, const float *delta) {
+						glm::vec3 temp = transformMorphDelta(job, j, delta, globalscale);
+						job.slotRanges[j] = glm::max(job.slotRanges[j], glm::vec3(fabsf(temp.x), fabsf(temp.y), fabsf(temp.z)));
+					});
+				}
+			}
+			// The range table comes first, one vec4 per slot
+			push.bufferOffset = quantize ? slotCount * 4 : 0;
+
+			// Count the non zero deltas of each vertex to pick the smaller of the dense and the per vertex list layout
+			std::vector<uint32_t> &listOffsets = job.listOffsets;
+			listOffsets.assign(vertexCount + 1, 0);
+			for (auto &source : job.morphSources) {
+				forEachMorphDelta(source, vertexCount, [&](uint32_t v, const float*) {
+					listOffsets[v]++;
+				});
+			}
+			// All sizes in 32 bit words
+			const size_t entryWords = quantize ? 2 : 4;
+			const size_t listHeaderSize = alignedSize(vertexCount + 1, entryWords);
+			size_t deltaCount = 0;
+			for (uint32_t v = 0; v <= vertexCount; v++) {
+				uint32_t count = listOffsets[v];
+				listOffsets[v] = static_cast<uint32_t>(listHeaderSize + deltaCount * entryWords);
+				deltaCount += count;
+			}
+			const size_t vertexWords = quantize ? MorphQuantization::vertexWords(push) : slotCount * 4;
+			const size_t denseSize = static_cast<size_t>(vertexCount) * vertexWords;
+			const size_t listSize = listHeaderSize + deltaCount * entryWords;
+			const bool sparse = listSize < denseSize;
+			push.sparse = sparse ? 1 : 0;
+			job.deltaCount = deltaCount;
+			job.morphDataSize = push.bufferOffset + (sparse ? listSize : denseSize);
+			if (!sparse) {
+				listOffsets.clear();
+			}
+		}
 
-					if (pMesh.isMorphTarget) {
-						std::vector<const float*> morphBuffer;
-						uint32_t morphVertexCount = 0;
-						// loop for each type to pack data given for morphVertexData
-						for (size_t t = 0; t < primitive.targets.size(); t++) {
-							if(primitive.targets[t].find("POSITION") != primitive.targets[t].end()) {
-								const tinygltf::Accessor &posWeightAccessor = model.accessors[primitive.targets[t].find("POSITION")->second];
-								const tinygltf::BufferView &posWeightView = model.bufferViews[posWeightAccessor.bufferView];
-								morphBuffer.push_back(reinterpret_cast<const float*>(&(model.buffers[posWeightView.buffer].data[posWeightAccessor.byteOffset + posWeightView.byteOffset])));
-								morphVertexCount = posWeightAccessor.count; // TODO https://github.com/KhronosGroup/glTF/issues/1339
-							}
-						}
+		/*
+			Packs the vertices, indices and morph deltas of a planned (and measured) primitive into its ranges of the
+			vertex, index and morph data buffers, touches no other state so it can run on any thread
+		*/
+		void packPrimitive(PrimitiveJob &job, const tinygltf::Model &model, Vertex *vertices, uint32_t *indices, float *morphData, float globalscale) const
+		{
+			const tinygltf::Primitive &primitive = *job.primitive;
 
-						pMesh.morphPushConst.normalOffset = static_cast<uint32_t>(morphBuffer.size());
-						for (size_t t = 0; t < primitive.targets.size(); t++) {
-							if(primitive.targets[t].find("NORMAL") != primitive.targets[t].end()) {
-								const tinygltf::Accessor &normalWeightAccessor = model.accessors[primitive.targets[t].find("NORMAL")->second];
-								const tinygltf::BufferView &normalWeightView = model.bufferViews[normalWeightAccessor.bufferView];
-								morphBuffer.push_back(reinterpret_cast<const float*>(&(model.buffers[normalWeightView.buffer].data[normalWeightAccessor.byteOffset + normalWeightView.byteOffset])));
-							}
+			// Vertices
+			{
+				const float *bufferPos = nullptr;
+				const float *bufferNormals = nullptr;
+				const float *bufferTexCoords = nullptr;
+				// Sparse attributes and attributes without a buffer view are resolved into these (see readAccessor)
+				std::vector<unsigned char> posStorage, normStorage, uvStorage;
+
+				const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
+				bufferPos = reinterpret_cast<const float *>(readAccessor(model, posAccessor, posStorage));
+
+				if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
+					const tinygltf::Accessor &normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
+					bufferNormals = reinterpret_cast<const float *>(readAccessor(model, normAccessor, normStorage));
+				}
+
+				if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
+					const tinygltf::Accessor &uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
+					bufferTexCoords = reinterpret_cast<const float *>(readAccessor(model, uvAccessor, uvStorage));
+				}
+
+				if (job.isMorphTarget) {
+					const uint32_t vertexCount = job.vertexCount;
+					const MorphPushConst &push = job.morphPushConst;
+					std::vector<MorphTargetSource> &morphSources = job.morphSources;
+					const std::vector<glm::vec3> &slotRanges = job.slotRanges;
+					std::vector<uint32_t> &listOffsets = job.listOffsets;
+					const uint32_t slotCount = push.vertexStride;
+					const bool quantize = push.quantized != 0;
+					const bool sparse = push.sparse != 0;
+					const size_t entryWords = quantize ? 2 : 4;
+					const size_t vertexWords = quantize ? MorphQuantization::vertexWords(push) : slotCount * 4;
+
+					// Zero words decode to a zero delta in every layout, so after clearing the block only the deltas that move a vertex are written
+					float *block = &morphData[job.morphBlockStart];
+					memset(block, 0, job.morphDataSize * sizeof(float));
+					for (uint32_t j = 0; j < slotRanges.size(); j++) {
+						memcpy(&block[j * 4], &slotRanges[j].x, sizeof(float) * 3);
+					}
+					uint32_t *words = reinterpret_cast<uint32_t*>(&block[push.bufferOffset]);
+
+					double errorMax[2] = { 0.0, 0.0 };
+					double errorSum[2] = { 0.0, 0.0 };
+					size_t errorCount[2] = { 0, 0 };
+					// List entries and quantized deltas, unquantized dense deltas are written directly below
+					// out can be mapped staging memory, which is only written and never read back
+					auto writeDelta = [&](uint32_t slot, const float *value, uint32_t *out) {
+						const glm::vec3 delta = transformMorphDelta(job, slot, value, globalscale);
+						if (!quantize) {
+							out[0] = slot;
+							memcpy(&out[1], &delta.x, sizeof(float) * 3);
+							return;
 						}
 
-						pMesh.morphPushConst.tangentOffset = static_cast<uint32_t>(morphBuffer.size());
-						for (size_t t = 0; t < primitive.targets.size(); t++) {
-							if(primitive.targets[t].find("TANGENT") != primitive.targets[t].end()) {
-								const tinygltf::Accessor &tangentWeightAccessor = model.accessors[primitive.targets[t].find("TANGENT")->second];
-								const tinygltf::BufferView &tangentWeightView = model.bufferViews[tangentWeightAccessor.bufferView];
-								morphBuffer.push_back(reinterpret_cast<const float*>(&(model.buffers[tangentWeightView.buffer].data[tangentWeightAccessor.byteOffset + tangentWeightView.byteOffset])));
+						const bool position = slot < push.normalOffset;
+						const glm::vec3 unit = MorphQuantization::toUnit(delta, slotRanges[slot]);
+						uint32_t encoded[2];
+						size_t encodedWords = 2;
+						glm::vec3 decoded;
+						if (sparse) {
+							uint32_t decodedSlot;
+							MorphQuantization::encodeListEntry(slot, unit, encoded);
+							decoded = MorphQuantization::decodeListEntry(encoded, decodedSlot);
+						} else if (position) {
+							MorphQuantization::encodePosition(unit, encoded);
+							decoded = MorphQuantization::decodePosition(encoded);
+						} else {
+							encoded[0] = MorphQuantization::encodeDirection(unit);
+							encodedWords = 1;
+							decoded = MorphQuantization::decodeDirection(encoded[0]);
+						}
+						memcpy(out, encoded, encodedWords * sizeof(uint32_t));
+						const double error = glm::length(decoded * slotRanges[slot] - delta);
+						const uint32_t kind = position ? 0 : 1;
+						errorMax[kind] = std::max(errorMax[kind], error);
+						errorSum[kind] += error * error;
+						errorCount[kind]++;
+					};
+
+					if (sparse) {
+						memcpy(words, listOffsets.data(), listOffsets.size() * sizeof(uint32_t));
+						// Entries of a vertex end up ordered by slot
+						for (uint32_t j = 0; j < slotCount; j++) {
+							forEachMorphDelta(morphSources[j], vertexCount, [&](uint32_t v, const float *value) {
+								writeDelta(j, value, &words[listOffsets[v]]);
+								listOffsets[v] += static_cast<uint32_t>(entryWords);
+							});
+						}
+					} else {
+						for (auto &source : morphSources) {
+							if (!source.dense) {
+								densifyMorphTarget(source, vertexCount);
 							}
 						}
 
-						pMesh.morphPushConst.vertexStride = static_cast<uint32_t>(morphBuffer.size());
-						pMesh.morphPushConst.bufferOffset = static_cast<uint32_t>(morphVertexData.size());
-
 						// Pack data in VAO style
-						// Can assume all vec3 from spec
-						for (size_t i = 0; i < morphVertexCount; i++) {
+						// Can assume all vec3 from spec, stored as vec4 with the w unused (or quantized)
+						for (uint32_t i = 0; i < vertexCount; i++) {
+							uint32_t *vertexOut = &words[i * vertexWords];
 							// Position data inserted first
-							for (size_t j = 0; j <  morphBuffer.size(); j++) {
-								glm::vec3 temp = localNodeRSMatrix * glm::vec4(glm::make_vec3(&(morphBuffer[j])[i * 3]), 1.0f);
-
-								if (j < pMesh.morphPushConst.normalOffset) {
-									// only position get global scaled up
-									temp *= globalscale;
-								} else if (temp.x != 0 || temp.y != 0 ||  temp.z != 0) { // glm::normalize() causes "nan" TODO figure that out
-									// need to normalize normal/tangent vectors
-									temp = glm::normalize(temp);
+							for (uint32_t j = 0; j < slotCount; j++) {
+								const float *value = &morphSources[j].dense[i * 3];
+								if (quantize) {
+									if (!isZeroDelta(value)) {
+										writeDelta(j, value, &vertexOut[MorphQuantization::slotWord(push, j)]);
+									}
+								} else {
+									glm::vec3 temp = transformMorphDelta(job, j, value, globalscale);
+									memcpy(&vertexOut[j * 4], &temp.x, sizeof(float) * 3);
 								}
-								temp.y *= -1.0f;
-								morphVertexData.push_back(temp.x);
-								morphVertexData.push_back(temp.y);
-								morphVertexData.push_back(temp.z);
 							}
 						}
 					}
 
-					for (size_t v = 0; v < posAccessor.count; v++) {
-						Vertex vert{};
-						vert.pos = localNodeTRSMatrix * glm::vec4(glm::make_vec3(&bufferPos[v * 3]), 1.0f);
-						vert.pos *= globalscale;
+					if (quantize) {
+						Mesh::QuantizationError &stats = job.quantizationError;
+						stats.positionMax = static_cast<float>(errorMax[0]);
+						stats.positionRms = errorCount[0] ? static_cast<float>(sqrt(errorSum[0] / errorCount[0])) : 0.0f;
+						stats.directionMax = static_cast<float>(errorMax[1]);
+						stats.directionRms = errorCount[1] ? static_cast<float>(sqrt(errorSum[1] / errorCount[1])) : 0.0f;
+						// Size the same deltas would take unquantized
+						const size_t floatSize = std::min(static_cast<size_t>(vertexCount) * slotCount * 4, alignedSize(vertexCount + 1, 4) + job.deltaCount * 4);
+						std::ostringstream report;
+						report << "Quantized morph deltas of mesh \"" << *job.meshName << "\": "
+							<< (floatSize * sizeof(float)) / 1024 << " KB -> " << job.morphDataSize * sizeof(float) / 1024 << " KB"
+							<< ", position error max " << stats.positionMax << " rms " << stats.positionRms
+							<< ", normal/tangent error max " << stats.directionMax << " rms " << stats.directionRms;
+						job.quantizationReport = report.str();
+					}
+					std::vector<MorphTargetSource>().swap(morphSources);
+					std::vector<uint32_t>().swap(listOffsets);
+				}
 
-						// glm::normalize() causes "nan" TODO figure that out
-						vert.normal = glm::normalize(glm::mat3(localNodeTRSMatrix) * glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * 3]) : glm::vec3(0.0f)));
+				for (size_t v = 0; v < job.vertexCount; v++) {
+					Vertex vert{};
+					vert.pos = glm::make_vec3(&bufferPos[v * 3]);
+					vert.pos *= globalscale;
 
-						//vert.uv = bufferTexCoords ? glm::make_vec2(&bufferTexCoords[v * 2]) : glm::vec3(0.0f);
-						vert.tangent = glm::vec3(0.0f);
+					// glm::normalize() causes "nan" TODO figure that out
+					vert.normal = glm::normalize(bufferNormals ? glm::make_vec3(&bufferNormals[v * 3]) : glm::vec3(0.0f));
 
-						// Vulkan coordinate system
-						vert.pos.y *= -1.0f;
-						vert.normal.y *= -1.0f;
+					//vert.uv = bufferTexCoords ? glm::make_vec2(&bufferTexCoords[v * 2]) : glm::vec3(0.0f);
+					vert.tangent = glm::vec3(0.0f);
 
-						if (pMesh.isMorphTarget) {
-							vertexBufferMorph.push_back(vert);
-						} else {
-							vertexBufferNormal.push_back(vert);
-						}
-					}
+					// Vulkan coordinate system
+					vert.pos.y *= -1.0f;
+					vert.normal.y *= -1.0f;
+
+					vertices[job.vertexStart + v] = vert;
 				}
+			}
 
-				// Indices
-				{
-					const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
-					const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
-					const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-
-					pPrimitive.indexCount = static_cast<uint32_t>(accessor.count);
-
-					// each morph has own gl_VertexIndex start at 0 so index is at zero_
-					switch (accessor.componentType) {
-					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-						uint32_t *buf = new uint32_t[accessor.count];
-						memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-						for (size_t index = 0; index < accessor.count; index++) {
-							if (pMesh.isMorphTarget) {
-								indexBufferMorph.push_back(buf[index]);
-							} else {
-								indexBufferNormal.push_back(buf[index] + vertexStart);
-							}
-						}
-						break;
-					}
-					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-						uint16_t *buf = new uint16_t[accessor.count];
-						memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-						for (size_t index = 0; index < accessor.count; index++) {
-							if (pMesh.isMorphTarget) {
-								indexBufferMorph.push_back(buf[index]);
-							} else {
-								indexBufferNormal.push_back(buf[index] + vertexStart);
-							}
-						}
-						break;
+			// Indices
+			if (job.indexCount > 0) {
+				const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
+				std::vector<unsigned char> indexStorage;
+				const unsigned char *indexData = readAccessor(model, accessor, indexStorage);
+
+				// each morph has own gl_VertexIndex start at 0 so index is at zero_
+				const uint32_t vertexStart = job.isMorphTarget ? 0 : job.vertexStart;
+				uint32_t *out = &indices[job.firstIndex];
+				switch (accessor.componentType) {
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
+					const uint32_t *buf = reinterpret_cast<const uint32_t*>(indexData);
+					for (size_t index = 0; index < accessor.count; index++) {
+						out[index] = buf[index] + vertexStart;
 					}
-					case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-						uint8_t *buf = new uint8_t[accessor.count];
-						memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-						for (size_t index = 0; index < accessor.count; index++) {
-							if (pMesh.isMorphTarget) {
-								indexBufferMorph.push_back(buf[index]);
-							} else {
-								indexBufferNormal.push_back(buf[index] + vertexStart);
-							}
-						}
-						break;
+					break;
+				}
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
+					const uint16_t *buf = reinterpret_cast<const uint16_t*>(indexData);
+					for (size_t index = 0; index < accessor.count; index++) {
+						out[index] = buf[index] + vertexStart;
 					}
-					default:
-						std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-						return;
+					break;
+				}
+				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
+					const uint8_t *buf = reinterpret_cast<const uint8_t*>(indexData);
+					for (size_t index = 0; index < accessor.count; index++) {
+						out[index] = buf[index] + vertexStart;
 					}
+					break;
+				}
 				}
 			}
 		}
 
-		void loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue)
+		void loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device)
 		{
 			for (tinygltf::Image &image : gltfModel.images) {
 				vkglTF::Texture texture;
-				texture.fromglTfImage(image, device, transferQueue);
+				texture.fromglTfImage(image, device);
 				textures.push_back(texture);
 			}
 		}
@@ -754,139 +1394,860 @@ namespace vkglTF
 			}
 		}
 
-		void loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f)
+		// glTF primitives without a material (-1) or with one that was not loaded get the default material
+		Material &primitiveMaterial(int index)
 		{
-			tinygltf::Model gltfModel;
-			tinygltf::TinyGLTF gltfContext;
-			std::string error;
+			return (index >= 0 && static_cast<size_t>(index) < materials.size()) ? materials[index] : defaultMaterial;
+		}
 
-#if defined(__ANDROID__)
-			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
-			assert(asset);
-			size_t size = AAsset_getLength(asset);
-			assert(size > 0);
-			char* fileData = new char[size];
-			AAsset_read(asset, fileData, size);
-			AAsset_close(asset);
-			std::string baseDir;
-			bool fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, fileData, size, baseDir);
-			free(fileData);
-#else
-			bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, filename.c_str());
-#endif
-			// TODO better placement so not sending in 4 vectors to loadNode()
-			std::vector<Vertex> vertexBufferMorph;
-			std::vector<uint32_t> indexBufferMorph;
-			std::vector<Vertex> vertexBufferNormal;
-			std::vector<uint32_t> indexBufferNormal;
+		static std::string directoryOf(const std::string &filename)
+		{
+			size_t separator = filename.find_last_of("/\\");
+			return (separator == std::string::npos) ? std::string() : filename.substr(0, separator + 1);
+		}
 
-			if (fileLoaded) {
-			//	loadImages(gltfModel, device, transferQueue);
-			//	loadMaterials(gltfModel, device, transferQueue);
-				const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene];
-				for (size_t i = 0; i < scene.nodes.size(); i++) {
-					const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-					loadNode(node, scene.nodes[i],  glm::mat4(1.0f), gltfModel, vertexBufferMorph, indexBufferMorph, vertexBufferNormal, indexBufferNormal, scale);
+		/*
+			Hash of everything the packed data depends on: the load options and the content of the glTF file
+			and its external buffers (relative to the glTF file), 0 if one of the files can not be read
+			Every option that changes what is cached goes in, mapBufferData decides whether animations can be streamed
+			Baking and compression run after loading the cache and loadThreads does not change the output, so they stay out
+		*/
+		uint64_t cacheSourceHash(const std::string &filename, const std::vector<std::string> &dependencies, float scale) const
+		{
+			const uint32_t options[4] = { quantizeMorphDeltas ? 1u : 0u, sizeof(Vertex), streamAnimationKeys, mapBufferData ? 1u : 0u };
+			uint64_t h = cache::hash(&scale, sizeof(scale), cache::VERSION);
+			h = cache::hash(options, sizeof(options), h);
+			const std::string directory = directoryOf(filename);
+			for (size_t i = 0; i <= dependencies.size(); i++) {
+				const std::string path = (i == 0) ? filename : directory + dependencies[i - 1];
+				vks::MappedFile file;
+				if (!file.open(path)) {
+					return 0;
 				}
+				h = cache::hash(file.data(), file.size(), h);
 			}
-			else {
-				// TODO: throw
-				std::cerr << "Could not load gltf file: " << error << std::endl;
-				exit(-1);
+			return (h != 0) ? h : 1;
+		}
+
+		static void writeCacheMesh(cache::Writer &writer, const Mesh &mesh)
+		{
+			writer.write(static_cast<uint32_t>(mesh.isMorphTarget));
+			writer.write(static_cast<uint64_t>(mesh.sampler));
+			writer.write(static_cast<uint64_t>(mesh.input));
+			writer.write(static_cast<uint64_t>(mesh.output));
+			writer.write(static_cast<uint32_t>(mesh.interpolation));
+			writer.write(mesh.weightsInit);
+			writer.write(mesh.weightsTime);
+			writer.write(mesh.weightsData);
+			writer.write(mesh.weightsSource.path);
+			writer.write(mesh.weightsSource.timesOffset);
+			writer.write(mesh.weightsSource.valuesOffset);
+			writer.write(mesh.weightsSource.keyCount);
+			writer.write(mesh.weightsSource.components);
+			writer.write(static_cast<uint32_t>(mesh.weightsSource.interpolation));
+			writer.write(mesh.weights);
+			writer.write(mesh.slotTargets);
+			writer.write(mesh.morphVertexOffset);
+			writer.write(mesh.vertexCount);
+			writer.write(mesh.node);
+			writer.write(mesh.morphPushConst);
+			writer.write(mesh.quantizationError);
+			writer.write(static_cast<uint64_t>(mesh.primitives.size()));
+			for (const Primitive &primitive : mesh.primitives) {
+				writer.write(primitive.firstIndex);
+				writer.write(primitive.indexCount);
+				writer.write(primitive.materialIndex);
 			}
+		}
 
-			size_t vertexBufferSizeMorph = vertexBufferMorph.size() * sizeof(Vertex);
-			size_t indexBufferSizeMorph = indexBufferMorph.size() * sizeof(uint32_t);
-			indicesMorph.count = static_cast<uint32_t>(indexBufferMorph.size());
+		bool readCacheMesh(cache::Reader &reader, Mesh &mesh)
+		{
+			uint32_t isMorphTarget = 0, interpolation = 0;
+			uint64_t sampler = 0, input = 0, output = 0, primitiveCount = 0;
+			reader.read(isMorphTarget);
+			reader.read(sampler);
+			reader.read(input);
+			reader.read(output);
+			reader.read(interpolation);
+			reader.read(mesh.weightsInit);
+			reader.read(mesh.weightsTime);
+			reader.read(mesh.weightsData);
+			uint32_t sourceInterpolation = 0;
+			reader.read(mesh.weightsSource.path);
+			reader.read(mesh.weightsSource.timesOffset);
+			reader.read(mesh.weightsSource.valuesOffset);
+			reader.read(mesh.weightsSource.keyCount);
+			reader.read(mesh.weightsSource.components);
+			reader.read(sourceInterpolation);
+			mesh.weightsSource.interpolation = static_cast<AnimationTrack::Interpolation>(sourceInterpolation);
+			reader.read(mesh.weights);
+			reader.read(mesh.slotTargets);
+			reader.read(mesh.morphVertexOffset);
+			reader.read(mesh.vertexCount);
+			reader.read(mesh.node);
+			reader.read(mesh.morphPushConst);
+			reader.read(mesh.quantizationError);
+			reader.read(primitiveCount);
+			for (uint64_t i = 0; i < primitiveCount && reader.ok(); i++) {
+				uint32_t firstIndex = 0, indexCount = 0;
+				int32_t materialIndex = -1;
+				reader.read(firstIndex);
+				reader.read(indexCount);
+				reader.read(materialIndex);
+				mesh.primitives.push_back(Primitive{ firstIndex, indexCount, materialIndex, primitiveMaterial(materialIndex) });
+			}
+			mesh.isMorphTarget = isMorphTarget != 0;
+			mesh.sampler = static_cast<size_t>(sampler);
+			mesh.input = static_cast<size_t>(input);
+			mesh.output = static_cast<size_t>(output);
+			mesh.interpolation = static_cast<AnimationTrack::Interpolation>(interpolation);
+			return reader.ok();
+		}
 
-			size_t vertexBufferSizeNormal = vertexBufferNormal.size() * sizeof(Vertex);
-			size_t indexBufferSizeNormal = indexBufferNormal.size() * sizeof(uint32_t);
-			indicesNormal.count = static_cast<uint32_t>(indexBufferNormal.size());
+		// External buffer files of a glTF model, the cache depends on them next to the glTF file itself
+		static std::vector<std::string> cacheDependencies(const tinygltf::Model &gltfModel)
+		{
+			std::vector<std::string> dependencies;
+			for (const tinygltf::Buffer &buffer : gltfModel.buffers) {
+				if (!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0) {
+					dependencies.push_back(buffer.uri);
+				}
+			}
+			return dependencies;
+		}
 
-			struct StagingBuffer {
-				VkBuffer buffer;
-				VkDeviceMemory memory;
-			} vertexStagingMorph, indexStagingMorph, vertexStagingNormal, indexStagingNormal;
+		/*
+			Write the packed data of a freshly loaded glTF file to cacheFile
+			The staged outputs are read back from the mapped staging memory, which is slow on write combined memory but only
+			happens when the cache is rebuilt
+		*/
+		bool saveCache(const std::string &filename, const std::vector<std::string> &dependencies, float scale, const PackedScene &packed)
+		{
+			cache::Header header{};
+			header.magic = cache::MAGIC;
+			header.version = cache::VERSION;
+			header.sourceHash = cacheSourceHash(filename, dependencies, scale);
+			header.vertexSize = sizeof(Vertex);
+			header.sectionCount = cache::SECTION_COUNT;
+			if (header.sourceHash == 0) {
+				return false;
+			}
 
+			cache::Writer dependencyWriter;
+			dependencyWriter.write(static_cast<uint64_t>(dependencies.size()));
+			for (const std::string &dependency : dependencies) {
+				dependencyWriter.write(dependency);
+			}
 
-			// TODO this is ugly, but just for testing
-			if ((vertexBufferSizeMorph > 0) && (indexBufferSizeMorph > 0)) {
-				// Create staging buffers
-				// Vertex data Morph
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					vertexBufferSizeMorph,
-					&vertexStagingMorph.buffer,
-					&vertexStagingMorph.memory,
-					vertexBufferMorph.data()));
+			cache::Writer modelWriter;
+			modelWriter.write(animationMaxTime);
+			modelWriter.write(nodes);
+			modelWriter.write(static_cast<uint64_t>(meshesMorph.size()));
+			for (const Mesh &mesh : meshesMorph) {
+				writeCacheMesh(modelWriter, mesh);
+			}
+			modelWriter.write(static_cast<uint64_t>(meshesNormal.size()));
+			for (const Mesh &mesh : meshesNormal) {
+				writeCacheMesh(modelWriter, mesh);
+			}
 
-				// Index data Morph
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					indexBufferSizeMorph,
-					&indexStagingMorph.buffer,
-					&indexStagingMorph.memory,
-					indexBufferMorph.data()));
+			const void *sectionData[cache::SECTION_COUNT] = {
+				dependencyWriter.data.data(), modelWriter.data.data(),
+				packed.verticesMorph.data, packed.indicesMorph.data, packed.verticesNormal.data, packed.indicesNormal.data,
+				packed.morphData.data, morphWeightData.data()
+			};
+			cache::Section sections[cache::SECTION_COUNT] = {
+				{ 0, dependencyWriter.data.size() }, { 0, modelWriter.data.size() },
+				{ 0, packed.verticesMorph.size }, { 0, packed.indicesMorph.size },
+				{ 0, packed.verticesNormal.size }, { 0, packed.indicesNormal.size },
+				{ 0, packed.morphData.size }, { 0, morphWeightData.size() * sizeof(float) }
+			};
+			uint64_t offset = sizeof(header) + sizeof(sections);
+			for (uint32_t i = 0; i < cache::SECTION_COUNT; i++) {
+				offset = (offset + cache::SECTION_ALIGNMENT - 1) / cache::SECTION_ALIGNMENT * cache::SECTION_ALIGNMENT;
+				sections[i].offset = offset;
+				offset += sections[i].size;
+			}
+
+			const bool written = vks::writeFileAtomic(cacheFile, [&](std::ofstream &out) {
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				out.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+				uint64_t position = sizeof(header) + sizeof(sections);
+				const char padding[cache::SECTION_ALIGNMENT] = {};
+				for (uint32_t i = 0; i < cache::SECTION_COUNT; i++) {
+					out.write(padding, static_cast<std::streamsize>(sections[i].offset - position));
+					if (sections[i].size > 0) {
+						out.write(static_cast<const char*>(sectionData[i]), static_cast<std::streamsize>(sections[i].size));
+					}
+					position = sections[i].offset + sections[i].size;
+				}
+			});
+			if (!written) {
+				std::cerr << "Could not write model cache " << cacheFile << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		/*
+			Load the model from cacheFile if it was built from the current content of filename (and its buffers) with
+			the same options. The vertex, index and morph sections are copied to staging memory straight from the mapping
+			Returns false without touching the model if the cache is missing, stale or damaged
+		*/
+		bool loadFromCache(const std::string &filename, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f)
+		{
+			vks::MappedFile file;
+			cache::Header header;
+			cache::Section sections[cache::SECTION_COUNT];
+			if (!file.open(cacheFile) || file.size() < sizeof(header) + sizeof(sections)) {
+				return false;
+			}
+			memcpy(&header, file.data(), sizeof(header));
+			memcpy(sections, file.data() + sizeof(header), sizeof(sections));
+			if (header.magic != cache::MAGIC || header.version != cache::VERSION || header.vertexSize != sizeof(Vertex) || header.sectionCount != cache::SECTION_COUNT) {
+				return false;
+			}
+			for (const cache::Section &section : sections) {
+				if (section.offset % cache::SECTION_ALIGNMENT != 0 || section.offset > file.size() || section.size > file.size() - section.offset) {
+					return false;
+				}
+			}
+			auto sectionData = [&](cache::SectionId id) {
+				return file.data() + sections[id].offset;
+			};
+
+			cache::Reader dependencyReader(sectionData(cache::SECTION_DEPENDENCIES), static_cast<size_t>(sections[cache::SECTION_DEPENDENCIES].size));
+			uint64_t dependencyCount = 0;
+			std::vector<std::string> dependencies;
+			dependencyReader.read(dependencyCount);
+			for (uint64_t i = 0; i < dependencyCount && dependencyReader.ok(); i++) {
+				dependencies.push_back(std::string());
+				dependencyReader.read(dependencies.back());
+			}
+			if (!dependencyReader.ok() || cacheSourceHash(filename, dependencies, scale) != header.sourceHash) {
+				return false;
+			}
+
+			cache::Reader modelReader(sectionData(cache::SECTION_MODEL), static_cast<size_t>(sections[cache::SECTION_MODEL].size));
+			float maxTime = 0.0f;
+			std::vector<Node> cachedNodes;
+			std::vector<Mesh> morphMeshes, normalMeshes;
+			uint64_t meshCount = 0;
+			modelReader.read(maxTime);
+			modelReader.read(cachedNodes);
+			modelReader.read(meshCount);
+			for (uint64_t i = 0; i < meshCount && modelReader.ok(); i++) {
+				morphMeshes.push_back(Mesh{});
+				readCacheMesh(modelReader, morphMeshes.back());
+			}
+			modelReader.read(meshCount);
+			for (uint64_t i = 0; i < meshCount && modelReader.ok(); i++) {
+				normalMeshes.push_back(Mesh{});
+				readCacheMesh(modelReader, normalMeshes.back());
+			}
+			if (!modelReader.ok() || sections[cache::SECTION_VERTICES_MORPH].size % sizeof(Vertex) != 0 || sections[cache::SECTION_VERTICES_NORMAL].size % sizeof(Vertex) != 0 ||
+				sections[cache::SECTION_INDICES_MORPH].size % sizeof(uint32_t) != 0 || sections[cache::SECTION_INDICES_NORMAL].size % sizeof(uint32_t) != 0 ||
+				sections[cache::SECTION_MORPH_TARGETS].size % sizeof(float) != 0) {
+				return false;
+			}
+			// updateNodeTransforms() relies on parents coming first
+			for (size_t i = 0; i < cachedNodes.size(); i++) {
+				if (cachedNodes[i].parent >= static_cast<int32_t>(i)) {
+					return false;
+				}
+			}
+			auto validNodes = [&](const std::vector<Mesh> &meshes) {
+				for (const Mesh &mesh : meshes) {
+					if (mesh.node >= cachedNodes.size()) {
+						return false;
+					}
+				}
+				return true;
+			};
+			if (!validNodes(morphMeshes) || !validNodes(normalMeshes)) {
+				return false;
+			}
+			// Index ranges, vertex ranges and morph data of every mesh have to lie in the sections they are drawn from
+			auto validPrimitives = [&](const std::vector<Mesh> &meshes, cache::SectionId indexSection) {
+				const uint64_t indexCount = sections[indexSection].size / sizeof(uint32_t);
+				for (const Mesh &mesh : meshes) {
+					for (const Primitive &primitive : mesh.primitives) {
+						if (static_cast<uint64_t>(primitive.firstIndex) + primitive.indexCount > indexCount) {
+							return false;
+						}
+					}
+				}
+				return true;
+			};
+			if (!validPrimitives(morphMeshes, cache::SECTION_INDICES_MORPH) || !validPrimitives(normalMeshes, cache::SECTION_INDICES_NORMAL)) {
+				return false;
+			}
+			const unsigned char *morphTargets = sectionData(cache::SECTION_MORPH_TARGETS);
+			const uint64_t morphFloats = sections[cache::SECTION_MORPH_TARGETS].size / sizeof(float);
+			const uint64_t weightFloats = sections[cache::SECTION_MORPH_WEIGHTS].size / sizeof(float);
+			for (const Mesh &mesh : morphMeshes) {
+				const MorphPushConst &push = mesh.morphPushConst;
+				if (mesh.morphVertexOffset % sizeof(Vertex) != 0 ||
+					mesh.morphVertexOffset + static_cast<uint64_t>(mesh.vertexCount) * sizeof(Vertex) > sections[cache::SECTION_VERTICES_MORPH].size) {
+					return false;
+				}
+				if (push.normalOffset > push.tangentOffset || push.tangentOffset > push.vertexStride || mesh.slotTargets.size() < push.vertexStride ||
+					push.weightOffset + 4ull + push.vertexStride * 2ull > weightFloats) {
+					return false;
+				}
+				// Quantized meshes have their slot ranges right before bufferOffset
+				if (push.quantized && push.bufferOffset < push.vertexStride * 4ull) {
+					return false;
+				}
+				if (push.sparse) {
+					// vertexCount + 1 list offsets, relative to bufferOffset and never decreasing
+					if (push.bufferOffset + mesh.vertexCount + 1ull > morphFloats) {
+						return false;
+					}
+					uint32_t previous = 0;
+					for (uint32_t v = 0; v <= mesh.vertexCount; v++) {
+						uint32_t listOffset;
+						memcpy(&listOffset, morphTargets + (push.bufferOffset + static_cast<uint64_t>(v)) * sizeof(float), sizeof(listOffset));
+						if (listOffset < previous || push.bufferOffset + static_cast<uint64_t>(listOffset) > morphFloats) {
+							return false;
+						}
+						previous = listOffset;
+					}
+				} else {
+					const uint64_t vertexWords = push.quantized ? MorphQuantization::vertexWords(push) : push.vertexStride * 4ull;
+					if (push.bufferOffset + mesh.vertexCount * vertexWords > morphFloats) {
+						return false;
+					}
+				}
+			}
+			// Streamed animations are read from the glTF file or its buffers again
+			for (Mesh &mesh : morphMeshes) {
+				const std::string &uri = mesh.weightsSource.path;
+				if (mesh.weightsSource.keyCount > 0 && !openWeightsStream(mesh, uri.empty() ? filename : directoryOf(filename) + uri)) {
+					return false;
+				}
+			}
+
+			animationMaxTime = maxTime;
+			nodes = std::move(cachedNodes);
+			updateNodeTransforms();
+			meshesMorph = std::move(morphMeshes);
+			meshesNormal = std::move(normalMeshes);
+			const float *morphWeights = reinterpret_cast<const float*>(sectionData(cache::SECTION_MORPH_WEIGHTS));
+			morphWeightData.assign(morphWeights, morphWeights + sections[cache::SECTION_MORPH_WEIGHTS].size / sizeof(float));
+
+			PackedScene packed;
+			PackedBuffer *outputs[] = { &packed.verticesMorph, &packed.indicesMorph, &packed.verticesNormal, &packed.indicesNormal, &packed.morphData };
+			const cache::SectionId outputSections[] = {
+				cache::SECTION_VERTICES_MORPH, cache::SECTION_INDICES_MORPH, cache::SECTION_VERTICES_NORMAL, cache::SECTION_INDICES_NORMAL, cache::SECTION_MORPH_TARGETS
+			};
+			for (size_t i = 0; i < 5; i++) {
+				outputs[i]->size = static_cast<size_t>(sections[outputSections[i]].size);
+			}
+			preparePackedScene(packed, device);
+			for (size_t i = 0; i < 5; i++) {
+				if (outputs[i]->size > 0) {
+					memcpy(outputs[i]->data, sectionData(outputSections[i]), outputs[i]->size);
+				}
+			}
+			uploadBuffers(packed, device, transferQueue);
+			return true;
+		}
+
+		// GLB files start with the "glTF" magic, everything else is parsed as glTF JSON
+		static bool isBinaryGltf(const unsigned char *data, size_t size)
+		{
+			return size >= 4 && memcmp(data, "glTF", 4) == 0;
+		}
+
+		/*
+			Parse a .gltf or .glb file into the tinygltf buffers
+		*/
+		bool parseFile(const std::string &filename, tinygltf::Model &gltfModel, std::string &error)
+		{
+			tinygltf::TinyGLTF gltfContext;
+#if defined(__ANDROID__)
+			AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			assert(asset);
+			size_t size = AAsset_getLength(asset);
+			assert(size > 0);
+			char* fileData = new char[size];
+			AAsset_read(asset, fileData, size);
+			AAsset_close(asset);
+			std::string baseDir;
+			bool fileLoaded;
+			if (isBinaryGltf(reinterpret_cast<const unsigned char*>(fileData), size)) {
+				fileLoaded = gltfContext.LoadBinaryFromMemory(&gltfModel, &error, reinterpret_cast<const unsigned char*>(fileData), static_cast<unsigned int>(size), baseDir);
+			} else {
+				fileLoaded = gltfContext.LoadASCIIFromString(&gltfModel, &error, fileData, size, baseDir);
+			}
+			delete[] fileData;
+			return fileLoaded;
+#else
+			unsigned char magic[4] = {};
+			std::ifstream file(filename, std::ios::binary);
+			file.read(reinterpret_cast<char*>(magic), sizeof(magic));
+			if (isBinaryGltf(magic, static_cast<size_t>(file.gcount()))) {
+				return gltfContext.LoadBinaryFromFile(&gltfModel, &error, filename.c_str());
+			}
+			return gltfContext.LoadASCIIFromFile(&gltfModel, &error, filename.c_str());
+#endif
+		}
+
+		/*
+			Parse a .gltf or .glb file from a memory mapping and point mappedBuffers at the GLB BIN chunk and the
+			mapped external buffer files, so sizeScene and packScene read the accessors in place without copying them first
+			The mappings are added to files and must be kept until the scene is packed
+		*/
+		bool parseMapped(const std::string &filename, tinygltf::Model &gltfModel, std::string &error, std::vector<std::unique_ptr<vks::MappedFile>> &files)
+		{
+			std::unique_ptr<vks::MappedFile> file(new vks::MappedFile());
+			if (!file->open(filename) || file->size() > UINT32_MAX) {
+				return false;
+			}
+			const unsigned char *data = file->data();
+			const size_t size = file->size();
+			const std::string directory = directoryOf(filename);
+			files.push_back(std::move(file));
+
+			tinygltf::TinyGLTF gltfContext;
+			gltfContext.SetLoadBufferData(false);
+			const unsigned char *binChunk = nullptr;
+			if (isBinaryGltf(data, size)) {
+				if (!gltfContext.LoadBinaryFromMemory(&gltfModel, &error, data, static_cast<unsigned int>(size), directory)) {
+					return false;
+				}
+				// 12 byte header, JSON chunk, then the 8 byte BIN chunk header (length, type)
+				uint32_t jsonLength;
+				memcpy(&jsonLength, data + 12, sizeof(jsonLength));
+				if (size >= 20 + static_cast<size_t>(jsonLength) + 8) {
+					binChunk = data + 20 + jsonLength + 8;
+				}
+			} else if (!gltfContext.LoadASCIIFromString(&gltfModel, &error, reinterpret_cast<const char*>(data), static_cast<unsigned int>(size), directory)) {
+				return false;
+			}
+
+			mappedBuffers.assign(gltfModel.buffers.size(), nullptr);
+			mappedBufferFiles.assign(gltfModel.buffers.size(), BufferFile{ std::string(), std::string(), 0 });
+			for (size_t i = 0; i < gltfModel.buffers.size(); i++) {
+				const tinygltf::Buffer &buffer = gltfModel.buffers[i];
+				if (!buffer.data.empty()) {
+					// Embedded data URI, decoded by tinygltf
+					continue;
+				}
+				if (buffer.uri.empty()) {
+					mappedBuffers[i] = binChunk;
+					mappedBufferFiles[i] = BufferFile{ std::string(), filename, binChunk ? static_cast<uint64_t>(binChunk - data) : 0 };
+				} else {
+					std::unique_ptr<vks::MappedFile> bufferFile(new vks::MappedFile());
+					if (bufferFile->open(directory + buffer.uri)) {
+						mappedBuffers[i] = bufferFile->data();
+						mappedBufferFiles[i] = BufferFile{ buffer.uri, directory + buffer.uri, 0 };
+						files.push_back(std::move(bufferFile));
+					}
+				}
+				if (!mappedBuffers[i]) {
+					error = "Could not map buffer " + std::to_string(i) + " " + buffer.uri;
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/*
+			Passing a null device only loads the host side data (morphVertexData, morphBaseVertices, meshes)
+			and skips all buffer creation, this is what CPU only users like the morph evaluator need
+			The scene is loaded in two passes: sizeScene measures every output, then packScene writes the transformed data
+			straight into mapped staging memory. So the peak memory of a load is about the source files plus the staging
+			memory, there is no host copy of the packed data in between (unless keepHostData is set)
+		*/
+		void loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f)
+		{
+			if (!cacheFile.empty() && loadFromCache(filename, device, transferQueue, scale)) {
+				bakeAnimations();
+				compressAnimations();
+				return;
+			}
+
+			tinygltf::Model gltfModel;
+			std::string error;
+			// The glTF file and its buffers while the scene is read in place from them
+			std::vector<std::unique_ptr<vks::MappedFile>> mappedFiles;
+			bool fileLoaded = mapBufferData && parseMapped(filename, gltfModel, error, mappedFiles);
+			if (!fileLoaded) {
+				gltfModel = tinygltf::Model();
+				mappedBuffers.clear();
+				mappedBufferFiles.clear();
+				mappedFiles.clear();
+				fileLoaded = parseFile(filename, gltfModel, error);
+			}
+			if (!fileLoaded) {
+				// TODO: throw
+				std::cerr << "Could not load gltf file: " << error << std::endl;
+				exit(-1);
+			}
+
+			ScenePlan plan;
+			PackedScene packed;
+			sizeScene(gltfModel, scale, plan, packed);
+			preparePackedScene(packed, device);
+			packScene(gltfModel, scale, plan, packed);
+
+			// Everything is packed, release the source before the upload and the cache write
+			const std::vector<std::string> dependencies = cacheDependencies(gltfModel);
+			plan = ScenePlan();
+			mappedBuffers.clear();
+			mappedBufferFiles.clear();
+			gltfModel = tinygltf::Model();
+			mappedFiles.clear();
+			if (!cacheFile.empty()) {
+				saveCache(filename, dependencies, scale, packed);
+			}
+			uploadBuffers(packed, device, transferQueue);
+			bakeAnimations();
+			compressAnimations();
+		}
+
+		/*
+			Build the meshes and buffers from an already parsed glTF model
+			Split from loadFromFile so the loader can be used (and timed) without the file parsing
+		*/
+		void loadFromGltfModel(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue, float scale = 1.0f)
+		{
+			ScenePlan plan;
+			PackedScene packed;
+			sizeScene(gltfModel, scale, plan, packed);
+			preparePackedScene(packed, device);
+			packScene(gltfModel, scale, plan, packed);
+			uploadBuffers(packed, device, transferQueue);
+			bakeAnimations();
+			compressAnimations();
+		}
+
+		/*
+			Resample the weight animation of every morph mesh with bakeAnimationRate and bakeAnimationMaxError, called by
+			the loaders (the model cache keeps the glTF keys). Reports the memory and sampling cost of every baked track
+		*/
+		void bakeAnimations()
+		{
+			if (!(bakeAnimationRate > 0.0f)) {
+				return;
+			}
+			std::vector<float> times, values;
+			for (Mesh &mesh : meshesMorph) {
+				if (mesh.weightsRate > 0.0f || !mesh.weightsQuantized.empty() || mesh.weightsStream) {
+					continue;
+				}
+				AnimationBake::Report report;
+				if (!AnimationBake::bake(mesh.weightTrack(), bakeAnimationRate, bakeAnimationMaxError, bakeAnimationRate * 16.0f, times, values, report)) {
+					std::cerr << "Weight animation of node " << mesh.node << " not baked: " << report.sourceKeys << " keys, error " << report.maxError
+						<< " at " << bakeAnimationRate * 16.0f << " keys/s" << std::endl;
+					continue;
+				}
+				mesh.weightsTime.swap(times);
+				mesh.weightsData.swap(values);
+				mesh.interpolation = AnimationTrack::LINEAR;
+				mesh.weightsRate = report.rate;
+				mesh.currentIndex = 0;
+				std::cerr << "Baked weight animation of node " << mesh.node << ": " << report.sourceKeys << " keys (" << report.sourceBytes << " bytes) -> "
+					<< report.bakedKeys << " keys at " << report.rate << " keys/s (" << report.bakedBytes << " bytes), max error " << report.maxError
+					<< ", " << report.sourceNsPerSample << " -> " << report.bakedNsPerSample << " ns per sample" << std::endl;
+			}
+		}
+
+		/*
+			Reduce and quantize the weight animation of every morph mesh with compressAnimationTolerance, called by the
+			loaders after bakeAnimations (the model cache keeps the glTF keys). Reports the compression of every track
+		*/
+		void compressAnimations()
+		{
+			if (!(compressAnimationTolerance > 0.0f)) {
+				return;
+			}
+			std::vector<float> times;
+			for (Mesh &mesh : meshesMorph) {
+				if (!mesh.weightsQuantized.empty() || mesh.weightsTime.empty()) {
+					continue;
+				}
+				AnimationCompression::Report report;
+				AnimationCompression::compress(mesh.weightTrack(), compressAnimationTolerance, times, mesh.weightsQuantized, mesh.weightsOffset, mesh.weightsScale, report);
+				mesh.weightsTime.swap(times);
+				std::vector<float>().swap(mesh.weightsData);
+				mesh.weightsRate = (report.keys == report.sourceKeys) ? mesh.weightsRate : 0.0f;
+				mesh.currentIndex = 0;
+				std::cerr << "Compressed weight animation of node " << mesh.node << ": " << report.sourceKeys << " keys (" << report.sourceBytes << " bytes) -> "
+					<< report.keys << " keys (" << report.compressedBytes << " bytes), ratio " << report.ratio() << ", max error " << report.maxError
+					<< ", " << report.sourceNsPerSample << " -> " << report.nsPerSample << " ns per sample" << std::endl;
+			}
+		}
+
+		/*
+			Runs fn(job) for every job on up to threadCount threads, the largest primitives first so one big
+			mesh picked up last does not keep the other threads waiting
+		*/
+		template <typename Fn>
+		static void forEachJob(std::vector<PrimitiveJob> &jobs, uint32_t threadCount, Fn fn)
+		{
+			threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, jobs.size()));
+			if (threadCount <= 1) {
+				for (PrimitiveJob &job : jobs) {
+					fn(job);
+				}
+				return;
+			}
+			std::vector<size_t> order(jobs.size());
+			for (size_t i = 0; i < order.size(); i++) {
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+				return static_cast<uint64_t>(jobs[a].vertexCount) * (jobs[a].morphPushConst.vertexStride + 1) > static_cast<uint64_t>(jobs[b].vertexCount) * (jobs[b].morphPushConst.vertexStride + 1);
+			});
+			std::atomic<size_t> next(0);
+			std::vector<std::thread> threads;
+			for (uint32_t t = 0; t < threadCount; t++) {
+				threads.push_back(std::thread([&]() {
+					for (size_t i = next++; i < order.size(); i = next++) {
+						fn(jobs[order[i]]);
+					}
+				}));
+			}
+			for (auto &thread : threads) {
+				thread.join();
+			}
+		}
+
+		/*
+			First pass of a load: plan all nodes of the default scene and measure their packed data
+			Fixes the output range of every primitive and sets the byte size of every output in packed
+		*/
+		void sizeScene(const tinygltf::Model &gltfModel, float scale, ScenePlan &plan, PackedScene &packed)
+		{
+		//	loadImages(gltfModel, device);
+		//	loadMaterials(gltfModel, device, transferQueue);
+			const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene];
+			plan.meshEntries.assign(gltfModel.meshes.size(), -1);
+			for (size_t i = 0; i < scene.nodes.size(); i++) {
+				const tinygltf::Node &node = gltfModel.nodes[scene.nodes[i]];
+				loadNode(node, scene.nodes[i], -1, gltfModel, scale, plan);
+			}
+			std::vector<PrimitiveJob> &jobs = plan.jobs;
+
+			// Output ranges of every primitive in scene order, so the packed data does not depend on which thread packs what
+			size_t vertexCounts[2] = { 0, 0 };
+			size_t indexCounts[2] = { 0, 0 };
+			for (PrimitiveJob &job : jobs) {
+				job.vertexStart = static_cast<uint32_t>(vertexCounts[job.isMorphTarget]);
+				job.firstIndex = static_cast<uint32_t>(indexCounts[job.isMorphTarget]);
+				vertexCounts[job.isMorphTarget] += job.vertexCount;
+				indexCounts[job.isMorphTarget] += job.indexCount;
+			}
+
+			forEachJob(jobs, loadThreadCount(), [&](PrimitiveJob &job) {
+				if (job.isMorphTarget) {
+					measureMorphData(job, gltfModel, scale);
+				}
+			});
+
+			// Every morph block starts vec4 aligned
+			size_t morphDataSize = 0;
+			for (PrimitiveJob &job : jobs) {
+				if (job.isMorphTarget) {
+					job.morphBlockStart = alignedSize(morphDataSize, 4);
+					morphDataSize = job.morphBlockStart + job.morphDataSize;
+				}
+			}
+
+			packed.verticesNormal.size = vertexCounts[0] * sizeof(Vertex);
+			packed.verticesMorph.size = vertexCounts[1] * sizeof(Vertex);
+			packed.indicesNormal.size = indexCounts[0] * sizeof(uint32_t);
+			packed.indicesMorph.size = indexCounts[1] * sizeof(uint32_t);
+			packed.morphData.size = morphDataSize * sizeof(float);
+		}
+
+		uint32_t loadThreadCount() const
+		{
+			return (loadThreads > 0) ? loadThreads : std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		/*
+			Point the outputs of a sized load at the memory they are written to
+			With a device every output is a range of mapped staging memory from device->uploadManager (in its current batch,
+			so nothing may submit it before uploadBuffers recorded the copies). The morph deltas and base vertices are
+			written to morphVertexData and morphBaseVertices instead if the model keeps them (keepHostData or no device)
+		*/
+		void preparePackedScene(PackedScene &packed, vks::VulkanDevice *device)
+		{
+			if (keepHostData || device == nullptr) {
+				morphBaseVertices.assign(packed.verticesMorph.size / sizeof(Vertex), Vertex{});
+				packed.verticesMorph.data = morphBaseVertices.data();
+				morphVertexData.assign(packed.morphData.size / sizeof(float), 0.0f);
+				packed.morphData.data = morphVertexData.data();
+			} else {
+				std::vector<Vertex>().swap(morphBaseVertices);
+				std::vector<float>().swap(morphVertexData);
+			}
+			if (device == nullptr) {
+				packed.hostVerticesNormal.resize(packed.verticesNormal.size / sizeof(Vertex));
+				packed.verticesNormal.data = packed.hostVerticesNormal.data();
+				packed.hostIndicesMorph.resize(packed.indicesMorph.size / sizeof(uint32_t));
+				packed.indicesMorph.data = packed.hostIndicesMorph.data();
+				packed.hostIndicesNormal.resize(packed.indicesNormal.size / sizeof(uint32_t));
+				packed.indicesNormal.data = packed.hostIndicesNormal.data();
+				return;
+			}
 
-				// Create device local buffers
-				// Vertex buffer Morph
+			PackedBuffer *outputs[] = { &packed.verticesMorph, &packed.indicesMorph, &packed.verticesNormal, &packed.indicesNormal, &packed.morphData };
+			for (PackedBuffer *output : outputs) {
+				if (output->data == nullptr && output->size > 0) {
+					output->staging = device->uploadManager.stage(output->size);
+					output->data = output->staging.mapped;
+					output->staged = true;
+				}
+			}
+		}
+
+		/*
+			Second pass of a load: pack the sized scene into the outputs and set up the meshes
+			Every byte of the outputs is written, staging memory does not need to be cleared first
+		*/
+		void packScene(const tinygltf::Model &gltfModel, float scale, ScenePlan &plan, const PackedScene &packed)
+		{
+			std::vector<PrimitiveJob> &jobs = plan.jobs;
+			Vertex *verticesMorphData = static_cast<Vertex*>(packed.verticesMorph.data);
+			uint32_t *indicesMorphData = static_cast<uint32_t*>(packed.indicesMorph.data);
+			Vertex *verticesNormalData = static_cast<Vertex*>(packed.verticesNormal.data);
+			uint32_t *indicesNormalData = static_cast<uint32_t*>(packed.indicesNormal.data);
+			float *morphData = static_cast<float*>(packed.morphData.data);
+
+			// packPrimitive clears its own morph block, only the alignment gaps between the blocks are left
+			size_t morphDataEnd = 0;
+			for (const PrimitiveJob &job : jobs) {
+				if (job.isMorphTarget) {
+					memset(&morphData[morphDataEnd], 0, (job.morphBlockStart - morphDataEnd) * sizeof(float));
+					morphDataEnd = job.morphBlockStart + job.morphDataSize;
+				}
+			}
+			if (morphData != nullptr) {
+				memset(&morphData[morphDataEnd], 0, packed.morphData.size - morphDataEnd * sizeof(float));
+			}
+
+			forEachJob(jobs, loadThreadCount(), [&](PrimitiveJob &job) {
+				packPrimitive(job, gltfModel, job.isMorphTarget ? verticesMorphData : verticesNormalData,
+							  job.isMorphTarget ? indicesMorphData : indicesNormalData, morphData, scale);
+			});
+
+			// Mesh state in scene order, the last primitive of a mesh sets its push constants
+			for (PrimitiveJob &job : jobs) {
+				Mesh &mesh = job.isMorphTarget ? meshesMorph[job.meshIndex] : meshesNormal[job.meshIndex];
+				mesh.morphVertexOffset = job.vertexStart * sizeof(Vertex);
+				mesh.primitives[job.primitiveIndex].firstIndex = job.firstIndex;
+				if (!job.isMorphTarget) {
+					continue;
+				}
+				mesh.morphPushConst = job.morphPushConst;
+				mesh.morphPushConst.bufferOffset += static_cast<uint32_t>(job.morphBlockStart);
+				if (mesh.morphPushConst.quantized) {
+					mesh.quantizationError = job.quantizationError;
+					std::cerr << job.quantizationReport << std::endl;
+				}
+			}
+			for (const SharedMesh &shared : plan.sharedMeshes) {
+				std::vector<Mesh> &meshes = shared.isMorphTarget ? meshesMorph : meshesNormal;
+				Mesh &mesh = meshes[shared.meshIndex];
+				const Mesh &source = meshes[shared.sourceIndex];
+				const uint32_t weightOffset = mesh.morphPushConst.weightOffset;
+				// Primitive holds a reference, so copied element by element
+				for (const Primitive &primitive : source.primitives) {
+					mesh.primitives.push_back(primitive);
+				}
+				mesh.slotTargets = source.slotTargets;
+				mesh.morphVertexOffset = source.morphVertexOffset;
+				mesh.vertexCount = source.vertexCount;
+				mesh.morphPushConst = source.morphPushConst;
+				mesh.morphPushConst.weightOffset = weightOffset;
+				mesh.quantizationError = source.quantizationError;
+			}
+			updateNodeTransforms();
+			updateMorphWeights();
+		}
+
+		/*
+			Place the range of every morph mesh node in verticesBlended, nodes sharing a mesh blend it with their own weights
+			Returns the vertex count of verticesBlended
+		*/
+		size_t assignBlendedVertices()
+		{
+			size_t vertexCount = 0;
+			for (Mesh &mesh : meshesMorph) {
+				mesh.blendedVertex = static_cast<uint32_t>(vertexCount);
+				vertexCount += mesh.vertexCount;
+			}
+			return vertexCount;
+		}
+
+		/*
+			Create the device local vertex, index and morph target buffers and copy the packed outputs into them
+			Staged outputs are copied from where the loader wrote them, host outputs (keepHostData) are staged first
+			The copies are recorded into device->uploadManager and submitted together on transferQueue (a graphics queue, the
+			copies themselves run on the dedicated transfer queue if there is one) without waiting, see uploadTicket
+			With a null device only the host side copies are kept
+		*/
+		void uploadBuffers(const PackedScene &packed, vks::VulkanDevice *device, VkQueue transferQueue)
+		{
+			indicesMorph.count = static_cast<uint32_t>(packed.indicesMorph.size / sizeof(uint32_t));
+			indicesNormal.count = static_cast<uint32_t>(packed.indicesNormal.size / sizeof(uint32_t));
+			if (device == nullptr) {
+				return;
+			}
+
+			size_t vertexBufferSizeMorph = packed.verticesMorph.size;
+			size_t indexBufferSizeMorph = packed.indicesMorph.size;
+
+			size_t vertexBufferSizeNormal = packed.verticesNormal.size;
+			size_t indexBufferSizeNormal = packed.indicesNormal.size;
+
+			vks::UploadManager &uploads = device->uploadManager;
+			auto upload = [&](const PackedBuffer &output, VkBuffer dst, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+				if (output.staged) {
+					uploads.copyStaged(output.staging, dst, 0, output.size, dstStage, dstAccess);
+				} else {
+					uploads.uploadBuffer(dst, 0, output.data, output.size, dstStage, dstAccess);
+				}
+			};
+			const VkPipelineStageFlags vertexStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+			if ((vertexBufferSizeMorph > 0) && (indexBufferSizeMorph > 0)) {
+				// Vertex buffer Morph, also read as storage buffer by the compute blending
 				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 					vertexBufferSizeMorph,
 					&verticesMorph.buffer,
 					&verticesMorph.memory));
 
+				// Blended vertex buffer written by morph.comp
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					assignBlendedVertices() * sizeof(Vertex),
+					&verticesBlended.buffer,
+					&verticesBlended.memory));
+				verticesMorphSize = vertexBufferSizeMorph;
+
 				// Index buffer Morph
 				VK_CHECK_RESULT(device->createBuffer(
 					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 					indexBufferSizeMorph,
 					&indicesMorph.buffer,
-					&indicesMorph.memory))
-
-				// Copy from staging buffers
-				VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-				VkBufferCopy copyRegion = {};
+					&indicesMorph.memory));
 
-				copyRegion.size = vertexBufferSizeMorph;
-				vkCmdCopyBuffer(copyCmd, vertexStagingMorph.buffer, verticesMorph.buffer, 1, &copyRegion);
-
-				copyRegion.size = indexBufferSizeMorph;
-				vkCmdCopyBuffer(copyCmd, indexStagingMorph.buffer, indicesMorph.buffer, 1, &copyRegion);
-
-				device->flushCommandBuffer(copyCmd, transferQueue, true); // TODO Need to free compyCmd?
-
-				vkDestroyBuffer(device->logicalDevice, vertexStagingMorph.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, vertexStagingMorph.memory, nullptr);
-				vkDestroyBuffer(device->logicalDevice, indexStagingMorph.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, indexStagingMorph.memory, nullptr);
+				upload(packed.verticesMorph, verticesMorph.buffer, vertexStages, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+				upload(packed.indicesMorph, indicesMorph.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 			}
 
-			// TODO have one buffer allocated and make Normal and Morph buffers adjacent
+			// The device local buffers of both paths are sub-allocated from the same memory blocks (see VulkanMemoryAllocator.hpp)
 			if ((vertexBufferSizeNormal > 0) && (indexBufferSizeNormal > 0)) {
-
-				// Vertex data Normal
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					vertexBufferSizeNormal,
-					&vertexStagingNormal.buffer,
-					&vertexStagingNormal.memory,
-					vertexBufferNormal.data()));
-
-				// Index data Normal
-				VK_CHECK_RESULT(device->createBuffer(
-					VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-					indexBufferSizeNormal,
-					&indexStagingNormal.buffer,
-					&indexStagingNormal.memory,
-					indexBufferNormal.data()));
-
 				// Vertex buffer Normal
 				VK_CHECK_RESULT(device->createBuffer(
 					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
@@ -903,48 +2264,210 @@ namespace vkglTF
 					&indicesNormal.buffer,
 					&indicesNormal.memory));
 
-				// Normal copy
-				VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+				upload(packed.verticesNormal, verticesNormal.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+				upload(packed.indicesNormal, indicesNormal.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+			}
+
+			if (packed.morphData.size > 0) {
+				// Morph target deltas, read by morph.vert and the compute blending
+				VK_CHECK_RESULT(device->createBuffer(
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					packed.morphData.size,
+					&morphTargets.buffer,
+					&morphTargets.memory));
+				upload(packed.morphData, morphTargets.buffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+			}
+
+			// One submit for all buffers (and textures) of the model
+			uploadTicket = uploads.submit(transferQueue);
+		}
+
+		/*
+			Advance the weight animation of all morph meshes by deltaTime (in seconds) and update their push constant weights
+			playback sets the rate, direction and looping, it loops over animationMaxTime by default
+			This is the model's own playback (playback, Mesh::currentIndex and Mesh::weights), e.g. for MorphEvaluator.
+			To play the model several times at once use ModelInstance, which leaves the model untouched
+		*/
+		void updateAnimation(float deltaTime)
+		{
+			playback.duration = animationMaxTime;
+			playback.advance(deltaTime);
+			const float time = playback.clipTime();
+			for (auto& mesh: meshesMorph) {
+				sampleWeights(mesh, time, mesh.currentIndex, mesh.weights.data());
+			}
+			updateMorphWeights();
+		}
+
+		/*
+			Sample the weight animation of a mesh at time (in seconds) into weights, one per target
+			keyframe is the caller's cursor into weightsTime, any time can be sampled with it (see AnimationSampler)
+			Streamed animations never wait for their file, they hold a coarse preview until the keys of time are loaded
+		*/
+		static void sampleWeights(const Mesh &mesh, float time, uint32_t &keyframe, float *weights)
+		{
+			if (mesh.weightsStream) {
+				mesh.weightsStream->sample(time, keyframe, weights);
+				return;
+			}
+			AnimationSampler::sample(mesh.weightTrack(), time, keyframe, weights);
+		}
+
+		/*
+			Propagate the local node matrices down the hierarchy into nodeTransformData, call after changing a Node::matrix
+			The result has to be copied to the GPU like the weights, the vertex data does not change
+		*/
+		void updateNodeTransforms()
+		{
+			nodeTransformData.resize(nodes.size());
+			for (size_t i = 0; i < nodes.size(); i++) {
+				const Node &node = nodes[i];
+				nodeTransformData[i] = (node.parent >= 0) ? nodeTransformData[node.parent] * node.matrix : node.matrix;
+			}
+		}
 
-				VkBufferCopy copyRegion = {};
+		static float targetWeight(const Mesh &mesh, const float *weights, size_t weightCount, uint32_t slot)
+		{
+			uint32_t target = mesh.slotTargets[slot];
+			return (target < weightCount) ? weights[target] : 0.0f;
+		}
 
-				copyRegion.size = vertexBufferSizeNormal;
-				vkCmdCopyBuffer(copyCmd, vertexStagingNormal.buffer, verticesNormal.buffer, 1, &copyRegion);
+		/*
+			Pack the current weights of all morph meshes into morphWeightData
+		*/
+		void updateMorphWeights()
+		{
+			for (auto& mesh : meshesMorph) {
+				packWeights(mesh, mesh.weights.data(), mesh.weights.size(), &morphWeightData[mesh.morphPushConst.weightOffset]);
+			}
+		}
 
-				copyRegion.size = indexBufferSizeNormal;
-				vkCmdCopyBuffer(copyCmd, indexStagingNormal.buffer, indicesNormal.buffer, 1, &copyRegion);
+		/*
+			Pack the target weights of a mesh into its weight block (see morphWeightData)
+			Dense meshes get a compacted list of the slots with a non zero weight so the shader only loops over active targets
+		*/
+		static void packWeights(const Mesh &mesh, const float *weights, size_t weightCount, float *block)
+		{
+			const MorphPushConst &push = mesh.morphPushConst;
+			uint32_t header[4] = { 0, 0, 0, 0 };
+			float *entries = block + 4;
+			if (push.sparse) {
+				for (uint32_t slot = 0; slot < push.vertexStride; slot++) {
+					entries[slot] = targetWeight(mesh, weights, weightCount, slot);
+					if (entries[slot] != 0.0f) {
+						header[2]++;
+					}
+				}
+			} else {
+				uint32_t activeCount = 0;
+				for (uint32_t slot = 0; slot < push.vertexStride; slot++) {
+					if (slot == push.normalOffset) {
+						header[0] = activeCount;
+					}
+					if (slot == push.tangentOffset) {
+						header[1] = activeCount;
+					}
+					float weight = targetWeight(mesh, weights, weightCount, slot);
+					if (weight != 0.0f) {
+						memcpy(&entries[activeCount * 2], &slot, sizeof(uint32_t));
+						entries[activeCount * 2 + 1] = weight;
+						activeCount++;
+					}
+				}
+				// Segments that are empty or end the stride start after the last active slot
+				if (push.normalOffset >= push.vertexStride) {
+					header[0] = activeCount;
+				}
+				if (push.tangentOffset >= push.vertexStride) {
+					header[1] = activeCount;
+				}
+				header[2] = activeCount;
+			}
+			memcpy(block, header, sizeof(header));
+		}
 
-				device->flushCommandBuffer(copyCmd, transferQueue, true);
 
-				vkDestroyBuffer(device->logicalDevice, vertexStagingNormal.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, vertexStagingNormal.memory, nullptr);
-				vkDestroyBuffer(device->logicalDevice, indexStagingNormal.buffer, nullptr);
-				vkFreeMemory(device->logicalDevice, indexStagingNormal.memory, nullptr);
+		/*
+			Blend all morph meshes into verticesBlended with the bound morph.comp pipeline
+			Must be recorded outside of a render pass, before drawMorph(..., true) reads the result
+		*/
+		void dispatchMorph(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
+		{
+			const uint32_t workGroupSize = 64; // local_size_x in morph.comp
+
+			// Previous frame's draws may still read verticesBlended
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+			for (auto &mesh : meshesMorph) {
+				MorphComputePushConst pushConst;
+				pushConst.morph = mesh.morphPushConst;
+				pushConst.baseVertex = mesh.morphVertexOffset / sizeof(Vertex);
+				pushConst.vertexCount = mesh.vertexCount;
+				pushConst.blendedVertex = mesh.blendedVertex;
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MorphComputePushConst), &pushConst);
+				vkCmdDispatch(commandBuffer, (mesh.vertexCount + workGroupSize - 1) / workGroupSize, 1, 1);
 			}
+
+			VkBufferMemoryBarrier bufferBarrier{};
+			bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = verticesBlended.buffer;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
 		}
 
-		void drawMorph(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
+		/*
+			Draws instanceCount instances with one draw per primitive, morph.vert reads the weights of instance i at
+			i * morphWeightData.size() in the weight buffer (see ModelInstance::updateAll)
+			preBlended draws the output of dispatchMorph as plain vertices (normal.vert pipeline, node index as push constant), as it only holds one copy it is drawn once
+			meshPipelines has a pipeline per mesh in meshesMorph (see MorphPipelineVariants::meshPipelines), bound when it changes, null keeps the bound pipeline
+		*/
+		void drawMorph(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, bool preBlended = false, uint32_t instanceCount = 1, const VkPipeline *meshPipelines = nullptr)
 		{
+			VkPipeline boundPipeline = VK_NULL_HANDLE;
 			// TODO have a static and full draw call
-			for (auto mesh : meshesMorph) {
-				// need offset since index buffer will be zero'ed for each mesh
-				const VkDeviceSize offsets[1] = {mesh.morphVertexOffset};
-				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vkglTF::Mesh::morphPushConst), &mesh.morphPushConst);
-				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &verticesMorph.buffer, offsets);
+			for (size_t i = 0; i < meshesMorph.size(); i++) {
+				const Mesh &mesh = meshesMorph[i];
+				if (meshPipelines && !preBlended && meshPipelines[i] != boundPipeline) {
+					boundPipeline = meshPipelines[i];
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundPipeline);
+				}
+				if (preBlended) {
+					// Every node has its own blended range, even if it shares the mesh
+					const VkDeviceSize offsets[1] = { static_cast<VkDeviceSize>(mesh.blendedVertex) * sizeof(Vertex) };
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &mesh.node);
+					vkCmdBindVertexBuffers(commandBuffer, 0, 1, &verticesBlended.buffer, offsets);
+				} else {
+					// need offset since index buffer will be zero'ed for each mesh
+					const VkDeviceSize offsets[1] = {mesh.morphVertexOffset};
+					MorphDrawPushConst pushConst;
+					pushConst.morph = mesh.morphPushConst;
+					pushConst.instanceWeightStride = static_cast<uint32_t>(morphWeightData.size());
+					pushConst.node = mesh.node;
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MorphDrawPushConst), &pushConst);
+					vkCmdBindVertexBuffers(commandBuffer, 0, 1, &verticesMorph.buffer, offsets);
+				}
 				vkCmdBindIndexBuffer(commandBuffer, indicesMorph.buffer, 0, VK_INDEX_TYPE_UINT32);
-				for (auto primitive : mesh.primitives) {
-					vkCmdDrawIndexed(commandBuffer, primitive.indexCount, 1, primitive.firstIndex, 0, 0);
+				for (auto &primitive : mesh.primitives) {
+					vkCmdDrawIndexed(commandBuffer, primitive.indexCount, preBlended ? 1 : instanceCount, primitive.firstIndex, 0, 0);
 				}
 			}
 		}
 
-		void drawNormal(VkCommandBuffer commandBuffer)
+		/*
+			Draws the meshes without morph targets with normal.vert, which gets the node index as push constant
+		*/
+		void drawNormal(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
 		{
-			for (auto mesh : meshesNormal) {
+			for (auto &mesh : meshesNormal) {
 				const VkDeviceSize offsets[1] = {0};
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &mesh.node);
 				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &verticesNormal.buffer, offsets);
 				vkCmdBindIndexBuffer(commandBuffer, indicesNormal.buffer, 0, VK_INDEX_TYPE_UINT32);
-				for (auto primitive : mesh.primitives) {
+				for (auto &primitive : mesh.primitives) {
 					vkCmdDrawIndexed(commandBuffer, primitive.indexCount, 1, primitive.firstIndex, 0, 0);
 				}
 			}
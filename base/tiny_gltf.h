@@ -491,8 +491,8 @@ struct BufferView {
 };
 
 struct Accessor {
-  int bufferView;  // optional in spec but required here since sparse accessor
-                   // are not supported
+  int bufferView;  // optional in spec, -1 means all zeros (plus the sparse
+                   // substitution when `sparse.isSparse` is set)
   std::string name;
   size_t byteOffset;
   bool normalized;    // optinal.
@@ -504,7 +504,21 @@ struct Accessor {
   std::vector<double> minValues;  // optional
   std::vector<double> maxValues;  // optional
 
-  // TODO(syoyo): "sparse"
+  // Sparse storage. `count` elements of the accessor (at indices read from
+  // `indices`) are replaced by the values read from `values`.
+  struct {
+    int count;
+    bool isSparse;
+    struct {
+      int byteOffset;
+      int bufferView;
+      int componentType;  // UNSIGNED_BYTE, UNSIGNED_SHORT or UNSIGNED_INT
+    } indices;
+    struct {
+      int bufferView;
+      int byteOffset;
+    } values;
+  } sparse;
 
   ///
   /// Utility function to compute byteStride for a given bufferView object.
@@ -540,7 +554,17 @@ struct Accessor {
     return 0;
   }
 
-  Accessor() { bufferView = -1; }
+  Accessor() {
+    bufferView = -1;
+    byteOffset = 0;
+    sparse.count = 0;
+    sparse.isSparse = false;
+    sparse.indices.byteOffset = 0;
+    sparse.indices.bufferView = -1;
+    sparse.indices.componentType = 0;
+    sparse.values.bufferView = -1;
+    sparse.values.byteOffset = 0;
+  }
 };
 
 struct PerspectiveCamera {
@@ -734,7 +758,8 @@ class TinyGLTF {
 #pragma clang diagnostic ignored "-Wc++98-compat"
 #endif
 
-  TinyGLTF() : bin_data_(nullptr), bin_size_(0), is_binary_(false) {
+  TinyGLTF() : bin_data_(nullptr), bin_size_(0), is_binary_(false),
+               load_buffer_data_(true) {
   }
 
 #ifdef __clang__
@@ -780,6 +805,15 @@ class TinyGLTF {
                             const std::string &base_dir = "",
                             unsigned int check_sections = REQUIRE_ALL);
 
+  ///
+  /// When disabled, buffers stored in the GLB BIN chunk or in external files
+  /// are not copied into `Buffer::data` (it stays empty, `uri` is still set),
+  /// the caller reads them in place, e.g. from a memory mapping of the files.
+  /// Embedded data URIs are always decoded. Images stored in buffer views of
+  /// such buffers are not decoded either, only `Image::bufferView` is set.
+  ///
+  void SetLoadBufferData(bool load) { load_buffer_data_ = load; }
+
   ///
   /// Write glTF to file.
   ///
@@ -801,6 +835,7 @@ class TinyGLTF {
   const unsigned char *bin_data_;
   size_t bin_size_;
   bool is_binary_;
+  bool load_buffer_data_;
 };
 
 #ifdef __clang__
@@ -1703,7 +1738,8 @@ static bool ParseBuffer(Buffer *buffer, std::string *err,
                         const json &o, const std::string &basedir,
                         bool is_binary = false,
                         const unsigned char *bin_data = nullptr,
-                        size_t bin_size = 0) {
+                        size_t bin_size = 0,
+                        bool load_data = true) {
   double byteLength;
   if (!ParseNumberProperty(&byteLength, err, o, "byteLength", true, "Buffer")) {
     return false;
@@ -1712,6 +1748,10 @@ static bool ParseBuffer(Buffer *buffer, std::string *err,
   // In glTF 2.0, uri is not mandatory anymore
   std::string uri;
   ParseStringProperty(&uri, err, o, "uri", false, "Buffer");
+  // Keep external file names (e.g. to track the files a model depends on), data URIs would only duplicate the data
+  if (!IsDataURI(uri)) {
+    buffer->uri = uri;
+  }
 
   // having an empty uri for a non embedded image should not be valid
   if (!is_binary && uri.empty()) {
@@ -1731,7 +1771,15 @@ static bool ParseBuffer(Buffer *buffer, std::string *err,
   }
 
   size_t bytes = static_cast<size_t>(byteLength);
-  if (is_binary) {
+  if (!load_data && !IsDataURI(uri)) {
+    // The caller reads the BIN chunk or the external file in place
+    if (is_binary && uri.empty() && byteLength > bin_size) {
+      if (err) {
+        (*err) += "Invalid `byteLength' of binary chunk buffer.\n";
+      }
+      return false;
+    }
+  } else if (is_binary) {
     // Still binary glTF accepts external dataURI. First try external resources.
 
     if (!uri.empty()) {
@@ -1846,13 +1894,83 @@ static bool ParseBufferView(BufferView *bufferView, std::string *err,
   return true;
 }
 
+static bool ParseSparseAccessor(Accessor *accessor, std::string *err,
+                                const json &o) {
+  accessor->sparse.isSparse = true;
+
+  double count = 0.0;
+  if (!ParseNumberProperty(&count, err, o, "count", true, "SparseAccessor")) {
+    return false;
+  }
+
+  json::const_iterator indicesIt = o.find("indices");
+  json::const_iterator valuesIt = o.find("values");
+  if ((indicesIt == o.end()) || !indicesIt.value().is_object()) {
+    if (err) {
+      (*err) += "`indices` field is missing in accessor.sparse\n";
+    }
+    return false;
+  }
+  if ((valuesIt == o.end()) || !valuesIt.value().is_object()) {
+    if (err) {
+      (*err) += "`values` field is missing in accessor.sparse\n";
+    }
+    return false;
+  }
+
+  const json &indices_object = indicesIt.value();
+  const json &values_object = valuesIt.value();
+
+  double indices_buffer_view = -1.0, indices_byte_offset = 0.0,
+         component_type = 0.0;
+  if (!ParseNumberProperty(&indices_buffer_view, err, indices_object,
+                           "bufferView", true, "SparseAccessor")) {
+    return false;
+  }
+  ParseNumberProperty(&indices_byte_offset, err, indices_object, "byteOffset",
+                      false);
+  if (!ParseNumberProperty(&component_type, err, indices_object,
+                           "componentType", true, "SparseAccessor")) {
+    return false;
+  }
+
+  double values_buffer_view = -1.0, values_byte_offset = 0.0;
+  if (!ParseNumberProperty(&values_buffer_view, err, values_object,
+                           "bufferView", true, "SparseAccessor")) {
+    return false;
+  }
+  ParseNumberProperty(&values_byte_offset, err, values_object, "byteOffset",
+                      false);
+
+  int comp = static_cast<int>(component_type);
+  if (comp != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE &&
+      comp != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+      comp != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+    std::stringstream ss;
+    ss << "Invalid `componentType` in accessor.sparse.indices. Got " << comp
+       << "\n";
+    if (err) {
+      (*err) += ss.str();
+    }
+    return false;
+  }
+
+  accessor->sparse.count = static_cast<int>(count);
+  accessor->sparse.indices.bufferView = static_cast<int>(indices_buffer_view);
+  accessor->sparse.indices.byteOffset = static_cast<int>(indices_byte_offset);
+  accessor->sparse.indices.componentType = comp;
+  accessor->sparse.values.bufferView = static_cast<int>(values_buffer_view);
+  accessor->sparse.values.byteOffset = static_cast<int>(values_byte_offset);
+
+  return true;
+}
+
 static bool ParseAccessor(Accessor *accessor, std::string *err,
                           const json &o) {
+  // `bufferView` is optional, without it the accessor is initialized with
+  // zeros (and then patched by `sparse` if present)
   double bufferView = -1.0;
-  if (!ParseNumberProperty(&bufferView, err, o, "bufferView", true,
-                           "Accessor")) {
-    return false;
-  }
+  ParseNumberProperty(&bufferView, err, o, "bufferView", false, "Accessor");
 
   double byteOffset = 0.0;
   ParseNumberProperty(&byteOffset, err, o, "byteOffset", false, "Accessor");
@@ -1929,6 +2047,13 @@ static bool ParseAccessor(Accessor *accessor, std::string *err,
     }
   }
 
+  json::const_iterator sparseIt = o.find("sparse");
+  if ((sparseIt != o.end()) && sparseIt.value().is_object()) {
+    if (!ParseSparseAccessor(accessor, err, sparseIt.value())) {
+      return false;
+    }
+  }
+
   ParseExtrasProperty(&(accessor->extras), o);
 
   return true;
@@ -2653,11 +2778,12 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, const char *str,
         }
         Buffer buffer;
         if (!ParseBuffer(&buffer, err, it->get<json>(), base_dir,
-                         is_binary_, bin_data_, bin_size_)) {
+                         is_binary_, bin_data_, bin_size_,
+                         load_buffer_data_)) {
           return false;
         }
 
-        model->buffers.push_back(buffer);
+        model->buffers.push_back(std::move(buffer));
       }
     }
   }
@@ -2873,7 +2999,10 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, const char *str,
               model->bufferViews[size_t(image.bufferView)];
           const Buffer &buffer = model->buffers[size_t(bufferView.buffer)];
 
-          bool ret = LoadImageData(&image, err, image.width, image.height,
+          // Buffer data not loaded (see SetLoadBufferData), the caller decodes
+          // the image from the buffer view itself
+          bool ret = buffer.data.empty() ||
+                     LoadImageData(&image, err, image.width, image.height,
                                    &buffer.data[bufferView.byteOffset],
                                    static_cast<int>(bufferView.byteLength));
           if (!ret) {
@@ -3300,7 +3429,8 @@ static void SerializeParameterMap(ParameterMap &param, json &o) {
 }
 
 static void SerializeGltfAccessor(Accessor &accessor, json &o) {
-  SerializeNumberProperty<int>("bufferView", accessor.bufferView, o);
+  if (accessor.bufferView >= 0)
+    SerializeNumberProperty<int>("bufferView", accessor.bufferView, o);
 
   if (accessor.byteOffset != 0.0)
     SerializeNumberProperty<int>("byteOffset", int(accessor.byteOffset), o);
@@ -3335,6 +3465,21 @@ static void SerializeGltfAccessor(Accessor &accessor, json &o) {
   }
 
   SerializeStringProperty("type", type, o);
+
+  if (accessor.sparse.isSparse) {
+    json sparse, indices, values;
+    SerializeNumberProperty<int>("count", accessor.sparse.count, sparse);
+    SerializeNumberProperty<int>("bufferView", accessor.sparse.indices.bufferView, indices);
+    if (accessor.sparse.indices.byteOffset != 0)
+      SerializeNumberProperty<int>("byteOffset", accessor.sparse.indices.byteOffset, indices);
+    SerializeNumberProperty<int>("componentType", accessor.sparse.indices.componentType, indices);
+    SerializeNumberProperty<int>("bufferView", accessor.sparse.values.bufferView, values);
+    if (accessor.sparse.values.byteOffset != 0)
+      SerializeNumberProperty<int>("byteOffset", accessor.sparse.values.byteOffset, values);
+    sparse["indices"] = indices;
+    sparse["values"] = values;
+    o["sparse"] = sparse;
+  }
 }
 
 static void SerializeGltfAnimationChannel(AnimationChannel &channel,
@@ -1,7 +1,7 @@
 #!/bin/bash
 DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
 
-declare -a shaders=("morph.vert" "morph.frag" "normal.vert" )
+declare -a shaders=("morph.vert" "morph.frag" "morph.comp" "normal.vert" )
 
 for i in "${shaders[@]}"
 do
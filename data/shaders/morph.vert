@@ -15,21 +15,94 @@ layout (binding = 0) uniform UBO
 	vec4 lightPos;
 } ubo;
 
-// Tried having the morphTargets.buf a vec3[], but there must be some inheirent padding issues not aware of
+// Every delta is padded to a vec4 by the loader (a vec3[] would get the same 16 byte std430 stride), one aligned load per delta
 layout(binding = 1) readonly buffer MorphTargets {
-   float buf[];
+   vec4 deltas[];
 } morphTargets;
 
-#define MAX_WEIGHTS 8
+// Same buffer read as uint, for the offsets of the per vertex delta lists and quantized normal/tangent deltas
+layout(binding = 1) readonly buffer MorphTargetWords {
+   uint words[];
+} morphWords;
+
+// and as uvec2 for quantized position deltas and list entries (see vkglTF::MorphQuantization)
+layout(binding = 1) readonly buffer MorphTargetPairs {
+   uvec2 pairs[];
+} morphPairs;
+
+// and as uvec4 for the [slot, x, y, z] list entries, so the slot bits are never touched as a float
+layout(binding = 1) readonly buffer MorphTargetEntries {
+   uvec4 entries[];
+} morphEntries;
+
+// Weights written by the CPU every frame, see vkglTF::Model::updateMorphWeights() and updateInstances()
+// [normalStart, tangentStart, activeCount, 0] then [slot, weight] pairs of the active slots, or one weight per slot if sparse
+// One block per instance, instanceWeightStride floats apart
+layout(binding = 2) readonly buffer MorphWeights {
+   float weights[];
+} morphWeights;
+
+layout(binding = 2) readonly buffer MorphActiveSlots {
+   uint data[];
+} morphActive;
+
+// Transform of every instance, vkglTF::Model::instanceTransformData
+layout(binding = 3) readonly buffer Instances {
+   mat4 transforms[];
+} instances;
+
+// World matrix of every glTF node, vkglTF::Model::nodeTransformData (the vertices are in mesh space)
+layout(binding = 4) readonly buffer Nodes {
+   mat4 transforms[];
+} nodes;
 
 layout(push_constant) uniform PushConsts {
     uint  bufferOffset;
 	uint  normalOffset;
 	uint  tangentOffset;
 	uint  vertexStride;
-	float weights[MAX_WEIGHTS];
+	uint  sparse;
+	uint  weightOffset;
+	uint  quantized;
+	uint  instanceWeightStride;
+	uint  node;
 } push;
 
+// Pipeline variant of a mesh layout, see vkglTF::MorphPipelineVariants
+// The generic variant (SPECIALIZED false) reads the layout from the push constants, a specialized one has it as constants
+// so the slot loops have a constant trip count and unroll, and the branches on sparse/quantized are gone
+layout (constant_id = 0) const bool SPECIALIZED = false;
+layout (constant_id = 1) const uint POSITION_SLOTS = 0;
+layout (constant_id = 2) const uint NORMAL_SLOTS = 0;
+layout (constant_id = 3) const uint TANGENT_SLOTS = 0;
+layout (constant_id = 4) const bool SPARSE = false;
+layout (constant_id = 5) const bool QUANTIZED = false;
+
+uint normalOffset()
+{
+    return SPECIALIZED ? POSITION_SLOTS : push.normalOffset;
+}
+
+uint tangentOffset()
+{
+    return SPECIALIZED ? POSITION_SLOTS + NORMAL_SLOTS : push.tangentOffset;
+}
+
+uint vertexStride()
+{
+    return SPECIALIZED ? POSITION_SLOTS + NORMAL_SLOTS + TANGENT_SLOTS : push.vertexStride;
+}
+
+bool sparse()
+{
+    return SPECIALIZED ? SPARSE : push.sparse != 0;
+}
+
+bool quantized()
+{
+    return SPECIALIZED ? QUANTIZED : push.quantized != 0;
+}
+
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outLightVec;
 layout (location = 2) out vec3 outViewVec;
@@ -39,40 +112,106 @@ out gl_PerVertex
 	vec4 gl_Position;
 };
 
-uint pIndex;
-void main()
+// Range of a quantized slot, stored right before the mesh data
+vec3 slotRange(uint slot)
 {
-    vec3 morphPos = inPos;
-    uint vertexOffset = (push.vertexStride * gl_VertexIndex * 3);
+    return morphTargets.deltas[(push.bufferOffset / 4) - vertexStride() + slot].xyz;
+}
 
-    for (uint i = 0, pIndex = 0; i < push.normalOffset; i++, pIndex++) {
-        morphPos += vec3(morphTargets.buf[(vertexOffset + (i * 3) + 0) + push.bufferOffset],
-                         morphTargets.buf[(vertexOffset + (i * 3) + 1) + push.bufferOffset],
-                         morphTargets.buf[(vertexOffset + (i * 3) + 2) + push.bufferOffset])
-                         * push.weights[pIndex];
+// Weighted delta of one [slot, weight] entry of the active list
+vec3 activeDelta(uint vertex, uint entry)
+{
+    uint slot = morphActive.data[entry];
+    float weight = morphWeights.weights[entry + 1];
+    if (!quantized()) {
+        return morphTargets.deltas[(push.bufferOffset / 4) + (vertexStride() * vertex) + slot].xyz * weight;
     }
 
-    vec3 morphNormal = inNormal;
-    for (uint i = push.normalOffset, pIndex = 0; i < push.tangentOffset; i++, pIndex++) {
-        morphNormal += vec3(morphTargets.buf[(vertexOffset + (i * 3) + 0) + push.bufferOffset],
-                            morphTargets.buf[(vertexOffset + (i * 3) + 1) + push.bufferOffset],
-                            morphTargets.buf[(vertexOffset + (i * 3) + 2) + push.bufferOffset])
-                          * push.weights[pIndex];
+    // Positions are 3 x snorm16, normals and tangents 3 x snorm8, each vertex padded to an even word count
+    uint vertexWord = push.bufferOffset + vertex * ((normalOffset() * 2 + (vertexStride() - normalOffset()) + 1) & ~1u);
+    vec3 delta;
+    if (slot < normalOffset()) {
+        uvec2 q = morphPairs.pairs[(vertexWord / 2) + slot];
+        delta = vec3(unpackSnorm2x16(q.x), unpackSnorm2x16(q.y).x);
+    } else {
+        delta = unpackSnorm4x8(morphWords.words[vertexWord + normalOffset() + slot]).xyz;
     }
+    return delta * slotRange(slot) * weight;
+}
+
+// Slot of the list entry starting at word e, [slot, x, y, z] or [slot | snorm16 x, snorm16 y | snorm16 z] if quantized
+uint listSlot(uint e)
+{
+    return quantized() ? (morphWords.words[e] & 0xffffu) : morphWords.words[e];
+}
+
+// Delta of the list entry starting at word e
+vec3 listDelta(uint e, uint slot)
+{
+    if (!quantized()) {
+        return uintBitsToFloat(morphEntries.entries[e / 4].yzw);
+    }
+    uvec2 q = morphPairs.pairs[e / 2];
+    return vec3(unpackSnorm2x16(q.x).y, unpackSnorm2x16(q.y)) * slotRange(slot);
+}
+
+void main()
+{
+    vec3 morphPos = inPos;
+    vec3 morphNormal = inNormal;
+    // Tangent deltas are skipped, nothing reads a morphed tangent yet (they only count in the slot layout)
+
+    uint weightOffset = push.weightOffset + gl_InstanceIndex * push.instanceWeightStride;
+    if (sparse()) {
+        // Only the deltas touching this vertex, as [slot, x, y, z] entries
+        // Entries of slots without a weight this frame are dropped on their slot word before the delta is fetched,
+        // and the lists are not walked at all while no slot of the mesh is active
+        uint slotWeights = weightOffset + 4;
+        uint activeCount = morphActive.data[weightOffset + 2];
+        uint listStart = morphWords.words[push.bufferOffset + gl_VertexIndex] + push.bufferOffset;
+        uint listEnd = (activeCount > 0) ? morphWords.words[push.bufferOffset + gl_VertexIndex + 1] + push.bufferOffset : listStart;
+        uint entryWords = quantized() ? 2 : 4;
+        for (uint e = listStart; e < listEnd; e += entryWords) {
+            uint slot = listSlot(e);
+            float weight = morphWeights.weights[slotWeights + slot];
+            if (weight == 0.0 || slot >= tangentOffset()) {
+                continue;
+            }
+            vec3 delta = listDelta(e, slot) * weight;
+            if (slot < normalOffset()) {
+                morphPos += delta;
+            } else {
+                morphNormal += delta;
+            }
+        }
+    } else {
+        // Only the targets with a non zero weight this frame, same for every vertex of the draw
+        // The active list is ordered by slot, so at most normalOffset() position and tangentOffset() - normalOffset() normal entries
+        uint normalStart = morphActive.data[weightOffset];
+        uint tangentStart = morphActive.data[weightOffset + 1];
+        uint activeList = weightOffset + 4;
+
+        for (uint k = 0; k < normalOffset(); k++) {
+            if (k >= normalStart) {
+                break;
+            }
+            morphPos += activeDelta(gl_VertexIndex, activeList + k * 2);
+        }
 
-    // unused at the moment
-    vec3 morphTagent = inTangent;
-    for (uint i = push.tangentOffset, pIndex = 0; i < push.vertexStride; i++, pIndex++) {
-        morphTagent += vec3(morphTargets.buf[(vertexOffset + (i * 3) + 0) + push.bufferOffset],
-                            morphTargets.buf[(vertexOffset + (i * 3) + 1) + push.bufferOffset],
-                            morphTargets.buf[(vertexOffset + (i * 3) + 2) + push.bufferOffset])
-                          * push.weights[pIndex];
+        for (uint k = 0; k < tangentOffset() - normalOffset(); k++) {
+            if (normalStart + k >= tangentStart) {
+                break;
+            }
+            morphNormal += activeDelta(gl_VertexIndex, activeList + (normalStart + k) * 2);
+        }
     }
 
-	gl_Position = ubo.MVP * vec4(morphPos, 1.0);
+    mat4 instance = instances.transforms[gl_InstanceIndex] * nodes.transforms[push.node];
+	gl_Position = ubo.MVP * instance * vec4(morphPos, 1.0);
 
-    vec4 pos = ubo.model * vec4(inPos, 1.0);
-    outNormal = mat3(inverse(transpose(ubo.model))) * morphNormal;
+    mat4 model = ubo.model * instance;
+    vec4 pos = model * vec4(inPos, 1.0);
+    outNormal = mat3(inverse(transpose(model))) * morphNormal;
     vec3 lPos = mat3(ubo.model) * ubo.lightPos.xyz;
     outLightVec = lPos - pos.xyz;
     outViewVec = ubo.camera.xyz - pos.xyz;
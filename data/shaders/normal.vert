@@ -15,6 +15,15 @@ layout (binding = 0) uniform UBO
 	vec4 lightPos;
 } ubo;
 
+// World matrix of every glTF node, vkglTF::Model::nodeTransformData (the vertices are in mesh space)
+layout(binding = 1) readonly buffer Nodes {
+   mat4 transforms[];
+} nodes;
+
+layout(push_constant) uniform PushConsts {
+	uint  node;
+} push;
+
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outLightVec;
 layout (location = 2) out vec3 outViewVec;
@@ -26,10 +35,12 @@ out gl_PerVertex
 
 void main()
 {
-	gl_Position = ubo.MVP * vec4(inPos, 1.0);
+	mat4 node = nodes.transforms[push.node];
+	gl_Position = ubo.MVP * node * vec4(inPos, 1.0);
 
-    vec4 pos = ubo.model * vec4(inPos, 1.0);
-    outNormal = mat3(inverse(transpose(ubo.model))) * inNormal;
+    mat4 model = ubo.model * node;
+    vec4 pos = model * vec4(inPos, 1.0);
+    outNormal = mat3(inverse(transpose(model))) * inNormal;
     vec3 lPos = mat3(ubo.model) * ubo.lightPos.xyz;
     outLightVec = lPos - pos.xyz;
     outViewVec = ubo.camera.xyz - pos.xyz;
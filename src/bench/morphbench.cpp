@@ -0,0 +1,1032 @@
+/*
+* Morph target benchmark
+*
+* Times the glTF loader (vkglTF::Model::loadNode), the weight animation (vkglTF::Model::updateAnimation) and
+* the CPU morph blending (vkglTF::MorphEvaluator) without a window or GPU
+* With --frames-in-flight it also runs the frame loop of the example on a headless Vulkan device
+* Inputs are the bundled models and generated meshes, results are written as JSON or CSV to track regressions
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "VulkanglTFModel.hpp"
+#include "MorphEvaluator.hpp"
+#include "ModelInstance.hpp"
+
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#include "tiny_gltf.h"
+
+#if defined(VK_EXAMPLE_DATA_DIR)
+static const std::string defaultDataDir = VK_EXAMPLE_DATA_DIR;
+#else
+static const std::string defaultDataDir = "./../data/";
+#endif
+
+static const char *bundledModels[] = {
+	"models/AnimatedMorphCube/glTF/AnimatedMorphCube.gltf",
+	"models/AnimatedMorphSphere/glTF/AnimatedMorphSphere.gltf",
+	"models/AnimatedMorphCube/glTF-Binary/AnimatedMorphCube.glb",
+	"models/AnimatedMorphSphere/glTF-Binary/AnimatedMorphSphere.glb",
+	"models/fourCube/fourCube.gltf",
+	"models/threeCube/threeCube.gltf",
+	"models/twoCube/twoCube.gltf",
+	"models/twoCube/twoCubeLinear.gltf",
+	"models/twoCubeMorph/twoCubeMorph.gltf",
+	"models/heart/scene.gltf",
+};
+
+/*
+	Headless Vulkan device for the frames in flight stage, only created if --frames-in-flight is given
+*/
+struct GpuContext {
+	VkInstance instance = VK_NULL_HANDLE;
+	vks::VulkanDevice *device = nullptr;
+	VkQueue queue = VK_NULL_HANDLE;
+
+	bool create()
+	{
+		VkApplicationInfo appInfo{};
+		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName = "morph-bench";
+		appInfo.apiVersion = VK_API_VERSION_1_0;
+		VkInstanceCreateInfo instanceCI{};
+		instanceCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		instanceCI.pApplicationInfo = &appInfo;
+		if (vkCreateInstance(&instanceCI, nullptr, &instance) != VK_SUCCESS) {
+			return false;
+		}
+		uint32_t count = 0;
+		vkEnumeratePhysicalDevices(instance, &count, nullptr);
+		if (count == 0) {
+			return false;
+		}
+		std::vector<VkPhysicalDevice> physicalDevices(count);
+		vkEnumeratePhysicalDevices(instance, &count, physicalDevices.data());
+		device = new vks::VulkanDevice(physicalDevices[0]);
+		if (device->createLogicalDevice(VkPhysicalDeviceFeatures{}, {}, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT) != VK_SUCCESS) {
+			return false;
+		}
+		vkGetDeviceQueue(device->logicalDevice, device->queueFamilyIndices.graphics, 0, &queue);
+		return true;
+	}
+
+	void destroy()
+	{
+		delete device;
+		device = nullptr;
+		if (instance != VK_NULL_HANDLE) {
+			vkDestroyInstance(instance, nullptr);
+			instance = VK_NULL_HANDLE;
+		}
+	}
+};
+
+struct Settings {
+	std::string format = "json";
+	std::string output;
+	std::string dataDir = defaultDataDir;
+	uint32_t iterations = 5;
+	std::vector<uint32_t> vertexCounts = { 10000, 100000, 1000000, 5000000 };
+	std::vector<uint32_t> targetCounts = { 1, 8, 64, 256 };
+	uint32_t keyframes = 120;
+	std::string interpolation = "LINEAR";
+	float bakeRate = 0.0f;
+	float compressTolerance = 0.0f;
+	float coverage = 1.0f;
+	float active = 1.0f;
+	bool quantize = false;
+	uint32_t meshes = 1;
+	uint32_t loadThreads = 1;
+	uint32_t instances = 1000;
+	uint32_t animationThreads = 1;
+	std::string cacheDir;
+	std::string streamDir;
+	uint64_t maxMorphBytes = 1024ull * 1024ull * 1024ull;
+	bool assets = true;
+	bool synthetic = true;
+	std::vector<uint32_t> framesInFlight;
+	uint32_t frames = 500;
+	GpuContext *gpu = nullptr;
+};
+
+/*
+	One line of output, fields that do not apply to a stage are negative and written as empty/null
+*/
+struct Result {
+	std::string input;
+	std::string kind;
+	std::string stage;
+	std::string kernel;
+	uint64_t vertices = 0;
+	uint64_t targets = 0;
+	uint64_t keyframes = 0;
+	uint32_t iterations = 0;
+	double medianNs = 0.0;
+	double nsPerVertex = -1.0;
+	double nsPerTarget = -1.0;
+	double nsPerKeyframe = -1.0;
+};
+
+/*
+	Runs func iterations times (after one warm up run) and returns the median time in nanoseconds
+*/
+template<typename Func>
+static double medianNs(uint32_t iterations, Func func)
+{
+	func();
+	std::vector<double> times;
+	for (uint32_t i = 0; i < iterations; i++) {
+		auto tStart = std::chrono::high_resolution_clock::now();
+		func();
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		times.push_back(std::chrono::duration<double, std::nano>(tEnd - tStart).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+/*
+	Small LCG so generated meshes are identical on every platform and run
+*/
+struct Random {
+	uint32_t state;
+	explicit Random(uint32_t seed) : state(seed) {}
+	float next(float min, float max)
+	{
+		state = state * 1664525u + 1013904223u;
+		return min + (max - min) * (static_cast<float>(state >> 8) / 16777216.0f);
+	}
+};
+
+static int addAccessor(tinygltf::Model &model, const void *data, size_t byteLength, int componentType, int type, size_t count)
+{
+	tinygltf::Buffer &buffer = model.buffers[0];
+	// keep every view 4 byte aligned
+	buffer.data.resize((buffer.data.size() + 3) & ~size_t(3));
+	tinygltf::BufferView view;
+	view.buffer = 0;
+	view.byteOffset = buffer.data.size();
+	view.byteLength = byteLength;
+	buffer.data.insert(buffer.data.end(), static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + byteLength);
+	model.bufferViews.push_back(view);
+
+	tinygltf::Accessor accessor;
+	accessor.bufferView = static_cast<int>(model.bufferViews.size() - 1);
+	accessor.byteOffset = 0;
+	accessor.normalized = false;
+	accessor.componentType = componentType;
+	accessor.type = type;
+	accessor.count = count;
+	model.accessors.push_back(accessor);
+	return static_cast<int>(model.accessors.size() - 1);
+}
+
+/*
+	Sparse accessor without a base buffer view, only the vertices in indices are non zero
+*/
+static int addSparseAccessor(tinygltf::Model &model, const std::vector<uint32_t> &indices, const std::vector<float> &values, size_t count)
+{
+	int indexAccessor = addAccessor(model, indices.data(), indices.size() * sizeof(uint32_t), TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, TINYGLTF_TYPE_SCALAR, indices.size());
+	int valueAccessor = addAccessor(model, values.data(), values.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, indices.size());
+
+	tinygltf::Accessor accessor;
+	accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+	accessor.type = TINYGLTF_TYPE_VEC3;
+	accessor.normalized = false;
+	accessor.count = count;
+	accessor.sparse.isSparse = true;
+	accessor.sparse.count = static_cast<int>(indices.size());
+	accessor.sparse.indices.bufferView = model.accessors[indexAccessor].bufferView;
+	accessor.sparse.indices.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+	accessor.sparse.values.bufferView = model.accessors[valueAccessor].bufferView;
+	model.accessors.push_back(accessor);
+	return static_cast<int>(model.accessors.size() - 1);
+}
+
+/*
+	Generates a grid mesh with POSITION/NORMAL deltas for every target and a LINEAR weight animation
+	With coverage below 1 every target only moves that fraction of the vertices and is stored as sparse accessor
+	With active below 1 only that fraction of the targets gets non zero weights
+	With meshCount above 1 the vertices are split over that many meshes, each on its own node and animated by its own channel
+*/
+static void buildSyntheticModel(uint32_t vertexCount, uint32_t targetCount, uint32_t keyframeCount, const std::string &interpolation, float coverage, float active, uint32_t meshCount, tinygltf::Model &model)
+{
+	Random random(0x5eed1234u ^ (vertexCount * 31u + targetCount));
+	model.buffers.resize(1);
+	model.defaultScene = 0;
+	model.scenes.resize(1);
+	model.animations.resize(1);
+
+	for (uint32_t m = 0; m < meshCount; m++) {
+		const uint32_t meshVertexCount = std::max(1u, vertexCount / meshCount);
+		const uint32_t gridSize = static_cast<uint32_t>(ceil(sqrt(static_cast<double>(meshVertexCount))));
+		std::vector<float> positions(meshVertexCount * 3);
+		std::vector<float> normals(meshVertexCount * 3);
+		for (uint32_t v = 0; v < meshVertexCount; v++) {
+			positions[v * 3 + 0] = static_cast<float>(v % gridSize) / gridSize - 0.5f;
+			positions[v * 3 + 1] = static_cast<float>(v / gridSize) / gridSize - 0.5f;
+			positions[v * 3 + 2] = random.next(-0.01f, 0.01f);
+			normals[v * 3 + 0] = 0.0f;
+			normals[v * 3 + 1] = 0.0f;
+			normals[v * 3 + 2] = 1.0f;
+		}
+
+		std::vector<uint32_t> indices;
+		for (uint32_t y = 0; y + 1 < gridSize; y++) {
+			for (uint32_t x = 0; x + 1 < gridSize; x++) {
+				uint32_t i0 = y * gridSize + x;
+				uint32_t i1 = i0 + 1;
+				uint32_t i2 = i0 + gridSize;
+				uint32_t i3 = i2 + 1;
+				if (i3 >= meshVertexCount) {
+					continue;
+				}
+				uint32_t quad[6] = { i0, i2, i1, i1, i2, i3 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+
+		tinygltf::Primitive primitive;
+		primitive.mode = TINYGLTF_MODE_TRIANGLES;
+		primitive.attributes["POSITION"] = addAccessor(model, positions.data(), positions.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, meshVertexCount);
+		primitive.attributes["NORMAL"] = addAccessor(model, normals.data(), normals.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, meshVertexCount);
+		primitive.indices = addAccessor(model, indices.data(), indices.size() * sizeof(uint32_t), TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, TINYGLTF_TYPE_SCALAR, indices.size());
+
+		std::vector<float> deltas(meshVertexCount * 3);
+		for (uint32_t t = 0; t < targetCount; t++) {
+			std::map<std::string, int> target;
+			if (coverage < 1.0f) {
+				// One contiguous region per target, like a blend shape touching part of a face
+				uint32_t regionSize = std::max(1u, static_cast<uint32_t>(meshVertexCount * coverage));
+				uint32_t regionStart = static_cast<uint32_t>(random.next(0.0f, 1.0f) * (meshVertexCount - regionSize));
+				std::vector<uint32_t> targetVertices(regionSize);
+				for (uint32_t i = 0; i < regionSize; i++) {
+					targetVertices[i] = regionStart + i;
+				}
+				deltas.resize(regionSize * 3);
+				for (auto &delta : deltas) {
+					delta = random.next(-0.1f, 0.1f);
+				}
+				target["POSITION"] = addSparseAccessor(model, targetVertices, deltas, meshVertexCount);
+				for (auto &delta : deltas) {
+					delta = random.next(-0.05f, 0.05f);
+				}
+				target["NORMAL"] = addSparseAccessor(model, targetVertices, deltas, meshVertexCount);
+				primitive.targets.push_back(target);
+				continue;
+			}
+			for (auto &delta : deltas) {
+				delta = random.next(-0.1f, 0.1f);
+			}
+			target["POSITION"] = addAccessor(model, deltas.data(), deltas.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, meshVertexCount);
+			for (auto &delta : deltas) {
+				delta = random.next(-0.05f, 0.05f);
+			}
+			target["NORMAL"] = addAccessor(model, deltas.data(), deltas.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, meshVertexCount);
+			primitive.targets.push_back(target);
+		}
+
+		tinygltf::Mesh mesh;
+		mesh.name = "synthetic";
+		mesh.primitives.push_back(primitive);
+		mesh.weights.resize(targetCount, 0.0);
+		model.meshes.push_back(mesh);
+
+		tinygltf::Node node;
+		node.mesh = static_cast<int>(m);
+		model.nodes.push_back(node);
+		model.scenes[0].nodes.push_back(static_cast<int>(m));
+
+		// one keyframe every 1/30 second, CUBICSPLINE keys are [in tangents, weights, out tangents]
+		const bool cubic = interpolation == "CUBICSPLINE";
+		const uint32_t valuesPerKey = cubic ? targetCount * 3 : targetCount;
+		std::vector<float> times(keyframeCount);
+		std::vector<float> weights(keyframeCount * valuesPerKey);
+		for (uint32_t k = 0; k < keyframeCount; k++) {
+			times[k] = k / 30.0f;
+		}
+		const uint32_t activeCount = std::max(1u, static_cast<uint32_t>(targetCount * active));
+		for (size_t i = 0; i < weights.size(); i++) {
+			const bool tangent = cubic && (i % valuesPerKey) / targetCount != 1;
+			weights[i] = (i % targetCount < activeCount) ? (tangent ? random.next(-1.0f, 1.0f) : random.next(0.0f, 1.0f)) : 0.0f;
+		}
+
+		tinygltf::AnimationSampler sampler;
+		sampler.input = addAccessor(model, times.data(), times.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_SCALAR, keyframeCount);
+		sampler.output = addAccessor(model, weights.data(), weights.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_SCALAR, weights.size());
+		sampler.interpolation = interpolation;
+
+		tinygltf::AnimationChannel channel;
+		channel.sampler = static_cast<int>(m);
+		channel.target_node = static_cast<int>(m);
+		channel.target_path = "weights";
+
+		model.animations[0].samplers.push_back(sampler);
+		model.animations[0].channels.push_back(channel);
+	}
+}
+
+static uint64_t countVertices(const vkglTF::Model &model)
+{
+	uint64_t count = 0;
+	for (auto &mesh : model.meshesMorph) {
+		count += mesh.vertexCount;
+	}
+	for (auto &mesh : model.meshesNormal) {
+		count += mesh.vertexCount;
+	}
+	return count;
+}
+
+static VkShaderModule loadShaderModule(VkDevice device, const std::string &filename)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		return VK_NULL_HANDLE;
+	}
+	std::vector<char> code(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(code.data(), code.size());
+	VkShaderModuleCreateInfo moduleCI{};
+	moduleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleCI.codeSize = code.size();
+	moduleCI.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	VkShaderModule module = VK_NULL_HANDLE;
+	vkCreateShaderModule(device, &moduleCI, nullptr, &module);
+	return module;
+}
+
+/*
+	The frame loop of the example without a window, for every count in --frames-in-flight:
+	each frame waits for the fence of its frame slot, animates the instances on the CPU (ModelInstance::updateAll), writes
+	the weights to the slot's region and submits the command buffer of that slot, recorded once, which blends the model
+	with morph.comp. With one frame in flight the CPU and the GPU take turns, with more the animation of the next frame
+	overlaps the GPU work of the previous ones
+	Frame times are measured start to start and reported as percentiles, like VulkanExampleBase prints them on exit
+*/
+static void benchFramesInFlight(const Result &base, tinygltf::Model &gltfModel, const Settings &settings, std::vector<Result> &results)
+{
+	vks::VulkanDevice *vulkanDevice = settings.gpu->device;
+	VkDevice device = vulkanDevice->logicalDevice;
+	vkglTF::Model model;
+	model.quantizeMorphDeltas = settings.quantize;
+	model.loadFromGltfModel(gltfModel, vulkanDevice, settings.gpu->queue);
+	vkDeviceWaitIdle(device);
+	VkShaderModule shader = loadShaderModule(device, settings.dataDir + "shaders/morph.comp.spv");
+	if (model.verticesBlended.buffer == VK_NULL_HANDLE || shader == VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, shader, nullptr);
+		model.destroy(vulkanDevice);
+		return;
+	}
+
+	std::vector<vkglTF::ModelInstance> instances;
+	const uint32_t instanceCount = std::max(settings.instances, 1u);
+	for (uint32_t i = 0; i < instanceCount; i++) {
+		instances.push_back(vkglTF::ModelInstance(model, glm::mat4(1.0f), model.animationMaxTime * i / instanceCount));
+	}
+	std::vector<float> weightData(instances.size() * model.morphWeightData.size());
+	std::vector<glm::mat4> transforms(instances.size());
+
+	// One weight region per frame slot, morph.comp blends the first instance
+	const uint32_t slotCount = *std::max_element(settings.framesInFlight.begin(), settings.framesInFlight.end());
+	const VkDeviceSize weightSize = std::max<size_t>(model.morphWeightData.size(), 1) * sizeof(float);
+	const VkDeviceSize alignment = std::max<VkDeviceSize>(vulkanDevice->properties.limits.minStorageBufferOffsetAlignment, 1);
+	const VkDeviceSize regionSize = (weightSize + alignment - 1) / alignment * alignment;
+	VkBuffer weightBuffer;
+	vks::Allocation weightMemory;
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		regionSize * slotCount, &weightBuffer, &weightMemory));
+
+	// Same bindings as the compute set of the example
+	VkDescriptorSetLayoutBinding bindings[4] = {
+		{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+	};
+	VkDescriptorSetLayoutCreateInfo setLayoutCI{};
+	setLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutCI.bindingCount = 4;
+	setLayoutCI.pBindings = bindings;
+	VkDescriptorSetLayout setLayout;
+	VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCI, nullptr, &setLayout));
+	VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(vkglTF::MorphComputePushConst) };
+	VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+	pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCI.setLayoutCount = 1;
+	pipelineLayoutCI.pSetLayouts = &setLayout;
+	pipelineLayoutCI.pushConstantRangeCount = 1;
+	pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+	VkPipelineLayout pipelineLayout;
+	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
+	VkComputePipelineCreateInfo pipelineCI{};
+	pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCI.layout = pipelineLayout;
+	pipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCI.stage.module = shader;
+	pipelineCI.stage.pName = "main";
+	VkPipeline pipeline;
+	VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+	vkDestroyShaderModule(device, shader, nullptr);
+
+	VkDescriptorPoolSize poolSizes[2] = { { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 } };
+	VkDescriptorPoolCreateInfo poolCI{};
+	poolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCI.maxSets = 1;
+	poolCI.poolSizeCount = 2;
+	poolCI.pPoolSizes = poolSizes;
+	VkDescriptorPool descriptorPool;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolCI, nullptr, &descriptorPool));
+	VkDescriptorSetAllocateInfo setAllocInfo{};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &setLayout;
+	VkDescriptorSet descriptorSet;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet));
+	const VkDescriptorBufferInfo bufferInfos[4] = {
+		{ model.verticesMorph.buffer, 0, VK_WHOLE_SIZE }, { model.morphTargets.buffer, 0, VK_WHOLE_SIZE },
+		{ weightBuffer, 0, weightSize }, { model.verticesBlended.buffer, 0, VK_WHOLE_SIZE }
+	};
+	VkWriteDescriptorSet writes[4] = {};
+	for (uint32_t i = 0; i < 4; i++) {
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = descriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = bindings[i].descriptorType;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+	vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+
+	// Recorded once per slot with the offset of its region, like the per image command buffers of the example
+	std::vector<VkCommandBuffer> commandBuffers(slotCount);
+	std::vector<VkFence> fences(slotCount);
+	for (uint32_t i = 0; i < slotCount; i++) {
+		commandBuffers[i] = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		const uint32_t offset = static_cast<uint32_t>(i * regionSize);
+		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 1, &offset);
+		model.dispatchMorph(commandBuffers[i], pipelineLayout);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffers[i]));
+		VkFenceCreateInfo fenceCI{};
+		fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCI.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCI, nullptr, &fences[i]));
+	}
+
+	const float deltaTime = 1.0f / 60.0f;
+	for (uint32_t framesInFlight : settings.framesInFlight) {
+		// The first frames fill the pipeline and are not counted
+		const uint32_t warmup = framesInFlight * 2;
+		std::vector<double> frameTimes;
+		auto previous = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < settings.frames + warmup; frame++) {
+			const uint32_t slot = frame % framesInFlight;
+			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fences[slot], VK_TRUE, UINT64_MAX));
+			VK_CHECK_RESULT(vkResetFences(device, 1, &fences[slot]));
+			vkglTF::ModelInstance::updateAll(instances, deltaTime, weightData.data(), transforms.data(), settings.animationThreads);
+			memcpy(static_cast<char*>(weightMemory.mapped) + slot * regionSize, weightData.data(), model.morphWeightData.size() * sizeof(float));
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &commandBuffers[slot];
+			VK_CHECK_RESULT(vkQueueSubmit(settings.gpu->queue, 1, &submitInfo, fences[slot]));
+			auto now = std::chrono::high_resolution_clock::now();
+			if (frame >= warmup) {
+				frameTimes.push_back(std::chrono::duration<double, std::nano>(now - previous).count());
+			}
+			previous = now;
+		}
+		vkDeviceWaitIdle(device);
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		const char *names[3] = { "p50", "p90", "p99" };
+		const float percentiles[3] = { 0.5f, 0.9f, 0.99f };
+		for (uint32_t i = 0; i < 3; i++) {
+			Result result = base;
+			result.stage = "frame_" + std::to_string(framesInFlight) + "_in_flight_" + names[i];
+			result.iterations = settings.frames;
+			result.medianNs = frameTimes[std::min(frameTimes.size() - 1, static_cast<size_t>(percentiles[i] * frameTimes.size()))];
+			results.push_back(result);
+		}
+	}
+
+	for (uint32_t i = 0; i < slotCount; i++) {
+		vkDestroyFence(device, fences[i], nullptr);
+	}
+	vkFreeCommandBuffers(device, vulkanDevice->commandPool, slotCount, commandBuffers.data());
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	vulkanDevice->destroyBuffer(weightBuffer, weightMemory);
+	model.destroy(vulkanDevice);
+}
+
+/*
+	Loader, animation and blend timings for one parsed glTF model
+*/
+static void benchModel(const std::string &input, const std::string &kind, tinygltf::Model &gltfModel, const Settings &settings, std::vector<Result> &results)
+{
+	vkglTF::Model model;
+	model.quantizeMorphDeltas = settings.quantize;
+	model.bakeAnimationRate = settings.bakeRate;
+	model.compressAnimationTolerance = settings.compressTolerance;
+	model.loadFromGltfModel(gltfModel, nullptr, VK_NULL_HANDLE);
+
+	uint64_t vertices = countVertices(model);
+	uint64_t targets = 0;
+	uint64_t keyframes = 0;
+	for (auto &mesh : model.meshesMorph) {
+		keyframes += mesh.weightKeyCount();
+	}
+	for (auto &mesh : gltfModel.meshes) {
+		targets = std::max<uint64_t>(targets, mesh.weights.size());
+	}
+
+	Result base;
+	base.input = input;
+	base.kind = kind;
+	base.vertices = vertices;
+	base.targets = targets;
+	base.keyframes = keyframes;
+	base.iterations = settings.iterations;
+
+	// Loader
+	{
+		Result result = base;
+		result.stage = "load";
+		result.medianNs = medianNs(settings.iterations, [&]() {
+			vkglTF::Model loaded;
+			loaded.quantizeMorphDeltas = settings.quantize;
+			loaded.loadThreads = settings.loadThreads;
+			loaded.bakeAnimationRate = settings.bakeRate;
+			loaded.compressAnimationTolerance = settings.compressTolerance;
+			loaded.loadFromGltfModel(gltfModel, nullptr, VK_NULL_HANDLE);
+		});
+		result.nsPerVertex = vertices ? result.medianNs / vertices : -1.0;
+		result.nsPerTarget = (vertices && targets) ? result.medianNs / (vertices * targets) : -1.0;
+		results.push_back(result);
+	}
+
+	// Weight animation, one full play through with four updates per keyframe
+	if (keyframes > 0 && model.animationMaxTime > 0.0f) {
+		const uint32_t steps = static_cast<uint32_t>(keyframes * 4);
+		const float deltaTime = model.animationMaxTime / steps;
+		Result result = base;
+		result.stage = "animate";
+		result.medianNs = medianNs(settings.iterations, [&]() {
+			model.playback.seek(0.0f);
+			for (auto &mesh : model.meshesMorph) {
+				mesh.currentIndex = 0;
+			}
+			for (uint32_t s = 0; s < steps; s++) {
+				model.updateAnimation(deltaTime);
+			}
+		});
+		result.nsPerTarget = targets ? result.medianNs / (steps * targets) : -1.0;
+		result.nsPerKeyframe = result.medianNs / keyframes;
+		results.push_back(result);
+	}
+
+	// Scrubbing, the same number of samples at random times along the clip, every one a jump for the keyframe cursor
+	if (keyframes > 0 && model.animationMaxTime > 0.0f) {
+		const uint32_t steps = static_cast<uint32_t>(keyframes * 4);
+		std::vector<float> times(steps);
+		uint32_t random = 1;
+		for (auto &time : times) {
+			random = random * 1664525u + 1013904223u;
+			time = model.animationMaxTime * static_cast<float>(random >> 8) / static_cast<float>(1u << 24);
+		}
+		std::vector<float> weights;
+		Result result = base;
+		result.stage = "scrub";
+		result.medianNs = medianNs(settings.iterations, [&]() {
+			for (auto &mesh : model.meshesMorph) {
+				weights.resize(mesh.weights.size());
+				uint32_t keyframe = 0;
+				for (float time : times) {
+					vkglTF::Model::sampleWeights(mesh, time, keyframe, weights.data());
+				}
+			}
+		});
+		result.nsPerTarget = targets ? result.medianNs / (steps * targets) : -1.0;
+		result.nsPerKeyframe = result.medianNs / keyframes;
+		results.push_back(result);
+	}
+
+	// Playback of the first mesh's animation streamed from a sidecar file (AnimationStream), one play through like animate
+	if (!settings.streamDir.empty() && !model.meshesMorph.empty() && !model.meshesMorph[0].weightsData.empty()) {
+		const vkglTF::AnimationTrack track = model.meshesMorph[0].weightTrack();
+		std::string sidecar = input;
+		std::replace(sidecar.begin(), sidecar.end(), '/', '_');
+		sidecar = settings.streamDir + sidecar + ".keys";
+		std::ofstream out(sidecar.c_str(), std::ios::binary | std::ios::trunc);
+		const size_t valueCount = static_cast<size_t>(track.keyCount) * track.valuesPerKey();
+		out.write(reinterpret_cast<const char*>(track.times), track.keyCount * sizeof(float));
+		out.write(reinterpret_cast<const char*>(track.values), valueCount * sizeof(float));
+		out.close();
+
+		vkglTF::AnimationStream::Source source;
+		source.path = sidecar;
+		source.valuesOffset = track.keyCount * sizeof(float);
+		source.keyCount = track.keyCount;
+		source.components = track.components;
+		source.interpolation = track.interpolation;
+		vkglTF::AnimationStream stream;
+		if (out && stream.open(source)) {
+			const uint32_t steps = track.keyCount * 4;
+			const float start = track.times[0];
+			const float deltaTime = (track.duration() - start) / steps;
+			std::vector<float> weights(track.components);
+			Result result = base;
+			result.stage = "stream";
+			result.keyframes = track.keyCount;
+			result.medianNs = medianNs(settings.iterations, [&]() {
+				uint32_t key = 0;
+				for (uint32_t s = 0; s < steps; s++) {
+					stream.sample(start + deltaTime * s, key, weights.data());
+				}
+			});
+			result.nsPerTarget = track.components ? result.medianNs / (static_cast<double>(steps) * track.components) : -1.0;
+			result.nsPerKeyframe = result.medianNs / track.keyCount;
+			results.push_back(result);
+			const vkglTF::AnimationStream::Stats stats = stream.stats();
+			std::cerr << "Streamed " << track.keyCount << " keys: " << stats.hits << " samples from loaded chunks, " << stats.misses << " from the preview, "
+				<< stats.loads << " chunks read, at most " << stream.residentBytes() << " of " << stream.trackBytes() << " bytes in memory" << std::endl;
+		} else {
+			std::cerr << "Could not stream from " << sidecar << std::endl;
+		}
+		stream.close();
+		std::remove(sidecar.c_str());
+	}
+
+	// One frame of a crowd, every instance on its own animation time (ModelInstance::updateAll)
+	if (keyframes > 0 && model.animationMaxTime > 0.0f && settings.instances > 0) {
+		std::vector<vkglTF::ModelInstance> instances;
+		for (uint32_t i = 0; i < settings.instances; i++) {
+			instances.push_back(vkglTF::ModelInstance(model, glm::mat4(1.0f), model.animationMaxTime * i / settings.instances));
+		}
+		std::vector<float> weightData(instances.size() * model.morphWeightData.size());
+		std::vector<glm::mat4> transforms(instances.size());
+		const float deltaTime = model.animationMaxTime / (keyframes * 4);
+		Result result = base;
+		result.stage = "animate_instances";
+		result.medianNs = medianNs(settings.iterations, [&]() {
+			vkglTF::ModelInstance::updateAll(instances, deltaTime, weightData.data(), transforms.data(), settings.animationThreads);
+		});
+		result.nsPerTarget = targets ? result.medianNs / (static_cast<double>(settings.instances) * targets) : -1.0;
+		results.push_back(result);
+	}
+
+	if (settings.gpu) {
+		benchFramesInFlight(base, gltfModel, settings, results);
+	}
+
+	// CPU blending with every kernel the machine supports
+	const vkglTF::MorphEvaluator::Kernel kernels[] = {
+		vkglTF::MorphEvaluator::KERNEL_SCALAR, vkglTF::MorphEvaluator::KERNEL_SSE,
+		vkglTF::MorphEvaluator::KERNEL_AVX2, vkglTF::MorphEvaluator::KERNEL_NEON
+	};
+	uint64_t morphVertices = 0;
+	for (auto &mesh : model.meshesMorph) {
+		morphVertices += mesh.vertexCount;
+	}
+	if (morphVertices == 0) {
+		return;
+	}
+	for (auto kernel : kernels) {
+		if (!vkglTF::MorphEvaluator::kernelSupported(kernel)) {
+			continue;
+		}
+		std::vector<vkglTF::Model::Vertex> blended;
+		Result result = base;
+		result.stage = "blend";
+		result.kernel = vkglTF::MorphEvaluator::kernelName(kernel);
+		result.vertices = morphVertices;
+		result.medianNs = medianNs(settings.iterations, [&]() {
+			for (auto &mesh : model.meshesMorph) {
+				vkglTF::MorphEvaluator::blendMesh(model, mesh, blended, kernel);
+			}
+		});
+		result.nsPerVertex = result.medianNs / morphVertices;
+		result.nsPerTarget = targets ? result.medianNs / (morphVertices * targets) : -1.0;
+		results.push_back(result);
+	}
+}
+
+static bool parseAsset(tinygltf::TinyGLTF &gltfContext, tinygltf::Model &gltfModel, std::string &error, const std::string &filename)
+{
+	if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".glb") == 0) {
+		return gltfContext.LoadBinaryFromFile(&gltfModel, &error, filename.c_str());
+	}
+	return gltfContext.LoadASCIIFromFile(&gltfModel, &error, filename.c_str());
+}
+
+static void benchAssets(const Settings &settings, std::vector<Result> &results)
+{
+	for (auto path : bundledModels) {
+		std::string filename = settings.dataDir + path;
+		tinygltf::Model gltfModel;
+		tinygltf::TinyGLTF gltfContext;
+		std::string error;
+		if (!parseAsset(gltfContext, gltfModel, error, filename)) {
+			std::cerr << "Skipping " << filename << ": " << error << std::endl;
+			continue;
+		}
+
+		Result parse;
+		parse.input = path;
+		parse.kind = "asset";
+		parse.stage = "parse";
+		parse.iterations = settings.iterations;
+		parse.medianNs = medianNs(settings.iterations, [&]() {
+			tinygltf::Model parsed;
+			parseAsset(gltfContext, parsed, error, filename);
+		});
+		results.push_back(parse);
+
+		// Whole loadFromFile with the buffers copied into tinygltf and read in place from the mapped files
+		for (int mapped = 0; mapped < 2; mapped++) {
+			Result load = parse;
+			load.stage = mapped ? "load_file_mapped" : "load_file";
+			load.medianNs = medianNs(settings.iterations, [&]() {
+				vkglTF::Model loaded;
+				loaded.quantizeMorphDeltas = settings.quantize;
+				loaded.mapBufferData = mapped != 0;
+				loaded.loadThreads = settings.loadThreads;
+				loaded.bakeAnimationRate = settings.bakeRate;
+				loaded.compressAnimationTolerance = settings.compressTolerance;
+				loaded.loadFromFile(filename, nullptr, VK_NULL_HANDLE);
+			});
+			results.push_back(load);
+		}
+
+		if (!settings.cacheDir.empty()) {
+			// Parse and load replaced by the binary model cache, the untimed warm up load writes it
+			std::string cacheFile = path;
+			std::replace(cacheFile.begin(), cacheFile.end(), '/', '_');
+			cacheFile = settings.cacheDir + cacheFile + ".vkgc";
+			auto loadCached = [&]() {
+				vkglTF::Model cached;
+				cached.quantizeMorphDeltas = settings.quantize;
+				cached.cacheFile = cacheFile;
+				cached.loadThreads = settings.loadThreads;
+				cached.bakeAnimationRate = settings.bakeRate;
+				cached.compressAnimationTolerance = settings.compressTolerance;
+				cached.loadFromFile(filename, nullptr, VK_NULL_HANDLE);
+			};
+			Result cachedLoad = parse;
+			cachedLoad.stage = "load_cached";
+			cachedLoad.medianNs = medianNs(settings.iterations, loadCached);
+			results.push_back(cachedLoad);
+		}
+
+		benchModel(path, "asset", gltfModel, settings, results);
+	}
+}
+
+static void benchSynthetic(const Settings &settings, std::vector<Result> &results)
+{
+	for (auto vertexCount : settings.vertexCounts) {
+		for (auto targetCount : settings.targetCounts) {
+			// POSITION and NORMAL delta per target, stored once in the glTF buffer and once packed by the loader
+			uint64_t morphBytes = static_cast<uint64_t>(uint64_t(vertexCount) * targetCount * 2 * 3 * sizeof(float) * std::min(settings.coverage, 1.0f));
+			if (morphBytes > settings.maxMorphBytes) {
+				std::cerr << "Skipping " << vertexCount << " vertices x " << targetCount << " targets, morph data exceeds --max-morph-mb" << std::endl;
+				continue;
+			}
+			std::stringstream name;
+			name << "synthetic_v" << vertexCount << "_t" << targetCount;
+			if (settings.coverage < 1.0f) {
+				name << "_c" << settings.coverage;
+			}
+			if (settings.active < 1.0f) {
+				name << "_a" << settings.active;
+			}
+			if (settings.meshes > 1) {
+				name << "_m" << settings.meshes;
+			}
+			if (settings.quantize) {
+				name << "_q";
+			}
+			if (settings.interpolation != "LINEAR") {
+				name << "_" << (settings.interpolation == "STEP" ? "step" : "cubic");
+			}
+			if (settings.bakeRate > 0.0f) {
+				name << "_b" << settings.bakeRate;
+			}
+			if (settings.compressTolerance > 0.0f) {
+				name << "_k" << settings.compressTolerance;
+			}
+			std::cerr << "Running " << name.str() << std::endl;
+
+			tinygltf::Model gltfModel;
+			buildSyntheticModel(vertexCount, targetCount, settings.keyframes, settings.interpolation, settings.coverage, settings.active, settings.meshes, gltfModel);
+			benchModel(name.str(), "synthetic", gltfModel, settings, results);
+		}
+	}
+}
+
+static std::string field(double value)
+{
+	if (value < 0.0) {
+		return "";
+	}
+	std::stringstream ss;
+	ss.precision(6);
+	ss << std::fixed << value;
+	return ss.str();
+}
+
+static void writeCSV(std::ostream &out, const std::vector<Result> &results)
+{
+	out << "input,kind,stage,kernel,vertices,targets,keyframes,iterations,median_ns,ns_per_vertex,ns_per_target,ns_per_keyframe\n";
+	for (auto &r : results) {
+		out << r.input << "," << r.kind << "," << r.stage << "," << r.kernel << ","
+			<< r.vertices << "," << r.targets << "," << r.keyframes << "," << r.iterations << ","
+			<< field(r.medianNs) << "," << field(r.nsPerVertex) << "," << field(r.nsPerTarget) << "," << field(r.nsPerKeyframe) << "\n";
+	}
+}
+
+static void writeJSON(std::ostream &out, const std::vector<Result> &results)
+{
+	auto number = [](double value) { return value < 0.0 ? std::string("null") : field(value); };
+	out << "{\n  \"kernel\": \"" << vkglTF::MorphEvaluator::kernelName(vkglTF::MorphEvaluator::bestKernel()) << "\",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		out << "    {\"input\": \"" << r.input << "\", \"kind\": \"" << r.kind << "\", \"stage\": \"" << r.stage << "\", \"kernel\": \"" << r.kernel << "\""
+			<< ", \"vertices\": " << r.vertices << ", \"targets\": " << r.targets << ", \"keyframes\": " << r.keyframes << ", \"iterations\": " << r.iterations
+			<< ", \"median_ns\": " << number(r.medianNs) << ", \"ns_per_vertex\": " << number(r.nsPerVertex)
+			<< ", \"ns_per_target\": " << number(r.nsPerTarget) << ", \"ns_per_keyframe\": " << number(r.nsPerKeyframe) << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+static std::vector<uint32_t> parseList(const char *arg)
+{
+	std::vector<uint32_t> values;
+	std::stringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		values.push_back(static_cast<uint32_t>(strtoul(item.c_str(), nullptr, 10)));
+	}
+	return values;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: morph-bench [options]\n"
+		<< "  --format json|csv     Output format (default json)\n"
+		<< "  --output <file>       Write results to file instead of stdout\n"
+		<< "  --data <dir>          Data directory containing models/\n"
+		<< "  --iterations <n>      Timed runs per measurement, the median is reported (default 5)\n"
+		<< "  --vertices <a,b,..>   Synthetic vertex counts (default 10000,100000,1000000,5000000)\n"
+		<< "  --targets <a,b,..>    Synthetic morph target counts (default 1,8,64,256)\n"
+		<< "  --keyframes <n>       Synthetic keyframe count (default 120)\n"
+		<< "  --interpolation <linear|step|cubic> Interpolation of the synthetic weight animation (default linear)\n"
+		<< "  --bake-rate <n>       Bake the weight animations to n keys per second at load (vkglTF::Model::bakeAnimationRate)\n"
+		<< "  --compress <e>        Reduce and quantize the weight animations at load within e (vkglTF::Model::compressAnimationTolerance)\n"
+		<< "  --coverage <0-1>      Fraction of vertices each synthetic target moves, below 1 targets are sparse accessors (default 1)\n"
+		<< "  --active <0-1>        Fraction of synthetic targets with non zero weights (default 1)\n"
+		<< "  --meshes <n>          Split the synthetic vertices over n meshes (default 1)\n"
+		<< "  --quantize            Load with quantized morph deltas (vkglTF::Model::quantizeMorphDeltas)\n"
+		<< "  --load-threads <n>    Threads packing the primitives while loading, 0 uses all hardware threads (default 1)\n"
+		<< "  --instances <n>       Instances animated per update in the animate_instances stage, 0 skips it (default 1000)\n"
+		<< "  --animation-threads <n> Threads updating the instances, 0 uses all hardware threads (default 1)\n"
+		<< "  --cache-dir <dir>     Also time loading the bundled models from a binary model cache written to <dir>\n"
+		<< "  --stream-dir <dir>    Also time playing the first animated mesh streamed from a file written to <dir> (vkglTF::AnimationStream)\n"
+		<< "  --max-morph-mb <n>    Skip synthetic meshes with more morph data than this (default 1024)\n"
+		<< "  --no-assets           Skip the bundled models\n"
+		<< "  --no-synthetic        Skip the generated meshes\n"
+		<< "  --frames-in-flight <a,b,..> Also time the frame loop with a, b.. frames in flight on a Vulkan device, e.g. 1,2,3\n"
+		<< "  --frames <n>          Frames timed per frames in flight count (default 500)\n";
+}
+
+int main(const int argc, const char *argv[])
+{
+	Settings settings;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (arg == "--format" && hasValue) {
+			settings.format = argv[++i];
+		} else if (arg == "--output" && hasValue) {
+			settings.output = argv[++i];
+		} else if (arg == "--data" && hasValue) {
+			settings.dataDir = argv[++i];
+			if (!settings.dataDir.empty() && settings.dataDir.back() != '/') {
+				settings.dataDir += "/";
+			}
+		} else if (arg == "--iterations" && hasValue) {
+			settings.iterations = std::max(1u, static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+		} else if (arg == "--vertices" && hasValue) {
+			settings.vertexCounts = parseList(argv[++i]);
+		} else if (arg == "--targets" && hasValue) {
+			settings.targetCounts = parseList(argv[++i]);
+		} else if (arg == "--keyframes" && hasValue) {
+			settings.keyframes = std::max(2u, static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+		} else if (arg == "--interpolation" && hasValue) {
+			const std::string interpolation = argv[++i];
+			settings.interpolation = (interpolation == "step") ? "STEP" : (interpolation == "cubic") ? "CUBICSPLINE" : "LINEAR";
+		} else if (arg == "--bake-rate" && hasValue) {
+			settings.bakeRate = std::max(0.0f, static_cast<float>(atof(argv[++i])));
+		} else if (arg == "--compress" && hasValue) {
+			settings.compressTolerance = std::max(0.0f, static_cast<float>(atof(argv[++i])));
+		} else if (arg == "--coverage" && hasValue) {
+			settings.coverage = std::min(1.0f, std::max(0.0f, static_cast<float>(atof(argv[++i]))));
+		} else if (arg == "--active" && hasValue) {
+			settings.active = std::min(1.0f, std::max(0.0f, static_cast<float>(atof(argv[++i]))));
+		} else if (arg == "--instances" && hasValue) {
+			settings.instances = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--animation-threads" && hasValue) {
+			settings.animationThreads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--meshes" && hasValue) {
+			settings.meshes = std::max(1u, static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+		} else if (arg == "--load-threads" && hasValue) {
+			settings.loadThreads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--quantize") {
+			settings.quantize = true;
+		} else if (arg == "--cache-dir" && hasValue) {
+			settings.cacheDir = argv[++i];
+			if (!settings.cacheDir.empty() && settings.cacheDir.back() != '/') {
+				settings.cacheDir += "/";
+			}
+		} else if (arg == "--stream-dir" && hasValue) {
+			settings.streamDir = argv[++i];
+			if (!settings.streamDir.empty() && settings.streamDir.back() != '/') {
+				settings.streamDir += "/";
+			}
+		} else if (arg == "--max-morph-mb" && hasValue) {
+			settings.maxMorphBytes = strtoull(argv[++i], nullptr, 10) * 1024ull * 1024ull;
+		} else if (arg == "--no-assets") {
+			settings.assets = false;
+		} else if (arg == "--no-synthetic") {
+			settings.synthetic = false;
+		} else if (arg == "--frames-in-flight" && hasValue) {
+			settings.framesInFlight = parseList(argv[++i]);
+			for (auto &count : settings.framesInFlight) {
+				count = std::max(count, 1u);
+			}
+		} else if (arg == "--frames" && hasValue) {
+			settings.frames = std::max(1u, static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+		} else {
+			printUsage();
+			return (arg == "--help" || arg == "-h") ? 0 : 1;
+		}
+	}
+	if (settings.format != "json" && settings.format != "csv") {
+		printUsage();
+		return 1;
+	}
+
+	GpuContext gpu;
+	if (!settings.framesInFlight.empty()) {
+		if (gpu.create()) {
+			settings.gpu = &gpu;
+		} else {
+			std::cerr << "No Vulkan device, skipping the frames in flight stage" << std::endl;
+		}
+	}
+
+	std::vector<Result> results;
+	if (settings.assets) {
+		benchAssets(settings, results);
+	}
+	if (settings.synthetic) {
+		benchSynthetic(settings, results);
+	}
+	gpu.destroy();
+
+	std::ofstream file;
+	if (!settings.output.empty()) {
+		file.open(settings.output);
+		if (!file.is_open()) {
+			std::cerr << "Could not open " << settings.output << std::endl;
+			return 1;
+		}
+	}
+	std::ostream &out = settings.output.empty() ? std::cout : file;
+	if (settings.format == "csv") {
+		writeCSV(out, results);
+	} else {
+		writeJSON(out, results);
+	}
+	return 0;
+}
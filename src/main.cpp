@@ -21,6 +21,9 @@
 #include "VulkanExampleBase.h"
 #include "VulkanTexture.hpp"
 #include "VulkanglTFModel.hpp"
+#include "ModelInstance.hpp"
+#include "MorphPipelineVariants.hpp"
+#include "ProcessMemory.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -98,14 +101,17 @@ public:
 
 	struct Buffer {
 		VkBuffer buffer;
-		VkDeviceMemory memory;
+		vks::Allocation memory;
 		VkDescriptorBufferInfo descriptor;
 		void *mapped;
 	};
 
 	struct UniformBuffers {
-		Buffer morphTaret; // SSBO block
-		Buffer cube;
+		Buffer morphTaret; // SSBO block, only the descriptor is used, the buffer is owned and uploaded by the model (Model::morphTargets)
+		Buffer morphWeights; // SSBO updated every frame, one region per swap chain image (bound with a dynamic offset)
+		Buffer cube; // one region per swap chain image (bound with a dynamic offset)
+		Buffer instanceTransforms; // SSBO, one region per swap chain image (bound with a dynamic offset)
+		Buffer nodeTransforms; // SSBO of the model's node world matrices, one region per swap chain image (bound with a dynamic offset)
 	} uniformBuffers;
 
 	struct UBOMatrices {
@@ -118,23 +124,56 @@ public:
 	struct PipelineLayouts {
 		VkPipelineLayout morph;
 		VkPipelineLayout normal;
+		VkPipelineLayout morphCompute;
 	} pipelineLayouts;
 
 	struct Pipelines {
-		VkPipeline morph;
 		VkPipeline normal;
+		VkPipeline morphCompute;
 	} pipelines;
+	// morph.vert specialized per mesh layout, --generic-morph-pipeline draws every mesh with the generic variant
+	vkglTF::MorphPipelineVariants morphVariants;
+	// Variant of every morph mesh, for Model::drawMorph
+	std::vector<VkPipeline> morphMeshPipelines;
 
 	struct DescriptorSetLayouts {
 		VkDescriptorSetLayout morph;
 		VkDescriptorSetLayout normal;
+		VkDescriptorSetLayout morphCompute;
 	} descriptorSetLayouts;
 
 	struct DescriptorSets {
 		VkDescriptorSet morph;
 		VkDescriptorSet normal;
+		VkDescriptorSet morphCompute;
 	} descriptorSets;
 
+	// Blend the morph targets in a compute pass once per frame instead of in morph.vert (toggle with B or --compute-morph)
+	bool computeMorph = false;
+	// Command buffers are only recorded on resize or scene changes, the weights change through morphWeights
+	// --rerecord-every-frame re-records the command buffer of every animated frame instead, to compare the cost
+	bool rerecordCommandBuffers = false;
+	// Run the load copies on a dedicated transfer queue family if there is one (--no-transfer-queue uses the graphics queue)
+	bool useTransferQueue = true;
+
+	// Copies of the morph meshes drawn with one instanced draw per primitive, each animated on its own time (--instances)
+	uint32_t instanceCount = 1;
+	std::vector<vkglTF::ModelInstance> instances;
+	// Written by ModelInstance::updateAll, copied into the region of the next image
+	std::vector<float> instanceWeightData;
+	std::vector<glm::mat4> instanceTransformData;
+	// Threads updating the instances, 0 uses all hardware threads (--animation-threads)
+	uint32_t animationThreads = 0;
+	// Playback rate of every instance, negative plays backwards (--animation-rate)
+	float animationRate = 1.0f;
+
+	// uniformBuffers.cube, morphWeights, instanceTransforms and nodeTransforms hold one region per swap chain image, the one of image i starts at i * regionSize
+	uint32_t imageRegionCount = 0;
+	VkDeviceSize uboRegionSize = 0;
+	VkDeviceSize weightRegionSize = 0;
+	VkDeviceSize transformRegionSize = 0;
+	VkDeviceSize nodeRegionSize = 0;
+
 	glm::vec3 rotation = glm::vec3(0.0f, 0.0f, 0.0f);
 
 	VulkanExample() : VulkanExampleBase()
@@ -146,24 +185,76 @@ public:
 		camera.rotationSpeed = 0.25f;
 		camera.setRotation({ 0.0f, 0.0f, 0.0f });
 		camera.setPosition({ 0.0f, 0.0f, -3.5f });
+		for (size_t i = 0; i < args.size(); i++) {
+			if (args[i] == std::string("--compute-morph")) {
+				computeMorph = true;
+			}
+			if (args[i] == std::string("--rerecord-every-frame")) {
+				rerecordCommandBuffers = true;
+			}
+			if (args[i] == std::string("--no-transfer-queue")) {
+				useTransferQueue = false;
+			}
+			if (args[i] == std::string("--quantize-morph")) {
+				models.cube.quantizeMorphDeltas = true;
+			}
+			if (args[i] == std::string("--generic-morph-pipeline")) {
+				morphVariants.specialize = false;
+			}
+			if ((args[i] == std::string("--model-cache")) && (i + 1 < args.size())) {
+				models.cube.cacheFile = args[i + 1];
+			}
+			if ((args[i] == std::string("--load-threads")) && (i + 1 < args.size())) {
+				models.cube.loadThreads = static_cast<uint32_t>(atoi(args[i + 1]));
+			}
+			if ((args[i] == std::string("--instances")) && (i + 1 < args.size())) {
+				instanceCount = std::max(atoi(args[i + 1]), 1);
+			}
+			if ((args[i] == std::string("--animation-threads")) && (i + 1 < args.size())) {
+				animationThreads = static_cast<uint32_t>(atoi(args[i + 1]));
+			}
+			if ((args[i] == std::string("--animation-rate")) && (i + 1 < args.size())) {
+				animationRate = static_cast<float>(atof(args[i + 1]));
+			}
+			if ((args[i] == std::string("--bake-animation")) && (i + 1 < args.size())) {
+				models.cube.bakeAnimationRate = static_cast<float>(atof(args[i + 1]));
+			}
+			if ((args[i] == std::string("--bake-max-error")) && (i + 1 < args.size())) {
+				models.cube.bakeAnimationMaxError = static_cast<float>(atof(args[i + 1]));
+			}
+			if ((args[i] == std::string("--compress-animation")) && (i + 1 < args.size())) {
+				models.cube.compressAnimationTolerance = static_cast<float>(atof(args[i + 1]));
+			}
+			if ((args[i] == std::string("--stream-animation")) && (i + 1 < args.size())) {
+				models.cube.streamAnimationKeys = static_cast<uint32_t>(atoi(args[i + 1]));
+			}
+		}
+		// The compute pass blends a single copy of the morph meshes, instances would all be drawn with the weights of the first
+		if (computeMorph && instanceCount > 1) {
+			std::cerr << "--compute-morph can not be combined with --instances greater than 1" << std::endl;
+			exit(-1);
+		}
 	}
 
 	~VulkanExample()
 	{
-		vkDestroyPipeline(device, pipelines.morph, nullptr);
+		morphVariants.destroy();
 		vkDestroyPipeline(device, pipelines.normal, nullptr);
+		vkDestroyPipeline(device, pipelines.morphCompute, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayouts.morph, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.normal, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.morphCompute, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.morph, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.normal, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.morphCompute, nullptr);
 
-		models.cube.destroy(device);
+		models.cube.destroy(vulkanDevice);
 
-		vkDestroyBuffer(device, uniformBuffers.cube.buffer, nullptr);
-		vkFreeMemory(device, uniformBuffers.cube.memory, nullptr);
-		vkDestroyBuffer(device, uniformBuffers.morphTaret.buffer, nullptr);
-		vkFreeMemory(device, uniformBuffers.morphTaret.memory, nullptr);
+		vulkanDevice->destroyBuffer(uniformBuffers.cube.buffer, uniformBuffers.cube.memory);
+		vulkanDevice->destroyBuffer(uniformBuffers.morphWeights.buffer, uniformBuffers.morphWeights.memory);
+		vulkanDevice->destroyBuffer(uniformBuffers.instanceTransforms.buffer, uniformBuffers.instanceTransforms.memory);
+		vulkanDevice->destroyBuffer(uniformBuffers.nodeTransforms.buffer, uniformBuffers.nodeTransforms.memory);
 	}
 
 	void reBuildCommandBuffers()
@@ -177,6 +268,22 @@ public:
 	}
 
 	void buildCommandBuffers()
+	{
+		// The swap chain can come back with more images after a resize
+		if (imageRegionCount < drawCmdBuffers.size()) {
+			preparePerImageBuffers();
+			updatePerImageDescriptors();
+		}
+
+		for (uint32_t i = 0; i < drawCmdBuffers.size(); ++i) {
+			buildCommandBuffer(i);
+		}
+	}
+
+	/*
+		Records the command buffer of swap chain image i, which must not be in use by the GPU
+	*/
+	void buildCommandBuffer(uint32_t i)
 	{
 		VkCommandBufferBeginInfo cmdBufferBeginInfo{};
 		cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -201,38 +308,56 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = settings.multiSampling ? 3 : 2;
 		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.framebuffer = frameBuffers[i];
+
+		// Matrices and weights written by render() for this image, in binding order
+		const uint32_t uboOffset = static_cast<uint32_t>(i * uboRegionSize);
+		const uint32_t weightOffset = static_cast<uint32_t>(i * weightRegionSize);
+		const uint32_t transformOffset = static_cast<uint32_t>(i * transformRegionSize);
+		const uint32_t nodeOffset = static_cast<uint32_t>(i * nodeRegionSize);
+		const uint32_t morphOffsets[4] = { uboOffset, weightOffset, transformOffset, nodeOffset };
+		const uint32_t normalOffsets[2] = { uboOffset, nodeOffset };
+
+		VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufferBeginInfo));
+
+		if (computeMorph) {
+			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.morphCompute);
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.morphCompute, 0, 1, &descriptorSets.morphCompute, 1, &weightOffset);
+			models.cube.dispatchMorph(drawCmdBuffers[i], pipelineLayouts.morphCompute);
+		}
 
-		for (size_t i = 0; i < drawCmdBuffers.size(); ++i) {
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufferBeginInfo));
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			VkViewport viewport{};
-			viewport.width = (float)width;
-			viewport.height = (float)height;
-			viewport.minDepth = 0.0f;
-			viewport.maxDepth = 1.0f;
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+		vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			VkRect2D scissor{};
-			scissor.extent = { width, height };
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+		VkViewport viewport{};
+		viewport.width = (float)width;
+		viewport.height = (float)height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
 
-			VkDeviceSize offsets[1] = { 0 };
+		VkRect2D scissor{};
+		scissor.extent = { width, height };
+		vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.morph, 0, 1, &descriptorSets.morph, 0, NULL);
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.morph);
-			models.cube.drawMorph(drawCmdBuffers[i], pipelineLayouts.morph);
+		VkDeviceSize offsets[1] = { 0 };
 
-			// TODO - profile if its faster to rebind diff pipeline/descriptor or both use morph's and have normal ignore the extra buffers and push const
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.normal, 0, 1, &descriptorSets.normal, 0, NULL);
+		if (computeMorph) {
+			// Already blended, draw as plain vertices
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.normal, 0, 1, &descriptorSets.normal, 2, normalOffsets);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.normal);
-			models.cube.drawNormal(drawCmdBuffers[i]);
-
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
+			models.cube.drawMorph(drawCmdBuffers[i], pipelineLayouts.normal, true);
+		} else {
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.morph, 0, 1, &descriptorSets.morph, 4, morphOffsets);
+			models.cube.drawMorph(drawCmdBuffers[i], pipelineLayouts.morph, false, instanceCount, morphMeshPipelines.data());
 		}
+
+		// TODO - profile if its faster to rebind diff pipeline/descriptor or both use morph's and have normal ignore the extra buffers and push const
+		vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.normal, 0, 1, &descriptorSets.normal, 2, normalOffsets);
+		vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.normal);
+		models.cube.drawNormal(drawCmdBuffers[i], pipelineLayouts.normal);
+
+		vkCmdEndRenderPass(drawCmdBuffers[i]);
+		VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 	}
 
 	void loadAssets()
@@ -251,10 +376,29 @@ public:
 			exit(-1);
 		}
 #endif
+		vulkanDevice->uploadManager.useTransferQueue = useTransferQueue;
+		// Peak of the load alone where the peak can be reset, of the whole run so far otherwise
+		const bool loadPeakOnly = vks::resetPeakResidentSetSize();
 //		models.cube.loadFromFile(assetpath + "models/AnimatedMorphCube/glTF/AnimatedMorphCube.gltf", vulkanDevice, queue);
 //		models.cube.loadFromFile(assetpath + "models/AnimatedMorphSphere/glTF/AnimatedMorphSphere.gltf", vulkanDevice, queue);
 		models.cube.loadFromFile(assetpath + "models/fourCube/fourCube.gltf", vulkanDevice, queue);
 //		models.cube.loadFromFile(assetpath + "models/twoCube/twoCube.gltf", vulkanDevice, queue);
+		std::cout << "Peak resident memory " << (loadPeakOnly ? "during load: " : "after load: ")
+			<< vks::peakResidentSetSize() / 1024 << " KiB" << std::endl;
+
+		// A square grid of copies, their animations staggered so they do not move in lockstep
+		const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount))));
+		const float spacing = 3.0f;
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			glm::vec3 offset((i % columns) * spacing, (i / columns) * spacing, 0.0f);
+			offset -= glm::vec3((columns - 1) * spacing * 0.5f, ((instanceCount - 1) / columns) * spacing * 0.5f, 0.0f);
+			const float time = models.cube.animationMaxTime * static_cast<float>(i) / static_cast<float>(instanceCount);
+			instances.push_back(vkglTF::ModelInstance(models.cube, glm::translate(glm::mat4(1.0f), offset), time));
+			instances.back().playback.rate = animationRate;
+		}
+		instanceWeightData.resize(instances.size() * models.cube.morphWeightData.size());
+		instanceTransformData.resize(instances.size());
+		updateInstances(0.0f);
 
 		// Need to wait until we get morph target data to build storage buffer for it
 		prepareStorageBuffers();
@@ -266,14 +410,15 @@ public:
 			Descriptor Pool
 		*/
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 },
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 5 },
 		};
 		VkDescriptorPoolCreateInfo descriptorPoolCI{};
 		descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 		descriptorPoolCI.pPoolSizes = poolSizes.data();
-		descriptorPoolCI.maxSets = 2;
+		descriptorPoolCI.maxSets = 3;
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &descriptorPool));
 
 		/*
@@ -281,8 +426,11 @@ public:
 		*/
 		{
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
 				{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
 			};
 
 			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
@@ -298,10 +446,10 @@ public:
 			descriptorSetAllocInfo.descriptorSetCount = 1;
 			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &descriptorSets.morph));
 
-			std::vector<VkWriteDescriptorSet> writeDescriptorSets(2);
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets(5);
 
 			writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 			writeDescriptorSets[0].descriptorCount = 1;
 			writeDescriptorSets[0].dstSet = descriptorSets.morph;
 			writeDescriptorSets[0].dstBinding = 0;
@@ -314,11 +462,33 @@ public:
 			writeDescriptorSets[1].dstBinding = 1;
 			writeDescriptorSets[1].pBufferInfo = &uniformBuffers.morphTaret.descriptor;
 
+			writeDescriptorSets[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			writeDescriptorSets[2].descriptorCount = 1;
+			writeDescriptorSets[2].dstSet = descriptorSets.morph;
+			writeDescriptorSets[2].dstBinding = 2;
+			writeDescriptorSets[2].pBufferInfo = &uniformBuffers.morphWeights.descriptor;
+
+			writeDescriptorSets[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			writeDescriptorSets[3].descriptorCount = 1;
+			writeDescriptorSets[3].dstSet = descriptorSets.morph;
+			writeDescriptorSets[3].dstBinding = 3;
+			writeDescriptorSets[3].pBufferInfo = &uniformBuffers.instanceTransforms.descriptor;
+
+			writeDescriptorSets[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			writeDescriptorSets[4].descriptorCount = 1;
+			writeDescriptorSets[4].dstSet = descriptorSets.morph;
+			writeDescriptorSets[4].dstBinding = 4;
+			writeDescriptorSets[4].pBufferInfo = &uniformBuffers.nodeTransforms.descriptor;
+
 			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 		}
 		{
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
+				{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT , nullptr },
 			};
 
 			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
@@ -334,15 +504,67 @@ public:
 			descriptorSetAllocInfo.descriptorSetCount = 1;
 			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &descriptorSets.normal));
 
-			std::vector<VkWriteDescriptorSet> writeDescriptorSets(1);
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets(2);
 
 			writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 			writeDescriptorSets[0].descriptorCount = 1;
 			writeDescriptorSets[0].dstSet = descriptorSets.normal;
 			writeDescriptorSets[0].dstBinding = 0;
 			writeDescriptorSets[0].pBufferInfo = &uniformBuffers.cube.descriptor;
 
+			writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			writeDescriptorSets[1].descriptorCount = 1;
+			writeDescriptorSets[1].dstSet = descriptorSets.normal;
+			writeDescriptorSets[1].dstBinding = 1;
+			writeDescriptorSets[1].pBufferInfo = &uniformBuffers.nodeTransforms.descriptor;
+
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+		}
+		{
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT , nullptr }, // base vertices
+				{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT , nullptr }, // morph target data
+				{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT , nullptr }, // weights
+				{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT , nullptr }, // blended vertices
+			};
+
+			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+			descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+			descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.morphCompute));
+
+			VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+			descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			descriptorSetAllocInfo.descriptorPool = descriptorPool;
+			descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.morphCompute;
+			descriptorSetAllocInfo.descriptorSetCount = 1;
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &descriptorSets.morphCompute));
+
+			// Models without morph meshes have no vertex buffers to blend
+			if (models.cube.verticesBlended.buffer == VK_NULL_HANDLE) {
+				computeMorph = false;
+				return;
+			}
+
+			VkDescriptorBufferInfo baseVertices = { models.cube.verticesMorph.buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo blendedVertices = { models.cube.verticesBlended.buffer, 0, VK_WHOLE_SIZE };
+			const VkDescriptorBufferInfo *bufferInfos[4] = {
+				&baseVertices, &uniformBuffers.morphTaret.descriptor, &uniformBuffers.morphWeights.descriptor, &blendedVertices
+			};
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets(4);
+			for (uint32_t i = 0; i < 4; i++) {
+				writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSets[i].descriptorType = (i == 2) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writeDescriptorSets[i].descriptorCount = 1;
+				writeDescriptorSets[i].dstSet = descriptorSets.morphCompute;
+				writeDescriptorSets[i].dstBinding = i;
+				writeDescriptorSets[i].pBufferInfo = bufferInfos[i];
+			}
+
 			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 		}
 	}
@@ -406,7 +628,7 @@ public:
 		std::array<VkDescriptorSetLayout, 1> setLayoutsNormal = { descriptorSetLayouts.normal };
 
 		VkPushConstantRange pushConstantRange{};
-		pushConstantRange.size = sizeof(vkglTF::Mesh::morphPushConst);
+		pushConstantRange.size = sizeof(vkglTF::MorphDrawPushConst);
 		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
@@ -418,9 +640,14 @@ public:
 
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayouts.morph));
 
+		// normal.vert only gets the node index
+		VkPushConstantRange normalPushConstantRange{};
+		normalPushConstantRange.size = sizeof(uint32_t);
+		normalPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
 		pipelineLayoutCI.pSetLayouts = setLayoutsNormal.data();
-		pipelineLayoutCI.pushConstantRangeCount = 0;
-		pipelineLayoutCI.pPushConstantRanges = nullptr;
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &normalPushConstantRange;
 
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayouts.normal));
 
@@ -464,10 +691,10 @@ public:
 			loadShader(device, "morph.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
 		};
 
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.morph));
-		for (auto shaderStage : shaderStages) {
-			vkDestroyShaderModule(device, shaderStage.module, nullptr);
-		}
+		// The variants keep the shader modules
+		morphVariants.init(device, pipelineCache, pipelineCI);
+		morphMeshPipelines = morphVariants.meshPipelines(models.cube);
+		std::cout << "Morph pipeline variants: " << morphVariants.size() << " for " << morphMeshPipelines.size() << " meshes" << std::endl;
 
 		// Normal Mesh pipeline
 		pipelineCI.layout = pipelineLayouts.normal;
@@ -480,6 +707,23 @@ public:
 		for (auto shaderStage : shaderStages) {
 			vkDestroyShaderModule(device, shaderStage.module, nullptr);
 		}
+
+		// Morph compute pipeline
+		VkPushConstantRange computePushConstantRange{};
+		computePushConstantRange.size = sizeof(vkglTF::MorphComputePushConst);
+		computePushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		pipelineLayoutCI.pSetLayouts = &descriptorSetLayouts.morphCompute;
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &computePushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayouts.morphCompute));
+
+		VkComputePipelineCreateInfo computePipelineCI{};
+		computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		computePipelineCI.layout = pipelineLayouts.morphCompute;
+		computePipelineCI.stage = loadShader(device, "morph.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &pipelines.morphCompute));
+		vkDestroyShaderModule(device, computePipelineCI.stage.module, nullptr);
 	}
 
 	/*
@@ -489,22 +733,9 @@ public:
 	{
 		// Set light position, not currently updating value
 		uboMatrices.lightPos = glm::vec4(2.0, -0.5, 7.0, 1.0);
-
-		// Cube vertex shader uniform buffer
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			sizeof(uboMatrices),
-			&uniformBuffers.cube.buffer,
-			&uniformBuffers.cube.memory));
-
-		// Descriptors
-		uniformBuffers.cube.descriptor = { uniformBuffers.cube.buffer, 0, sizeof(uboMatrices) };
-
-		// Map persistent
-		VK_CHECK_RESULT(vkMapMemory(device, uniformBuffers.cube.memory, 0, sizeof(uboMatrices), 0, &uniformBuffers.cube.mapped));
-
 		updateUniformBuffers();
+
+		preparePerImageBuffers();
 	}
 
 	/*
@@ -512,70 +743,128 @@ public:
 	 */
 	void prepareStorageBuffers()
 	{
-		VkBuffer stageBuffer;
-		VkDeviceMemory stageMemory;
-		uint32_t stagingSize = static_cast<uint32_t>(models.cube.morphVertexData.size() * sizeof(float));
+		// Loaded with the model, straight from staging memory, in its upload batch
+		uniformBuffers.morphTaret.buffer = models.cube.morphTargets.buffer;
+		uniformBuffers.morphTaret.descriptor = { uniformBuffers.morphTaret.buffer, 0, VK_WHOLE_SIZE };
+	}
 
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-			stagingSize,
-			&stageBuffer,
-			&stageMemory,
-		    models.cube.morphVertexData.data() ));
+	/*
+		The matrices, weights, instance and node transforms can change every frame while earlier frames are still in flight, so they are kept host
+		visible and persistently mapped, with one region per swap chain image
+		The command buffers are recorded once with the offsets of their regions, render() only rewrites the regions of
+		the image it submits next, which prepareFrame() guarantees the GPU is done reading
+	*/
+	void preparePerImageBuffers()
+	{
+		if (imageRegionCount > 0) {
+			vkDeviceWaitIdle(device);
+			Buffer *buffers[4] = { &uniformBuffers.cube, &uniformBuffers.morphWeights, &uniformBuffers.instanceTransforms, &uniformBuffers.nodeTransforms };
+			for (Buffer *buffer : buffers) {
+				vulkanDevice->destroyBuffer(buffer->buffer, buffer->memory);
+			}
+		}
+
+		auto alignedSize = [](VkDeviceSize size, VkDeviceSize alignment) {
+			alignment = std::max<VkDeviceSize>(alignment, 1);
+			return (size + alignment - 1) / alignment * alignment;
+		};
+		const VkPhysicalDeviceLimits &limits = vulkanDevice->properties.limits;
+		const VkDeviceSize weightSize = std::max<size_t>(instanceWeightData.size(), 1) * sizeof(float);
+		const VkDeviceSize transformSize = instanceTransformData.size() * sizeof(glm::mat4);
+		const VkDeviceSize nodeSize = std::max<size_t>(models.cube.nodeTransformData.size(), 1) * sizeof(glm::mat4);
+		uboRegionSize = alignedSize(sizeof(uboMatrices), limits.minUniformBufferOffsetAlignment);
+		weightRegionSize = alignedSize(weightSize, limits.minStorageBufferOffsetAlignment);
+		transformRegionSize = alignedSize(transformSize, limits.minStorageBufferOffsetAlignment);
+		nodeRegionSize = alignedSize(nodeSize, limits.minStorageBufferOffsetAlignment);
+		imageRegionCount = static_cast<uint32_t>(std::max<size_t>(drawCmdBuffers.size(), 1));
 
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			stagingSize,
-			&uniformBuffers.morphTaret.buffer,
-			&uniformBuffers.morphTaret.memory));
-
-		// Copy to staging buffer
-		VkCommandPool commandPool;
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = swapChain.queueNodeIndex; // TODO get a better way
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
-
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo = {};
-		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmdBufAllocateInfo.commandPool = commandPool;
-		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmdBufAllocateInfo.commandBufferCount = 1;
-
-		VkCommandBuffer copyCmd;
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
-		VkCommandBufferBeginInfo cmdBufInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-
-		VkBufferCopy copyRegion = {};
-		copyRegion.size = stagingSize;
-		vkCmdCopyBuffer(copyCmd, stageBuffer, uniformBuffers.morphTaret.buffer, 1, &copyRegion);
-		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &copyCmd;
-		VkFenceCreateInfo fenceCreateInfo {};
-		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceCreateInfo.flags = 0;
-		VkFence fence;
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
-
-		// Submit to the queue
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
-
-		vkDestroyFence(device, fence, nullptr);
-		vkFreeCommandBuffers(device, commandPool, 1, &copyCmd);
-		vkDestroyBuffer(device, stageBuffer, nullptr);
-		vkFreeMemory(device, stageMemory, nullptr);
-		vkDestroyCommandPool(device, commandPool, nullptr);
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			uboRegionSize * imageRegionCount,
+			&uniformBuffers.cube.buffer,
+			&uniformBuffers.cube.memory));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			weightRegionSize * imageRegionCount,
+			&uniformBuffers.morphWeights.buffer,
+			&uniformBuffers.morphWeights.memory));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			transformRegionSize * imageRegionCount,
+			&uniformBuffers.instanceTransforms.buffer,
+			&uniformBuffers.instanceTransforms.memory));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			nodeRegionSize * imageRegionCount,
+			&uniformBuffers.nodeTransforms.buffer,
+			&uniformBuffers.nodeTransforms.memory));
+		// The dynamic offsets select the region
+		uniformBuffers.cube.descriptor = { uniformBuffers.cube.buffer, 0, sizeof(uboMatrices) };
+		uniformBuffers.morphWeights.descriptor = { uniformBuffers.morphWeights.buffer, 0, weightSize };
+		uniformBuffers.instanceTransforms.descriptor = { uniformBuffers.instanceTransforms.buffer, 0, transformSize };
+		uniformBuffers.nodeTransforms.descriptor = { uniformBuffers.nodeTransforms.buffer, 0, nodeSize };
+		// Host visible pool blocks stay mapped, the allocations point into them
+		uniformBuffers.cube.mapped = uniformBuffers.cube.memory.mapped;
+		uniformBuffers.morphWeights.mapped = uniformBuffers.morphWeights.memory.mapped;
+		uniformBuffers.instanceTransforms.mapped = uniformBuffers.instanceTransforms.memory.mapped;
+		uniformBuffers.nodeTransforms.mapped = uniformBuffers.nodeTransforms.memory.mapped;
+		for (uint32_t i = 0; i < imageRegionCount; i++) {
+			updatePerImageData(i);
+		}
+	}
 
-		uniformBuffers.morphTaret.descriptor = { uniformBuffers.morphTaret.buffer, 0, VK_WHOLE_SIZE };
+	// Point the already allocated descriptor sets at recreated per image buffers
+	void updatePerImageDescriptors()
+	{
+		struct Binding {
+			VkDescriptorSet set;
+			uint32_t binding;
+			VkDescriptorType type;
+			const VkDescriptorBufferInfo *bufferInfo;
+		};
+		const Binding bindings[7] = {
+			{ descriptorSets.morph, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &uniformBuffers.cube.descriptor },
+			{ descriptorSets.morph, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, &uniformBuffers.morphWeights.descriptor },
+			{ descriptorSets.morph, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, &uniformBuffers.instanceTransforms.descriptor },
+			{ descriptorSets.morph, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, &uniformBuffers.nodeTransforms.descriptor },
+			{ descriptorSets.normal, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &uniformBuffers.cube.descriptor },
+			{ descriptorSets.normal, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, &uniformBuffers.nodeTransforms.descriptor },
+			{ descriptorSets.morphCompute, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, &uniformBuffers.morphWeights.descriptor },
+		};
+		// The compute set is left unwritten for models without morph meshes
+		const uint32_t count = (models.cube.verticesBlended.buffer != VK_NULL_HANDLE) ? 7 : 6;
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(count);
+		for (uint32_t i = 0; i < count; i++) {
+			writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writeDescriptorSets[i].descriptorType = bindings[i].type;
+			writeDescriptorSets[i].descriptorCount = 1;
+			writeDescriptorSets[i].dstSet = bindings[i].set;
+			writeDescriptorSets[i].dstBinding = bindings[i].binding;
+			writeDescriptorSets[i].pBufferInfo = bindings[i].bufferInfo;
+		}
+		vkUpdateDescriptorSets(device, count, writeDescriptorSets.data(), 0, NULL);
+	}
+
+	void updatePerImageData(uint32_t image)
+	{
+		char *ubo = static_cast<char*>(uniformBuffers.cube.mapped) + image * uboRegionSize;
+		memcpy(ubo, &uboMatrices, sizeof(uboMatrices));
+		char *weights = static_cast<char*>(uniformBuffers.morphWeights.mapped) + image * weightRegionSize;
+		memcpy(weights, instanceWeightData.data(), instanceWeightData.size() * sizeof(float));
+		char *transforms = static_cast<char*>(uniformBuffers.instanceTransforms.mapped) + image * transformRegionSize;
+		memcpy(transforms, instanceTransformData.data(), instanceTransformData.size() * sizeof(glm::mat4));
+		// Only changes when the application moves a node (Model::updateNodeTransforms), the vertex data stays as it is
+		char *nodeTransforms = static_cast<char*>(uniformBuffers.nodeTransforms.mapped) + image * nodeRegionSize;
+		memcpy(nodeTransforms, models.cube.nodeTransformData.data(), models.cube.nodeTransformData.size() * sizeof(glm::mat4));
+	}
+
+	void updateInstances(float deltaTime)
+	{
+		vkglTF::ModelInstance::updateAll(instances, deltaTime, instanceWeightData.data(), instanceTransformData.data(), animationThreads);
 	}
 
 	void updateUniformBuffers()
@@ -585,7 +874,7 @@ public:
 		uboMatrices.model = glm::rotate(uboMatrices.model, rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
 		uboMatrices.MVP = camera.matrices.perspective * camera.matrices.view * uboMatrices.model;
 		uboMatrices.camera = glm::vec4(camera.position * -1.0f, 1.0f);
-		memcpy(uniformBuffers.cube.mapped, &uboMatrices, sizeof(uboMatrices));
+		// Copied into the region of the next image by render()
 	}
 
 	void prepare()
@@ -595,8 +884,12 @@ public:
 		loadAssets();
 		prepareUniformBuffers();
 		setupDescriptors();
+		// Compare with and without --no-pipeline-cache, or on the first and second run
+		auto tPipelines = std::chrono::high_resolution_clock::now();
 		preparePipelines();
+		std::cout << "Pipelines created in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tPipelines).count() << " ms" << std::endl;
 		buildCommandBuffers();
+		vulkanDevice->memoryAllocator.printStats();
 
 		prepared = true;
 
@@ -609,9 +902,19 @@ public:
 		if (!prepared) {
 			return;
 		}
+		// Evaluated while the GPU still renders the previous frames
+		if (!paused) {
+			// Update all the models animation timers
+			auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tAnimation).count() / 1000.0f;
+			tAnimation = std::chrono::high_resolution_clock::now();
+			updateInstances(static_cast<float>(tDiff));
+		}
 		VulkanExampleBase::prepareFrame();
-		VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentBuffer], VK_TRUE, UINT64_MAX));
-		VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentBuffer]));
+		// Also while paused, every region has to catch up with the current matrices and weights
+		updatePerImageData(currentBuffer);
+		if (rerecordCommandBuffers && !paused) {
+			buildCommandBuffer(currentBuffer);
+		}
 		const VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -624,128 +927,23 @@ public:
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentBuffer]));
 		VulkanExampleBase::submitFrame();
-		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
-		if (!paused) {
-			// This is my implemenation of doing the animation loop
-			// Very naive approuch, but gets the job done, would like to clean up in future TODO
-
-//			test++; if (test % 500 == 0) { test = 0; std::cout << getWindowTitle() << std::endl; } // print out FPS
-
-			// Update all the models animation timers
-			auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tAnimation).count() / 1000.0f;
-			tAnimation = std::chrono::high_resolution_clock::now();
-			models.cube.currentTime += tDiff;
-
-			// need shared reset since curretTime is per model
-			bool reset = false;
-
-			for (auto& mesh: models.cube.meshesMorph) {
-
-				// check to reset loop
-				if (models.cube.currentTime > models.cube.animationMaxTime) {
-					mesh.currentIndex = 0;
-					reset = true;
-
-					// reset all weight data
-					for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-						mesh.morphPushConst.weights[i] = mesh.weightsInit[i];
-					}
-
-				} else {
-
-					// check where currentIndex is at
-					while (true) {
-						if (mesh.currentIndex == mesh.weightsTime.size() - 1) {
-							break; // at end
-						}
-
-						if (models.cube.currentTime > mesh.weightsTime[mesh.currentIndex + 1]) {
-							mesh.currentIndex++;
-						} else {
-							break;
-						}
-					}
-
-					// TODO all glTF sampler inputs are linear, don't need to compute for non-linear methods
-					switch (mesh.interpolation) {
-						// TODO clean up LINEAR math style to be readable
-						case vkglTF::Mesh::LINEAR:
-							if (mesh.currentIndex < mesh.weightsTime.size() - 1) {
-
-								float mixRate = (models.cube.currentTime - mesh.weightsTime[mesh.currentIndex]) /
-									(mesh.weightsTime[mesh.currentIndex + 1] - mesh.weightsTime[mesh.currentIndex]);
-
-								for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-									float weightDiff = mesh.weightsData[(mesh.currentIndex + 1) * mesh.weightsInit.size() + i] - mesh.weightsData[mesh.currentIndex * mesh.weightsInit.size() + i];
-									mesh.morphPushConst.weights[i] = (mixRate * weightDiff) + mesh.weightsData[mesh.currentIndex * mesh.weightsInit.size() + i];
-								}
-							} else {
-								// fill in with last index
-								for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-									mesh.morphPushConst.weights[i] =
-										mesh.weightsData[mesh.currentIndex * mesh.weightsInit.size() + i];
-								}
-							}
-							break;
-						case vkglTF::Mesh::STEP:
-							// sets weight to currentIndex only when step is reached
-							for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-								mesh.morphPushConst.weights[i] =
-									mesh.weightsData[mesh.currentIndex * mesh.weightsInit.size() + i];
-							}
-							break;
-						case vkglTF::Mesh::CUBICSPLINE:
-							// Implemented from https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#appendix-c-spline-interpolation
-							// p(t) = (2t^3 - 3t^2 + 1)p0 + (t^3 - 2t^2 + t)m0 + (-2t^3 + 3t^2)p1 + (t^3 - t^2)m1
-							// Assuming data is packed [in0, in1, ...inN, w0, w1, ...wN, out0, out1, ...outN]
-							if (mesh.currentIndex < mesh.weightsTime.size() - 1) {
-								//t = (tcurrent - tk) / (tk+1 - tk)
-								float tDelta = mesh.weightsTime[mesh.currentIndex + 1] - mesh.weightsTime[mesh.currentIndex];
-								float t = (models.cube.currentTime - mesh.weightsTime[mesh.currentIndex]) / tDelta;
-								assert(t >= 0.0f && t <= 1.0f);
-
-								float p0Const = (2 * pow(t, 3.0f)) - (3 * pow(t, 2.0f)) + 1.0f;
-								float m0Const = pow(t, 3.0f) - (2 * pow(t, 2.0f)) + t;
-								float p1Const = (-2 * pow(t, 3.0f)) + (3 * pow(t, 2.0f));
-								float m1Const = pow(t, 3.0f) - pow(t, 2.0f);
-
-								// This is assuming from https://github.com/KhronosGroup/glTF/issues/1344
-								int inTangentOffsetK1 = (mesh.currentIndex + 1) * mesh.weightsInit.size() * 3;
-								int vertexOffset = (mesh.currentIndex * mesh.weightsInit.size() * 3) + mesh.weightsInit.size();
-								int vertexOffsetK1 = ((mesh.currentIndex + 1) * mesh.weightsInit.size() * 3) + mesh.weightsInit.size();
-								int outTangentOffset = (mesh.currentIndex * mesh.weightsInit.size() * 3) + (mesh.weightsInit.size() * 2);
-
-								for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-									float p0 = p0Const * mesh.weightsData[vertexOffset + i];
-									float m0 = m0Const * (mesh.weightsData[outTangentOffset + i] * tDelta);
-									float p1 = p1Const * mesh.weightsData[vertexOffsetK1 + i];
-									float m1 = m1Const * (mesh.weightsData[inTangentOffsetK1 + i] * tDelta);
-									mesh.morphPushConst.weights[i] = p0 + m0 + p1 + m1; // finally!
-								}
-							} else {
-								// fill in with last index
-								for (size_t i = 0; i < mesh.weightsInit.size(); i++) {
-									mesh.morphPushConst.weights[i] =
-										mesh.weightsData[mesh.currentIndex * mesh.weightsInit.size() + i];
-								}
-							}
-							break;
-						default: std::cout << "Non supported interpolation" << std::endl;
-					}
-				}
-			} // for(mesh)
-
-			if (reset) {
-				models.cube.currentTime = 0.0f;
-			}
-			reBuildCommandBuffers();
-		} // if(!paused)
+//		test++; if (test % 500 == 0) { test = 0; std::cout << getWindowTitle() << std::endl; } // print out FPS
 	}
 
 	virtual void viewChanged()
 	{
 		updateUniformBuffers();
 	}
+
+	virtual void keyPressed(uint32_t key)
+	{
+		if (key == KEY_B && models.cube.verticesBlended.buffer != VK_NULL_HANDLE && instanceCount == 1) {
+			computeMorph = !computeMorph;
+			std::cout << "Morph blending: " << (computeMorph ? "compute pass" : "vertex shader") << std::endl;
+			vkDeviceWaitIdle(device);
+			reBuildCommandBuffers();
+		}
+	}
 };
 
 VulkanExample *vulkanExample;